@@ -0,0 +1,183 @@
+/****************************************************************/
+/* Microbenchmark for the character scanners in sources/scan.c */
+/*                                                              */
+/* Build: gcc -ansi -pedantic -Wall -O2 -Iheader \              */
+/*            bench/scan_bench.c sources/scan.c -o scan_bench   */
+/* Run:   ./scan_bench [buffer_size] [iterations]               */
+/*                                                              */
+/* Every available level is first checked against the scalar    */
+/* scanners on random text, then timed on the same buffers.     */
+/****************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "scan.h"
+
+#define DEFAULT_BUFFER_SIZE (1 << 20)
+#define DEFAULT_ITERATIONS 200
+#define CHECK_ROUNDS 20000
+#define MAX_CHECK_LENGTH 200
+
+static const char *level_names[] = {"scalar", "sse2", "avx2"};
+
+/* Fills a buffer with text resembling assembly source: short words, runs of blanks and newlines */
+static void fill_source_like(char *buffer, size_t size)
+{
+    static const char alphabet[] = "abcdefghXYZ0123456789#,:*.\"";
+    size_t i = 0;
+    int run;
+
+    while (i < size)
+    {
+        run = rand() % 12;
+        while (run-- > 0 && i < size)
+            buffer[i++] = alphabet[rand() % (sizeof(alphabet) - 1)];
+        run = rand() % 40;
+        while (run-- > 0 && i < size)
+            buffer[i++] = (rand() % 4 == 0) ? '\t' : ' ';
+        if (i < size && rand() % 3 == 0)
+            buffer[i++] = '\n';
+    }
+}
+
+/* Fills a buffer with arbitrary bytes, including non-ASCII ones */
+static void fill_random(char *buffer, size_t size)
+{
+    static const char interesting[] = " \t\n\v\f\r\x08\x0e\x1f az AZ09@[`{/:\x80\xff";
+    size_t i;
+
+    for (i = 0; i < size; i++)
+    {
+        buffer[i] = (rand() % 2) ? interesting[rand() % (sizeof(interesting) - 1)] : (char)rand();
+    }
+}
+
+/* Runs the scanners of the active level over one slice */
+static void run_slice(const char *p, size_t length, const char **results, size_t *ident)
+{
+    results[0] = scan_newline(p, p + length);
+    results[1] = scan_skip_blanks(p, p + length);
+    results[2] = scan_trim_end(p, p + length);
+    *ident = scan_identifier_length(p, length);
+}
+
+/* Checks that a level returns exactly what the scalar scanners return */
+static int check_level(ScanLevel level, const char *buffer, size_t size)
+{
+    const char *expected[3];
+    const char *actual[3];
+    size_t expected_ident;
+    size_t actual_ident;
+    size_t offset;
+    size_t length;
+    int round;
+
+    for (round = 0; round < CHECK_ROUNDS; round++)
+    {
+        offset = (size_t)rand() % (size - MAX_CHECK_LENGTH);
+        length = (size_t)rand() % MAX_CHECK_LENGTH;
+
+        scan_set_level(SCAN_SCALAR);
+        run_slice(buffer + offset, length, expected, &expected_ident);
+        scan_set_level(level);
+        run_slice(buffer + offset, length, actual, &actual_ident);
+
+        if (memcmp(expected, actual, sizeof(expected)) != 0 || expected_ident != actual_ident)
+        {
+            fprintf(stderr, "Mismatch for %s at offset %lu, length %lu\n",
+                    level_names[level], (unsigned long)offset, (unsigned long)length);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Times the scanners of the active level over a whole buffer, line by line */
+static double time_level(const char *buffer, size_t size, int iterations)
+{
+    const char *end = buffer + size;
+    const char *p;
+    const char *line_end;
+    const char *first;
+    size_t checksum = 0;
+    clock_t start;
+    int i;
+
+    start = clock();
+    for (i = 0; i < iterations; i++)
+    {
+        p = buffer;
+        while (p < end)
+        {
+            line_end = scan_newline(p, end);
+            first = scan_skip_blanks(p, line_end);
+            checksum += (size_t)(scan_trim_end(first, line_end) - first);
+            checksum += scan_identifier_length(first, (size_t)(line_end - first));
+            p = line_end + 1;
+        }
+    }
+    if (checksum == 0)
+    {
+        printf("(empty checksum)\n");
+    }
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t size = DEFAULT_BUFFER_SIZE;
+    int iterations = DEFAULT_ITERATIONS;
+    char *source_like;
+    char *random_bytes;
+    double scalar_time = 0;
+    double seconds;
+    int level;
+    int failed = 0;
+
+    if (argc > 1)
+        size = (size_t)atol(argv[1]);
+    if (argc > 2)
+        iterations = atoi(argv[2]);
+    if (size < 2 * MAX_CHECK_LENGTH)
+        size = 2 * MAX_CHECK_LENGTH;
+
+    source_like = malloc(size);
+    random_bytes = malloc(size);
+    if (source_like == NULL || random_bytes == NULL)
+    {
+        fprintf(stderr, "Error: Failed to allocate benchmark buffers\n");
+        return 1;
+    }
+
+    srand(12345);
+    fill_source_like(source_like, size);
+    fill_random(random_bytes, size);
+
+    for (level = SCAN_SCALAR; level <= SCAN_AVX2; level++)
+    {
+        if (scan_set_level((ScanLevel)level) != 0)
+        {
+            printf("%-7s not supported on this CPU\n", level_names[level]);
+            continue;
+        }
+        if (check_level((ScanLevel)level, source_like, size) != 0 ||
+            check_level((ScanLevel)level, random_bytes, size) != 0)
+        {
+            failed = 1;
+            continue;
+        }
+
+        scan_set_level((ScanLevel)level);
+        seconds = time_level(source_like, size, iterations);
+        if (level == SCAN_SCALAR)
+            scalar_time = seconds;
+        printf("%-7s %8.3f s  %8.1f MB/s  x%.2f\n", level_names[level], seconds,
+               seconds > 0 ? (double)size * iterations / seconds / 1e6 : 0.0,
+               seconds > 0 ? scalar_time / seconds : 0.0);
+    }
+
+    free(source_like);
+    free(random_bytes);
+    return failed;
+}
@@ -0,0 +1,87 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+/*
+ * This header file contains declarations for the per-file arena allocator.
+ * Small allocations made while assembling a file (macro names and bodies,
+ * label copies) are carved out of large chunks instead of coming from
+ * malloc one by one. Nothing is freed individually: the whole arena is
+ * rewound when the file is done, and its chunks are reused by the next file.
+ */
+
+#include <stddef.h>
+
+/**
+ * A chunk of arena memory; the usable bytes follow the header.
+ */
+typedef struct ArenaChunk {
+    struct ArenaChunk *next;
+    size_t size;            /* Usable bytes in the chunk */
+    size_t used;            /* Bytes handed out since the arena was last reset */
+} ArenaChunk;
+
+/**
+ * A bump allocator made of a chain of chunks.
+ */
+typedef struct {
+    ArenaChunk *first;
+    ArenaChunk *current;    /* The chunk allocations are taken from */
+    size_t chunk_size;      /* Usable size of a regular chunk */
+    size_t bytes;           /* Bytes requested since the last reset */
+    size_t allocations;     /* Allocations since the last reset */
+} Arena;
+
+/**
+ * @brief Initializes an empty arena; no memory is allocated until it is used.
+ *
+ * @param arena The arena to initialize.
+ * @param chunk_size The usable size of each chunk; larger requests get a chunk of their own.
+ */
+void arena_init(Arena *arena, size_t chunk_size);
+
+/**
+ * @brief Allocates memory from an arena, aligned for any type.
+ *
+ * @param arena The arena.
+ * @param size The number of bytes to allocate.
+ * @return A pointer to the memory, or NULL if a new chunk could not be allocated.
+ */
+void *arena_alloc(Arena *arena, size_t size);
+
+/**
+ * @brief Copies length characters into the arena and null-terminates them.
+ *
+ * @param arena The arena.
+ * @param str The characters to copy.
+ * @param length The number of characters to copy.
+ * @return The copy, or NULL if memory ran out.
+ */
+char *arena_strndup(Arena *arena, const char *str, size_t length);
+
+/**
+ * @brief Copies a null-terminated string into the arena.
+ *
+ * @param arena The arena.
+ * @param str The string to copy.
+ * @return The copy, or NULL if memory ran out.
+ */
+char *arena_strdup(Arena *arena, const char *str);
+
+/**
+ * @brief Releases every allocation at once and clears the counters.
+ *
+ * The chunks are kept and handed out again, so this takes constant time
+ * and a reused arena does not call malloc until it needs more room.
+ *
+ * @param arena The arena.
+ */
+void arena_reset(Arena *arena);
+
+/**
+ * @brief Returns every chunk of an arena to the system.
+ *
+ * @param arena The arena; it is left empty and can be used again.
+ */
+void arena_free(Arena *arena);
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef ASSEMBLE_H
+#define ASSEMBLE_H
+
+/*
+ * This header file contains the library interface of the assembler. It
+ * assembles a source held in memory into in-memory object, entry and extern
+ * files plus the rendered diagnostics, without touching the file system.
+ * Every call works on a state of its own and nothing is shared between
+ * calls, so any number of threads can assemble at the same time.
+ *
+ * The library is every file of sources/ except main.c.
+ */
+
+#include <stddef.h>
+#include "source.h"
+#include "diagnostics.h"
+
+/**
+ * Says how a source is assembled; the same choices as the command line.
+ */
+typedef struct {
+    int single_pass;                      /* 1 to encode during the first pass (--one-pass) */
+    int max_errors;                       /* Error budget, 0 for no limit (--max-errors) */
+    int threads;                          /* Threads the passes of a large source may use */
+    DiagnosticsFormat diagnostics_format; /* Text or JSON Lines (--diagnostics) */
+} AssembleOptions;
+
+/**
+ * The outputs of one assembly. Each buffer holds exactly what the command
+ * line would have written to the file of the same extension.
+ */
+typedef struct {
+    TextBuffer expanded;    /* The .am file; data is NULL if the macros could not be expanded */
+    TextBuffer object;      /* The .ob file; empty if the assembly failed */
+    TextBuffer entries;     /* The .ent file; empty if there are no entries */
+    TextBuffer externs;     /* The .ext file; empty if there are no externs */
+    TextBuffer diagnostics; /* Every diagnostic, sorted, in the chosen format */
+    int error_count;
+    int warning_count;
+    int ic;                 /* Code words, or -1 if the first pass did not finish */
+    int dc;                 /* Data words, or -1 if the first pass did not finish */
+} AssembleResult;
+
+/**
+ * @brief Fills options with the defaults of the command line.
+ *
+ * @param options The options to initialize.
+ */
+void assemble_options_init(AssembleOptions *options);
+
+/**
+ * @brief Assembles a source held in memory.
+ *
+ * The diagnostics name the source name.as before macro expansion and
+ * name.am after it, like the command line does for a file called name.
+ *
+ * @param name The name of the source, without extension.
+ * @param data The contents of the source; it is not modified.
+ * @param length The number of bytes in data.
+ * @param options How to assemble, or NULL for the defaults.
+ * @param result Receives the outputs; release it with assemble_result_free.
+ * @return 0 on success, 1 if the source has errors or memory ran out.
+ */
+int assemble_buffer(const char *name, const char *data, size_t length, const AssembleOptions *options, AssembleResult *result);
+
+/**
+ * @brief Releases the buffers of a result.
+ *
+ * @param result The result to release.
+ */
+void assemble_result_free(AssembleResult *result);
+
+#endif
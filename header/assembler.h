@@ -13,29 +13,54 @@
 #include <ctype.h>
 #include <errno.h>
 #include <stddef.h>
+#include "source.h"
+#include "diagnostics.h"
+#include "arena.h"
+#include "output.h"
+#include "tokenizer.h"
 
 /* Constants */
 #define MAX_LINE_LENGTH 100
 #define MAX_LABEL_LENGTH 31
 #define INITIAL_MEMORY_SIZE 1000
 #define MAX_LABELS 1000
+#define MEMORY_START 100
+#define ARENA_CHUNK_SIZE 16384
 #define INITIAL_TABLE_SIZE 10
 #define MAX_MACRO_NAME_LENGTH 31
 #define RESERVED_WORD_NUM 31
 #define MAX_FILENAME 100
+#define SYMBOL_BUCKET_COUNT 1024 /* Initial hash buckets; the table doubles as symbols are added */
+#define NO_SYMBOL -1
+#define NO_FIXUP -1
+#define ADDRESSING_NONE 0
+#define ADDRESSING_IMMEDIATE 1
+#define ADDRESSING_DIRECT 2
+#define ADDRESSING_INDIRECT_REGISTER 4
+#define ADDRESSING_DIRECT_REGISTER 8
 #define FALSE 0  
 #define TRUE 1
 
 /* Data Structures */
 
 /**
- * Represents an assembly instruction.
+ * The kinds of symbol references recorded in the relocation table.
+ */
+typedef enum {
+    RELOCATION_RELOCATABLE, /* Address of a label in this file */
+    RELOCATION_EXTERNAL     /* Reference to an external symbol, listed in the .ext file */
+} RelocationKind;
+
+/**
+ * Records that the word at an address refers to a symbol.
+ * Only the few words that name a symbol have one, so the memory image
+ * itself stays a plain array of words.
  */
 typedef struct {
-    int address;
-    char binary[16];
-    char label[MAX_LABEL_LENGTH + 1];
-} Instruction;
+    int address;        /* Address of the referencing word */
+    int symbol;         /* Referenced symbol */
+    unsigned char kind; /* A RelocationKind */
+} Relocation;
 
 /**
  * Represents a label in the assembly code.
@@ -45,6 +70,7 @@ typedef struct {
     int address;
     int is_entry;
     int is_extern;
+    int is_data; /* 1 if the label is in the data segment, which is placed after the code */
 } Label;
 
 /**
@@ -71,13 +97,90 @@ typedef struct {
     char* content;
 } Macro;
 
+/**
+ * Represents a name used as a label, an operand, or in an .entry/.extern directive.
+ * Statements refer to symbols by their index in the symbol table.
+ */
+typedef struct {
+    char name[MAX_LABEL_LENGTH + 1];
+    int label;     /* Index in the label table, or -1 if the symbol is not defined */
+    int is_extern; /* 1 if the symbol was declared with .extern */
+    int is_entry;  /* 1 if the symbol was declared with .entry */
+    int next;      /* Next symbol in the same hash bucket, or NO_SYMBOL */
+    int fixups;    /* Most recent reference awaiting a patch (single-pass mode), or NO_FIXUP */
+} Symbol;
+
+/**
+ * Represents a reference to a symbol from a machine word (single-pass mode).
+ */
+typedef struct {
+    int address; /* Address of the word to patch */
+    int symbol;  /* Referenced symbol */
+    int line;    /* Source line of the reference */
+    int next;    /* Previous reference to the same symbol, or NO_FIXUP */
+} Fixup;
+
+/**
+ * The kinds of statements recorded by the first pass.
+ */
+typedef enum {
+    STATEMENT_INSTRUCTION,
+    STATEMENT_DATA,
+    STATEMENT_STRING,
+    STATEMENT_ENTRY,
+    STATEMENT_EXTERN
+} StatementKind;
+
+/**
+ * Represents a parsed instruction operand.
+ */
+typedef struct {
+    unsigned char mode; /* Addressing mode bit: one of the ADDRESSING_ values */
+    signed char reg;    /* Register number for register modes, -1 otherwise */
+    short value;        /* Value of an immediate operand */
+    int symbol;         /* Symbol of a direct operand, NO_SYMBOL otherwise */
+} Operand;
+
+/**
+ * Represents one parsed source statement.
+ * Instructions are encoded from this record by the second pass; .data and
+ * .string statements point at their values in the data segment.
+ */
+typedef struct {
+    unsigned char kind;  /* A StatementKind */
+    signed char opcode;  /* Opcode of an instruction, -1 otherwise */
+    Operand src;
+    Operand dst;
+    int line;            /* Line number in the expanded source */
+    int address;         /* IC of an instruction, DC of a data statement */
+    int length;          /* Number of machine words the statement occupies */
+    int symbol;          /* Symbol named by .entry/.extern, NO_SYMBOL otherwise */
+} Statement;
+
+/**
+ * Upper bounds on what the first pass records for a source. They are
+ * counted by a quick scan before the first pass, so that every table can
+ * be sized once instead of growing while the file is assembled.
+ */
+typedef struct {
+    int statements;   /* Lines that are neither blank nor comments */
+    int labels;       /* Lines that may define a label */
+    int instructions; /* Lines that are not directives */
+    int data_values;  /* Words the .data and .string directives may add */
+    int entries;
+    int externs;
+} SourceCounts;
+
 /**
  * Represents the overall state of the assembler.
  */
 typedef struct {
-    Instruction* memory;
+    unsigned short* words; /* Memory image: the 15-bit word at each address */
     int memory_size;
     int memory_capacity;
+    Relocation* relocations; /* Words that refer to a symbol, in the order they were resolved */
+    int relocation_count;
+    int relocation_capacity;
     Label* label_table;
     int label_count;
     int label_capacity;
@@ -88,6 +191,26 @@ typedef struct {
     int extern_count;
     int extern_capacity;
     int current_line;
+    const char* line_start;   /* First character of the current line, for columns */
+    Diagnostics* diagnostics; /* Where errors and warnings are recorded */
+    OutputStats* output;      /* How output files are committed, or NULL to always write them */
+    Arena arena;              /* Small per-file allocations, released by reset_assembler_state */
+
+    Statement* statements;
+    int statement_count;
+    int statement_capacity;
+    int* data_values;
+    int data_capacity;
+    Symbol* symbols;
+    int symbol_count;
+    int symbol_capacity;
+    int* symbol_buckets;
+    int bucket_count; /* A power of two, kept at least symbol_count */
+    Fixup* fixups;
+    int fixup_count;
+    int fixup_capacity;
+    int single_pass; /* 1 to encode during the first pass and backpatch forward references */
+    int chunk_threads; /* Threads the first pass and the object file rendering may use */
 
     int IC;
     int DC;
@@ -95,16 +218,6 @@ typedef struct {
 
 /* General Functions */
 
-/**
- * @brief A reentrant version of strtok.
- * 
- * @param str The string to be parsed.
- * @param delim The delimiter string.
- * @param saveptr A pointer to a char * variable that is used internally to maintain context between successive calls.
- * @return A pointer to the next token in the string.
- */
-char *strtok_r(char *str, const char *delim, char **saveptr);
-
 /**
  * @brief Trims leading and trailing whitespace from a string.
  * 
@@ -113,15 +226,6 @@ char *strtok_r(char *str, const char *delim, char **saveptr);
  */
 char *trim(char *str);
 
-/**
- * @brief Converts an integer to its binary representation.
- * 
- * @param value The integer to convert.
- * @param bits The number of bits in the binary representation.
- * @return A string containing the binary representation.
- */
-char *int_to_binary(int value, int bits);
-
 /**
  * @brief Adds a file extension to a filename.
  * 
@@ -133,10 +237,13 @@ void addExtension(char *filename, const char *extension, char *result);
 
 /**
  * @brief Removes leading whitespace from a string.
+ *
+ * Comments are left untouched, since they must start at the first column.
  * 
  * @param str The string to be trimmed.
+ * @return 1 if the string is a comment preceded by whitespace, 0 otherwise.
  */
-void trimLeadingWhitespace(char *str);
+int trimLeadingWhitespace(char *str);
 
 /**
  * @brief Checks if a string has leading whitespace.
@@ -149,17 +256,19 @@ int has_leading_whitespace(const char *line);
 /* Macro Table Functions */
 
 /**
- * @brief Reads macros from a file.
+ * @brief Reads macros from a source buffer.
  * 
- * @param filename The name of the file to read from.
+ * @param source The contents of the source file.
  * @param macroCount A pointer to store the number of macros read.
  * @param error A pointer to store any error code.
+ * @param diagnostics Where errors are recorded.
+ * @param arena The file's arena, which holds the macro names and bodies.
  * @return An array of Macro structures.
  */
-Macro* readMacrosFromFile(const char* filename, int* macroCount, int* error);
+Macro* readMacrosFromSource(const SourceBuffer* source, int* macroCount, int* error, Diagnostics* diagnostics, Arena* arena);
 
 /**
- * @brief Frees the memory allocated for macros.
+ * @brief Frees the macro array; the names and bodies are released with the arena.
  * 
  * @param macros The array of Macro structures to free.
  * @param macroCount The number of macros in the array.
@@ -199,15 +308,21 @@ int is_whitespace_line(const char *line);
 int is_empty_macro_line(const char *line);
 
 /**
- * @brief Expands macros in a file and writes the result to a new file.
+ * @brief Expands macros in a source buffer and writes the result to a new file.
  * 
- * @param inputFilename The name of the input file.
- * @param outputFilename The name of the output file.
+ * The expanded text is also returned in memory, so the first pass does not
+ * read the output file back.
+ * 
+ * @param input The contents of the input file.
+ * @param outputFilename The name of the output file, or NULL to only expand in memory.
  * @param macros An array of Macro structures.
  * @param macroCount The number of macros in the array.
+ * @param expanded The source buffer receiving the expanded text.
  * @param error A pointer to store any error code.
+ * @param diagnostics Where errors are recorded.
+ * @param stats How the output file is committed, or NULL to always write it.
  */
-void expandMacrosInFile(const char* inputFilename, char* outputFilename, Macro* macros, int macroCount, int* error);
+void expandMacrosInSource(const SourceBuffer* input, const char* outputFilename, Macro* macros, int macroCount, SourceBuffer* expanded, int* error, Diagnostics* diagnostics, OutputStats* stats);
 
 /* First Pass Functions */
 
@@ -218,78 +333,148 @@ void expandMacrosInFile(const char* inputFilename, char* outputFilename, Macro*
  */
 AssemblerState *init_assembler_state();
 
+/**
+ * @brief Empties an assembler state so it can assemble another file.
+ *
+ * Every table keeps its buffer and capacity, so a reused state only
+ * allocates when a file needs more room than the previous ones did.
+ *
+ * @param state The assembler state to reset.
+ */
+void reset_assembler_state(AssemblerState *state);
+
+/**
+ * @brief Empties the tables the passes fill and resets IC and DC.
+ *
+ * Unlike reset_assembler_state, the arena and the settings of the state
+ * are kept, so it can be used in the middle of a file.
+ *
+ * @param state The assembler state.
+ */
+void clear_assembler_tables(AssemblerState *state);
+
+/**
+ * @brief Counts upper bounds on the statements, labels and words of a source.
+ *
+ * The scan only looks for colons, directive names and commas, so it costs
+ * far less than the first pass itself.
+ *
+ * @param source The expanded source.
+ * @param counts Receives the counts.
+ */
+void count_source(const SourceBuffer *source, SourceCounts *counts);
+
+/**
+ * @brief Grows the tables of an assembler state to hold a whole source.
+ *
+ * Tables that are already large enough are left alone.
+ *
+ * @param state The assembler state.
+ * @param counts The counts from count_source.
+ * @return 0 on success, 1 if memory allocation failed.
+ */
+int reserve_assembler_state(AssemblerState *state, const SourceCounts *counts);
+
 /**
  * @brief Processes a single line of assembly code.
  * 
+ * The line is tokenized in place and is never modified, so it may point
+ * into a read-only buffer and does not need to be null-terminated.
+ *
  * @param state The current assembler state.
  * @param line The line to process.
+ * @param length The number of characters in the line.
  * @param macros An array of Macro structures.
  * @param macroCount A pointer to the number of macros.
  * @return An integer indicating success or failure.
  */
-int process_line(AssemblerState* state, char* line, Macro *macros, int *macroCount);
+int process_line(AssemblerState* state, const char* line, size_t length, Macro *macros, int *macroCount);
 
 /**
  * @brief Performs the first pass of the assembly process.
  * 
  * @param state The current assembler state.
- * @param filename The name of the input file.
+ * @param source The macro-expanded source.
  * @param macros An array of Macro structures.
  * @param macroCount A pointer to the number of macros.
  * @param error A pointer to store any error code.
  */
-void first_pass(AssemblerState *state, const char *filename, Macro *macros, int *macroCount, int *error);
+void first_pass(AssemblerState *state, const SourceBuffer *source, Macro *macros, int *macroCount, int *error);
+
+/**
+ * @brief Runs process_line over every line of a source.
+ *
+ * @param state The current assembler state.
+ * @param source The expanded source.
+ * @param macros An array of Macro structures.
+ * @param macroCount A pointer to the number of macros.
+ * @return 0 on success, 1 if a line failed.
+ */
+int first_pass_lines(AssemblerState *state, const SourceBuffer *source, Macro *macros, int *macroCount);
 
 /* Directive Handling Functions */
 
 /**
  * @brief Handles the .data directive.
  * 
+ * Validates the comma-separated values and appends them to the data
+ * segment in a single scan.
+ * 
  * @param state The current assembler state.
- * @param label The label associated with the directive.
- * @param params The parameters of the directive.
+ * @param label The label associated with the directive (empty if none).
+ * @param params The parameters of the directive, not necessarily null-terminated.
+ * @param length The number of characters in params.
  * @param validLabel Indicates if the label is valid.
+ * @return 0 on success, 1 if the values are invalid.
  */
-void handle_data_directive(AssemblerState *state, const char *label, const char *params, int validLabel);
+int handle_data_directive(AssemblerState *state, Span label, const char *params, size_t length, int validLabel);
 
 /**
  * @brief Handles the .string directive.
  * 
+ * Validates the quoted string, decodes the escape sequences \n, \t, \r,
+ * \0, \a, \b, \f, \v, \\, \" and \' and appends the characters and
+ * a terminating zero to the data segment.
+ * 
  * @param state The current assembler state.
- * @param label The label associated with the directive.
- * @param params The parameters of the directive.
+ * @param label The label associated with the directive (empty if none).
+ * @param params The parameters of the directive, not necessarily null-terminated.
+ * @param length The number of characters in params.
  * @param validLabel Indicates if the label is valid.
+ * @return 0 on success, 1 if the string is invalid.
  */
-void handle_string_directive(AssemblerState *state, const char *label, const char *params, int validLabel);
+int handle_string_directive(AssemblerState *state, Span label, const char *params, size_t length, int validLabel);
 
 /**
  * @brief Handles the .entry directive.
  * 
  * @param state The current assembler state.
- * @param label The label associated with the directive.
+ * @param label The label named by the directive.
  */
-void handle_entry_directive(AssemblerState *state, const char *label);
+void handle_entry_directive(AssemblerState *state, Span label);
 
 /**
  * @brief Handles the .extern directive.
  * 
  * @param state The current assembler state.
- * @param label The label associated with the directive.
+ * @param label The label named by the directive.
  */
-void handle_extern_directive(AssemblerState *state, const char *label);
+void handle_extern_directive(AssemblerState *state, Span label);
 
 /**
- * @brief Assembles an instruction.
+ * @brief Records an instruction statement and advances IC by its size.
+ * 
+ * The instruction is encoded later from the recorded statement.
  * 
  * @param state The current assembler state.
- * @param label The label associated with the instruction.
- * @param op The operation code.
- * @param operand1 The first operand.
- * @param operand2 The second operand.
+ * @param label The label associated with the instruction (empty if none).
+ * @param op The instruction name, or NULL if it is not a valid one.
+ * @param operands The classified operands, in source order.
+ * @param operand_count The number of operands.
  * @param validLabel Indicates if the label is valid.
  * @return An integer indicating success or failure.
  */
-int assemble_instruction(AssemblerState *state, const char *label, const char *op, const char *operand1, const char *operand2, int validLabel);
+int assemble_instruction(AssemblerState *state, Span label, const char *op, const Operand *operands, int operand_count, int validLabel);
 
 /* First Pass Helper Functions */
 
@@ -302,14 +487,6 @@ int assemble_instruction(AssemblerState *state, const char *label, const char *o
  */
 void add_label_for_check(AssemblerState *state, const char *name, int address);
 
-/**
- * @brief Gets the register number from an operand.
- * 
- * @param operand The operand string.
- * @return The register number.
- */
-int get_register_number(const char *operand);
-
 /**
  * @brief Gets the opcode for an operation.
  * 
@@ -319,36 +496,113 @@ int get_register_number(const char *operand);
 int get_opcode(const char *operation);
 
 /**
- * @brief Encodes an immediate operand.
+ * @brief Frees the memory allocated for the assembler state.
  * 
- * @param operand The operand string.
- * @return The encoded operand.
+ * @param state The assembler state to free.
  */
-char *encode_immediate_operand(const char *operand);
+void free_assembler_state(AssemblerState *state);
 
 /**
- * @brief Gets the addressing mode for an operand.
+ * @brief Adds a label to the label table.
  * 
- * @param operand The operand string.
- * @return The addressing mode.
+ * @param state The current assembler state.
+ * @param name The name of the label.
+ * @param address The address of the label.
  */
-int get_addressing_mode(const char *operand);
+void add_label(AssemblerState *state, const char *name, int address);
 
 /**
- * @brief Frees the memory allocated for the assembler state.
+ * @brief Adds a label defined by a .data or .string directive.
  * 
- * @param state The assembler state to free.
+ * @param state The current assembler state.
+ * @param name The name of the label.
+ * @param data_address The address of the label relative to the data segment.
  */
-void free_assembler_state(AssemblerState *state);
+void add_data_label(AssemblerState *state, const char *name, int data_address);
 
 /**
- * @brief Adds a label to the label table.
+ * @brief Moves data labels after the code segment once the final IC is known.
  * 
  * @param state The current assembler state.
- * @param name The name of the label.
- * @param address The address of the label.
  */
-void add_label(AssemblerState *state, const char *name, int address);
+void relocate_data_labels(AssemblerState *state);
+
+/**
+ * @brief Looks up a symbol by name.
+ * 
+ * @param state The current assembler state.
+ * @param name The name of the symbol.
+ * @return The index of the symbol, or NO_SYMBOL if it is not in the table.
+ */
+int find_symbol(const AssemblerState *state, const char *name);
+
+/**
+ * @brief Looks up a symbol by a name that need not be null-terminated.
+ * 
+ * @param state The current assembler state.
+ * @param name The start of the name.
+ * @param length The number of characters in the name.
+ * @return The index of the symbol, or NO_SYMBOL if it is not in the table.
+ */
+int find_symbol_length(const AssemblerState *state, const char *name, size_t length);
+
+/**
+ * @brief Grows the symbol hash so the given number of symbols can be
+ * added without chains getting longer than one symbol on average.
+ * 
+ * @param state The current assembler state.
+ * @param symbols The number of symbols expected.
+ * @return 0 on success, 1 if memory allocation failed (the old buckets are kept).
+ */
+int reserve_symbol_buckets(AssemblerState *state, int symbols);
+
+/**
+ * @brief Returns the symbol for a name, adding it to the symbol table if needed.
+ * 
+ * @param state The current assembler state.
+ * @param name The name of the symbol.
+ * @return The index of the symbol, or NO_SYMBOL if memory allocation failed.
+ */
+int intern_symbol(AssemblerState *state, const char *name);
+
+/**
+ * @brief Appends an empty statement for the current line.
+ * 
+ * @param state The current assembler state.
+ * @param kind The StatementKind of the new statement.
+ * @return A pointer to the new statement, or NULL if memory allocation failed.
+ */
+Statement *append_statement(AssemblerState *state, int kind);
+
+/**
+ * @brief Gets the 1-based column of a character in the current line.
+ * 
+ * @param state The current assembler state.
+ * @param p A pointer into the current line.
+ * @return The column, or 0 if there is no current line.
+ */
+int source_column(const AssemblerState *state, const char *p);
+
+/**
+ * @brief Appends a value to the data segment and advances DC.
+ * 
+ * @param state The current assembler state.
+ * @param value The value to append.
+ * @return 0 on success, 1 if memory allocation failed.
+ */
+int append_data_value(AssemblerState *state, int value);
+
+/**
+ * @brief Makes room for values at the end of the data segment.
+ * 
+ * DC is not advanced; the caller fills the returned slots and adds the
+ * number of values it wrote to DC.
+ * 
+ * @param state The current assembler state.
+ * @param count The number of values to make room for.
+ * @return A pointer to the first free slot, or NULL if memory allocation failed.
+ */
+int *reserve_data_values(AssemblerState *state, size_t count);
 
 /**
  * @brief Checks if an instruction is a single-operand instruction.
@@ -377,50 +631,194 @@ void print_memory(AssemblerState *state);
 /**
  * @brief Performs the second pass of the assembly process.
  * 
+ * The .ob, .ent and .ext files are built in memory and written only if all
+ * of them could be built, each with a single write and a rename.
+ * 
  * @param state The current assembler state.
- * @param input_filename The name of the input file.
+ * @param input_filename The name of the input file, used to name the .ent and .ext files.
  * @param output_filename The name of the output file.
  * @param error A pointer to store any error code.
  */
 void second_pass(AssemblerState *state, const char *input_filename, const char *output_filename, int *error);
 
 /**
- * @brief Creates the entry file.
+ * @brief Encodes the parsed statements into the memory image.
+ * 
+ * Code words are placed from address 100 and the data segment follows them.
+ * Direct operands are resolved against the symbol table; undefined symbols
+ * are reported with the line of the statement that uses them.
  * 
  * @param state The current assembler state.
- * @param filename The base filename.
- * @param entFilename The name of the entry file to be created.
- * @return An integer indicating success or failure.
+ * @return 0 on success, 1 if a symbol could not be resolved.
  */
-int createEntryFile(AssemblerState *state, const char *filename, char *entFilename);
+int encode_statements(AssemblerState *state);
 
 /**
- * @brief Creates the extern file.
+ * @brief Makes sure the memory image can hold a number of words.
  * 
  * @param state The current assembler state.
- * @param filename The base filename.
- * @param extFilename The name of the extern file to be created.
- * @return An integer indicating success or failure.
+ * @param size The number of words (addresses 0 to size - 1) needed.
+ * @return 0 on success, 1 if memory allocation failed.
  */
-int createExternFile(AssemblerState *state, const char *filename, char *extFilename);
+int ensure_memory_capacity(AssemblerState *state, int size);
 
-/* Utility Functions */
+/**
+ * @brief Writes the final word for a reference to a symbol.
+ * 
+ * The reference is also added to the relocation table, which the .ext
+ * file is written from.
+ * 
+ * @param state The current assembler state.
+ * @param symbol_index The referenced symbol.
+ * @param address The address of the word.
+ * @param line The source line of the reference, for error messages.
+ * @return 0 on success, 1 if the symbol is undefined.
+ */
+int resolve_symbol_word(AssemblerState *state, int symbol_index, int address, int line);
+
+/**
+ * @brief Encodes the words of one instruction statement into the memory image.
+ * 
+ * @param state The current assembler state.
+ * @param statement The instruction statement.
+ * @return 0 on success, 1 if a symbol could not be resolved.
+ */
+int encode_instruction(AssemblerState *state, const Statement *statement);
+
+/**
+ * @brief Places the data segment after the code in the memory image.
+ * 
+ * @param state The current assembler state.
+ * @return 0 on success, 1 if memory allocation failed.
+ */
+int encode_data_segment(AssemblerState *state);
+
+/* Parallel First Pass Functions */
+
+/**
+ * @brief Runs the first pass of a large source on several threads.
+ *
+ * The source is cut at line boundaries into chunks that are parsed by
+ * separate states, each counting IC and DC from zero and keeping its own
+ * symbol table. The chunks are then merged in order, offsetting their
+ * addresses by the code and data sizes of the chunks before them.
+ *
+ * Nothing is merged if a chunk reported anything, or if two chunks
+ * conflict (a label defined twice, an entry or extern declared again).
+ * The caller then runs the sequential first pass, so diagnostics are
+ * exactly those of a sequential run.
+ *
+ * @param state The current assembler state; its tables must be empty.
+ * @param source The expanded source.
+ * @param macros An array of Macro structures.
+ * @param macroCount A pointer to the number of macros.
+ * @return 1 if the source was assembled, 0 if the caller must run the sequential first pass.
+ */
+int parallel_first_pass(AssemblerState *state, const SourceBuffer *source, Macro *macros, int *macroCount);
+
+/**
+ * @brief Renders the word lines of the object file on several threads.
+ *
+ * The memory image is split into address ranges. Each range is rendered
+ * straight into its place in out, which is known beforehand because every
+ * line has a length that depends only on its address.
+ *
+ * @param state The current assembler state.
+ * @param out Where to write; it must hold object_text_offset(end) bytes.
+ * @param end The address after the last word.
+ */
+void parallel_render_object(const AssemblerState *state, char *out, int end);
+
+/* Single-Pass Functions */
+
+/**
+ * @brief Records a reference to a symbol that may need to be patched.
+ * 
+ * @param state The current assembler state.
+ * @param symbol The referenced symbol.
+ * @param address The address of the referencing word.
+ * @param line The source line of the reference.
+ * @return 0 on success, 1 if memory allocation failed.
+ */
+int record_fixup(AssemblerState *state, int symbol, int address, int line);
+
+/**
+ * @brief Patches the recorded references to a code label that was just defined.
+ * 
+ * @param state The current assembler state.
+ * @param symbol The symbol of the label.
+ */
+void patch_label_fixups(AssemblerState *state, int symbol);
+
+/**
+ * @brief Places the data segment and patches the references still open at the end of the file.
+ * 
+ * @param state The current assembler state.
+ * @param report_undefined 1 to report undefined symbols.
+ * @return 0 on success, 1 if a symbol is undefined or memory allocation failed.
+ */
+int finish_single_pass(AssemblerState *state, int report_undefined);
+
+/**
+ * @brief Encodes the program and builds the contents of every output file.
+ *
+ * Nothing is written: second_pass commits the buffers to files, and the
+ * library API hands them to its caller.
+ * 
+ * @param state The current assembler state, after the first pass.
+ * @param object The buffer receiving the object file.
+ * @param entries The buffer receiving the entry file; left empty if there are no entries.
+ * @param externs The buffer receiving the extern file; left empty if there are no externs.
+ * @return 0 on success, 1 if a symbol is undefined, an entry or extern is invalid, or memory allocation failed.
+ */
+int build_output_files(AssemblerState *state, TextBuffer *object, TextBuffer *entries, TextBuffer *externs);
 
 /**
- * @brief Converts a decimal number to its octal representation.
+ * @brief Builds the contents of the object file.
  * 
- * @param decimal The decimal number to convert.
- * @param octalStr The string to store the octal representation.
+ * @param state The current assembler state.
+ * @param text The buffer to append to; it is sized once for every word.
+ * @return 0 on success, 1 if memory allocation failed.
  */
-void decimalToOctal(int decimal, char *octalStr);
+int build_object_file(AssemblerState *state, TextBuffer *text);
 
 /**
- * @brief Converts a binary string to its decimal equivalent.
+ * @brief Returns where the line of an address starts in the object file.
  * 
- * @param binaryStr The binary string to convert.
- * @return The decimal equivalent.
+ * @param address An address of the memory image, at least MEMORY_START.
+ * @return The offset of the line from the first word line.
  */
-int binaryToDecimal(const char *binaryStr);
+size_t object_text_offset(int address);
+
+/**
+ * @brief Renders the object file lines of a range of the memory image.
+ * 
+ * @param state The current assembler state.
+ * @param out Where to write; it must hold object_text_offset(to) - object_text_offset(from) bytes.
+ * @param from The first address to render.
+ * @param to The address after the last one to render.
+ */
+void render_object_words(const AssemblerState *state, char *out, int from, int to);
+
+/**
+ * @brief Builds the contents of the entry file.
+ * 
+ * @param state The current assembler state.
+ * @param text The buffer to append to.
+ * @return 0 on success, 1 if an entry label is undefined or memory allocation failed.
+ */
+int build_entry_file(AssemblerState *state, TextBuffer *text);
+
+/**
+ * @brief Builds the contents of the extern file.
+ * 
+ * @param state The current assembler state.
+ * @param text The buffer to append to.
+ * @return 0 on success, 1 if an external label is also an entry or memory allocation failed.
+ */
+int build_extern_file(AssemblerState *state, TextBuffer *text);
+
+/* Utility Functions */
 
 /**
  * @brief Gets the address of a label.
@@ -448,38 +846,4 @@ void decimalToBinary12(int n, char *binaryStr);
  */
 void createExtension(const char *filename, char *outputFilename, const char *extension);
 
-
-/**
- * @brief A custom implementation of snprintf with limited functionality.
- *
- * This function writes a formatted string to a character array, similar to snprintf,
- * but with limited format specifiers. It only supports %s for string formatting.
- *
- * @param str The buffer to write the formatted string to.
- * @param size The maximum number of bytes to be written to the buffer.
- * @param format The format string (only %s is supported).
- * @param arg The string argument to be formatted.
- *
- * @return The number of characters that would have been written if size had been sufficiently large,
- *         not counting the terminating null byte. If an encoding error occurs, a negative number is returned.
- *
- * @note This function only supports the %s format specifier for string formatting.
- * @note The resulting string is always null-terminated, unless size is 0.
- */
-int my_snprintf(char *str, size_t size, const char *format, const char *arg);
-
-/**
- * @brief Creates a duplicate of the input string.
- *
- * This function allocates memory for a new string and copies the contents
- * of the input string into it.
- *
- * @param s The input string to be duplicated.
- *
- * @return A pointer to the newly allocated string containing a copy of 's',
- *         or NULL if insufficient memory was available.
- *
- * @note The caller is responsible for freeing the memory allocated by this function.
- */
-char *my_strdup(const char *s);
 #endif
@@ -53,58 +53,37 @@ int is_valid_comment(const char* line);
 int isInSet(const char *word, const char *set[], int setSize);
 
 /**
- * @brief Checks if a word is a valid label.
+ * @brief Checks if a word is a valid label, reporting why it is not.
  *
- * @param word The word to check.
+ * @param state The current assembler state.
+ * @param word The word to check, not necessarily null-terminated.
+ * @param length The number of characters in the word.
+ * @param column The column of the word in the current line, or 0 if unknown.
  * @param macros An array of Macro structures.
  * @param macroCount A pointer to the number of macros.
  * @return 1 if the word is a valid label, 0 otherwise.
  */
-int isValidLabel(const char *word, Macro *macros, int *macroCount);
-
-/**
- * @brief Checks the integrity of data operands.
- *
- * @param operands The operands to check.
- * @return 1 if the data operands are valid, 0 otherwise.
- */
-int data_intergity_check(char *operands);
-
-/**
- * @brief Checks if a string contains invalid characters.
- *
- * @param str The string to check.
- * @return 1 if the string contains invalid characters, 0 otherwise.
- */
-int has_invalid_characters(const char *str);
-
-/**
- * @brief Checks the integrity of string operands.
- *
- * @param operands The operands to check.
- * @return 1 if the string operands are valid, 0 otherwise.
- */
-int string_intergity_check(char *operands);
+int isValidLabel(AssemblerState *state, const char *word, size_t length, int column, Macro *macros, int *macroCount);
 
 /**
  * @brief Checks the integrity of entry directives.
  *
- * @param line The line containing the entry directive.
+ * @param operand The text following the .entry directive.
  * @param state The current assembler state.
  * @param macros An array of Macro structures.
  * @param macroCount A pointer to the number of macros.
  * @return 1 if the entry directive is valid, 0 otherwise.
  */
-int entry_intergity_check(char *line, AssemblerState* state, Macro *macros, int *macroCount);
+int entry_intergity_check(Span operand, AssemblerState* state, Macro *macros, int *macroCount);
 
 /**
  * @brief Checks the integrity of extern directives.
  *
- * @param line The line containing the extern directive.
+ * @param operand The text following the .extern directive.
  * @param state The current assembler state.
  * @return 1 if the extern directive is valid, 0 otherwise.
  */
-int extern_intergity_check(char *line, AssemblerState* state);
+int extern_intergity_check(Span operand, AssemblerState* state);
 
 /**
  * @brief Checks if a word is a reserved word in the assembly language.
@@ -117,11 +96,12 @@ int is_reserved_word(const char* word);
 /**
  * @brief Checks if a label is already defined in the assembler state.
  *
- * @param label The label to check.
+ * @param label The label to check, not necessarily null-terminated.
+ * @param length The number of characters in the label.
  * @param state The current assembler state.
  * @return 1 if the label is a duplicate, 0 otherwise.
  */
-int is_duplicate_label(const char* label, const AssemblerState* state);
+int is_duplicate_label(const char* label, size_t length, const AssemblerState* state);
 
 /**
  * @brief Checks if an instruction is valid.
@@ -132,12 +112,13 @@ int is_duplicate_label(const char* label, const AssemblerState* state);
 int is_valid_instruction(const char* instruction);
 
 /**
- * @brief Checks if an operand is a valid immediate value.
+ * @brief Finds an instruction by a name that need not be null-terminated.
  *
- * @param operand The operand to check.
- * @return 1 if the operand is a valid immediate value, 0 otherwise.
+ * @param name The start of the name.
+ * @param length The number of characters in the name.
+ * @return The instruction's name as a null-terminated string, or NULL if it is not an instruction.
  */
-int is_valid_immediate(const char* operand);
+const char *find_instruction(const char* name, size_t length);
 
 /**
  * @brief Checks if the number of operands is correct for a given instruction.
@@ -149,24 +130,31 @@ int is_valid_immediate(const char* operand);
 int check_operand_count(const char* instruction, int operand_count);
 
 /**
- * @brief Checks if an operand is valid.
+ * @brief Classifies and validates an operand in a single scan.
+ *
+ * The operand is recognized as an immediate value, a register, an indirect
+ * register or a label, and its record is filled with the addressing mode,
+ * register number, immediate value or interned symbol.
  *
- * @param operand The operand to check.
+ * @param state The current assembler state.
+ * @param text The operand text, not necessarily null-terminated.
+ * @param length The number of characters in the operand.
+ * @param operand The operand record to fill.
  * @param macros An array of Macro structures.
  * @param macroCount A pointer to the number of macros.
- * @return 1 if the operand is valid, 0 otherwise.
+ * @return 1 if the operand is valid, 0 otherwise (the addressing mode is still set).
  */
-int is_valid_operand(const char* operand, Macro *macros, int *macroCount);
+int classify_operand(AssemblerState *state, const char *text, size_t length, Operand *operand, Macro *macros, int *macroCount);
 
 /**
  * @brief Checks if the addressing mode is valid for a given instruction and operand.
  *
  * @param instruction The instruction.
- * @param operand The operand.
+ * @param operand The classified operand.
  * @param is_source 1 if the operand is a source operand, 0 if it's a destination operand.
  * @return 1 if the addressing mode is valid, 0 otherwise.
  */
-int is_valid_addressing_mode(const char* instruction, const char* operand, int is_source);
+int is_valid_addressing_mode(const char* instruction, const Operand* operand, int is_source);
 
 /* Second Pass Validation Functions */
 
@@ -206,6 +194,4 @@ int is_entry_label_defined(const AssemblerState* state, const char* label);
 
 int is_extern_label_defined_as_entry(const AssemblerState* state, const char* label);
 
-int data_intergity_check(char *line);
-
 #endif 
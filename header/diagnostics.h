@@ -0,0 +1,172 @@
+#ifndef DIAGNOSTICS_H
+#define DIAGNOSTICS_H
+
+/*
+ * This header file contains declarations for the diagnostics collector.
+ * Errors and warnings are not printed where they are found: every stage
+ * records them with their severity, code, file, line and column, and the
+ * driver emits them once per input file, sorted by position, in a single
+ * buffered write. They can be emitted as text or as JSON Lines.
+ */
+
+#include <stdio.h>
+#include <stddef.h>
+#include "source.h"
+
+/**
+ * The severity of a diagnostic.
+ */
+typedef enum {
+    SEVERITY_NOTE,
+    SEVERITY_WARNING,
+    SEVERITY_ERROR
+} Severity;
+
+/**
+ * Identifies the kind of problem a diagnostic reports.
+ */
+typedef enum {
+    DIAG_OUT_OF_MEMORY,
+    DIAG_IO,
+    DIAG_LINE_TOO_LONG,
+    DIAG_INVALID_MACRO,
+    DIAG_INVALID_LABEL,
+    DIAG_DUPLICATE_LABEL,
+    DIAG_INVALID_DIRECTIVE,
+    DIAG_INVALID_DATA,
+    DIAG_INVALID_STRING,
+    DIAG_INVALID_ENTRY,
+    DIAG_INVALID_EXTERN,
+    DIAG_INVALID_INSTRUCTION,
+    DIAG_OPERAND_COUNT,
+    DIAG_INVALID_OPERAND,
+    DIAG_ADDRESSING_MODE,
+    DIAG_UNDEFINED_LABEL,
+    DIAG_SYMBOL_CONFLICT,
+    DIAG_STAGE_FAILED,
+    DIAG_INDENTED_COMMENT,
+    DIAG_CODE_COUNT
+} DiagnosticCode;
+
+/**
+ * The formats diagnostics can be emitted in.
+ */
+typedef enum {
+    DIAGNOSTICS_TEXT, /* file:line:column: severity: message [code] */
+    DIAGNOSTICS_JSON  /* One JSON object per line */
+} DiagnosticsFormat;
+
+/**
+ * Represents one recorded diagnostic. Strings are offsets into the
+ * collector's text pool, so recording never allocates per diagnostic.
+ */
+typedef struct {
+    unsigned char severity; /* A Severity */
+    unsigned char code;     /* A DiagnosticCode */
+    int file;               /* Index of the file, in the order files were set */
+    size_t file_name;       /* Offset of the file name in the text pool */
+    int line;               /* 1-based line, or 0 for the whole file */
+    int column;             /* 1-based column, or 0 if unknown */
+    size_t message;         /* Offset of the message in the text pool */
+    int sequence;           /* Order of recording, keeps the sort stable */
+} Diagnostic;
+
+/**
+ * Collects the diagnostics of one input file until they are emitted.
+ */
+typedef struct {
+    Diagnostic *items;
+    int count;
+    int capacity;
+    char *text;             /* Pool of null-terminated file names and messages */
+    size_t text_length;
+    size_t text_capacity;
+    int file;               /* Index of the current file, -1 before the first */
+    size_t file_name;       /* Offset of the current file name */
+    int error_count;
+    int warning_count;
+    int file_error_count;   /* Errors since the current file was set */
+    int max_errors;         /* Error budget per file, 0 for no limit */
+    int budget_reported;    /* Whether the exhausted budget was reported */
+    DiagnosticsFormat format;
+} Diagnostics;
+
+/**
+ * @brief Initializes an empty collector.
+ *
+ * @param diagnostics The collector to initialize.
+ * @param format The format used when the diagnostics are emitted.
+ */
+void diagnostics_init(Diagnostics *diagnostics, DiagnosticsFormat format);
+
+/**
+ * @brief Releases the memory held by a collector.
+ *
+ * @param diagnostics The collector to release.
+ */
+void diagnostics_free(Diagnostics *diagnostics);
+
+/**
+ * @brief Sets the file that subsequent diagnostics refer to.
+ *
+ * This also starts a new error budget.
+ *
+ * @param diagnostics The collector.
+ * @param filename The name of the file; it is copied.
+ */
+void diagnostics_set_file(Diagnostics *diagnostics, const char *filename);
+
+/**
+ * @brief Checks whether the current file has used up its error budget.
+ *
+ * Stages call this once per line or statement and stop early when it
+ * returns 1. The first time the budget runs out, a note saying so is
+ * recorded.
+ *
+ * @param diagnostics The collector, or NULL.
+ * @return 1 if the budget is exhausted, 0 otherwise.
+ */
+int diagnostics_budget_exhausted(Diagnostics *diagnostics);
+
+/**
+ * @brief Records a diagnostic for the current file.
+ *
+ * If there is no collector or memory runs out, the diagnostic is written
+ * to stderr right away, so it is never lost.
+ *
+ * @param diagnostics The collector, or NULL.
+ * @param severity The severity.
+ * @param code The kind of problem.
+ * @param line The 1-based line, or 0 if the diagnostic is about the whole file.
+ * @param column The 1-based column, or 0 if unknown.
+ * @param format A printf format for the message, followed by its arguments.
+ */
+void report(Diagnostics *diagnostics, Severity severity, DiagnosticCode code, int line, int column, const char *format, ...);
+
+/**
+ * @brief Appends the recorded diagnostics to a text buffer, sorted by
+ * file, line and column, and clears them.
+ *
+ * Whole-file diagnostics come after the line diagnostics of their file.
+ * The error and warning counts are kept.
+ *
+ * @param diagnostics The collector.
+ * @param out The buffer to append to.
+ * @return 0 on success, 1 if memory allocation failed.
+ */
+int diagnostics_render(Diagnostics *diagnostics, TextBuffer *out);
+
+/**
+ * @brief Writes the recorded diagnostics sorted by file, line and column
+ * in a single write, and clears them.
+ *
+ * Whole-file diagnostics come after the line diagnostics of their file.
+ * The error and warning counts are kept.
+ *
+ * @param diagnostics The collector.
+ * @param stream The stream to write to.
+ * @return 0 on success, 1 if the write failed.
+ */
+int diagnostics_flush(Diagnostics *diagnostics, FILE *stream);
+
+#endif
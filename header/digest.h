@@ -0,0 +1,24 @@
+#ifndef DIGEST_H
+#define DIGEST_H
+
+/*
+ * This header file contains the declaration of the content digest used to
+ * key cached results. It is SHA-256, so two different sources can be told
+ * apart by their digests alone and a cache key does not have to hold the
+ * source itself.
+ */
+
+#include <stddef.h>
+
+#define DIGEST_LENGTH 32
+
+/**
+ * @brief Computes the SHA-256 digest of a block of memory.
+ *
+ * @param data The bytes to digest.
+ * @param length The number of bytes.
+ * @param digest Receives the DIGEST_LENGTH bytes of the digest.
+ */
+void digest_compute(const char *data, size_t length, unsigned char digest[DIGEST_LENGTH]);
+
+#endif
@@ -0,0 +1,117 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+/*
+ * This header file contains declarations for the output layer. Every
+ * output file (.am, .ob, .ent, .ext) is built in a memory buffer first and
+ * committed with a single write to a temporary file, which is then renamed
+ * over the final name. A run that fails never leaves a partial file behind.
+ * Optionally, a file that already holds the new contents is left alone, so
+ * its timestamp does not trigger rebuilds downstream.
+ *
+ * Commits can also be handed to a background writer thread, so the thread
+ * that built the contents goes on with its next file while the disk is
+ * busy; failures are then collected and checked with output_wait.
+ */
+
+#include <stddef.h>
+#include "source.h"
+
+#define OUTPUT_NAME_LENGTH 260
+
+/**
+ * A background thread committing queued output files in order.
+ */
+typedef struct OutputWriter OutputWriter;
+
+/**
+ * Says how output files are committed and counts what happened to them.
+ * The counters of queued commits are updated by the writer thread; read
+ * them only after output_wait.
+ */
+typedef struct {
+    int skip_unchanged; /* 1 to leave a file alone if it already has the new contents */
+    int written;        /* Files written */
+    int unchanged;      /* Files left alone because they were identical */
+    OutputWriter *writer; /* Queue commits on this writer, or NULL to commit right away */
+    int pending;        /* Queued commits not done yet */
+    int failed;         /* Queued commits that failed */
+    int failed_errno;   /* errno of the first queued commit that failed */
+    char failed_file[OUTPUT_NAME_LENGTH]; /* Name of the first queued commit that failed */
+} OutputStats;
+
+/**
+ * @brief Starts a background writer thread.
+ *
+ * @param capacity The number of commits that can wait in the queue; a
+ * commit queued while it is full waits for room.
+ * @return The writer, or NULL if it could not be started.
+ */
+OutputWriter *output_writer_start(int capacity);
+
+/**
+ * @brief Finishes every queued commit and stops the writer thread.
+ *
+ * @param writer The writer, or NULL.
+ */
+void output_writer_stop(OutputWriter *writer);
+
+/**
+ * @brief Tells whether every commit queued through stats is done.
+ *
+ * @param stats The commit policy and counters.
+ * @return 1 if no commit is pending, 0 otherwise.
+ */
+int output_done(OutputStats *stats);
+
+/**
+ * @brief Waits until every commit queued through stats is done.
+ *
+ * @param stats The commit policy and counters.
+ * @return The number of queued commits that failed; failed_file and
+ * failed_errno describe the first one.
+ */
+int output_wait(OutputStats *stats);
+
+/**
+ * @brief Writes a file in one go and moves it into place.
+ *
+ * The data is written to a temporary file next to the destination, which
+ * is renamed to filename only once everything was written. If stats asks
+ * for it and the file already has exactly this contents, it is not
+ * touched at all. If stats has a writer, the data is copied and the
+ * commit is queued on it instead; its failure shows up in output_wait.
+ *
+ * @param stats The commit policy and counters, or NULL to always write.
+ * @param filename The name of the file to write.
+ * @param data The contents of the file.
+ * @param length The number of bytes in data.
+ * @return 0 on success, 1 on failure (errno is set and no file is left behind).
+ */
+int output_commit(OutputStats *stats, const char *filename, const char *data, size_t length);
+
+/**
+ * @brief Writes a text buffer to a file with output_commit.
+ *
+ * @param stats The commit policy and counters, or NULL to always write.
+ * @param filename The name of the file to write.
+ * @param text The contents of the file.
+ * @return 0 on success, 1 on failure (errno is set).
+ */
+int output_commit_text(OutputStats *stats, const char *filename, const TextBuffer *text);
+
+/**
+ * @brief Writes a text buffer to a file like output_commit_text, without copying it.
+ *
+ * If the commit is queued on the stats' writer, the writer takes over the
+ * buffer's memory and frees it once the file is written; text is left
+ * empty. Otherwise the file is written right away and text is untouched.
+ *
+ * @param stats The commit policy and counters, or NULL to always write.
+ * @param filename The name of the file to write.
+ * @param text The contents of the file.
+ * @return 0 on success, 1 on failure (errno is set).
+ */
+int output_commit_buffer(OutputStats *stats, const char *filename, TextBuffer *text);
+
+#endif
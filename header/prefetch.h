@@ -0,0 +1,69 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+/*
+ * This header file contains declarations for the prefetching reader of a
+ * batch run. A reader thread opens the source files in the order they are
+ * expected to be assembled and reads them into memory, staying at most a
+ * given number of files ahead of the stages that use them. A stage that
+ * asks for a file the reader has not reached yet loads it itself, so the
+ * order is only a hint and a stage never waits behind other files.
+ */
+
+#include <pthread.h>
+#include "source.h"
+
+/**
+ * The reader thread and the files it has loaded.
+ */
+typedef struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    char **names;               /* File names, without extension */
+    const char *extension;
+    const int *order;           /* Indices of the files in prefetch order */
+    int count;
+    int next;                   /* Position in order of the next file to consider */
+    int depth;                  /* Files loaded ahead and not yet taken, at most */
+    int ready;                  /* Files loaded ahead and not yet taken */
+    int stopping;
+    SourceBuffer *sources;
+    int *states;                /* A PrefetchState per file */
+    int *errors;                /* errno of a file that could not be loaded */
+} Prefetcher;
+
+/**
+ * @brief Starts the reader thread.
+ *
+ * @param prefetcher The prefetcher to start.
+ * @param names The file names, without extension; they must outlive the prefetcher.
+ * @param extension The extension added to every name.
+ * @param order The indices of the files in the order to load them; it must outlive the prefetcher.
+ * @param count The number of files.
+ * @param depth The number of files to load ahead, at least 1.
+ * @return 0 on success, 1 if the thread could not be started.
+ */
+int prefetcher_start(Prefetcher *prefetcher, char **names, const char *extension, const int *order, int count, int depth);
+
+/**
+ * @brief Takes a file, waiting for it if the reader is loading it and
+ * loading it on the calling thread if the reader has not reached it yet.
+ *
+ * Each file can be taken once.
+ *
+ * @param prefetcher The prefetcher.
+ * @param index The index of the file.
+ * @param source Receives the contents; release it with source_close.
+ * @return 0 on success, 1 if the file could not be read (errno is set).
+ */
+int prefetcher_take(Prefetcher *prefetcher, int index, SourceBuffer *source);
+
+/**
+ * @brief Stops the reader thread and releases the files nobody took.
+ *
+ * @param prefetcher The prefetcher to stop.
+ */
+void prefetcher_stop(Prefetcher *prefetcher);
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+/*
+ * This header file contains declarations for the character scanners used by
+ * the input layer and the line checks: finding line boundaries, skipping
+ * blanks and validating identifier characters. Each scanner has a scalar
+ * version and, on x86, SSE2 and AVX2 versions that look at 16 or 32 bytes at
+ * a time. The fastest version supported by the CPU is picked at start-up;
+ * all versions return identical results.
+ *
+ * Blanks are the characters isspace() accepts in the "C" locale:
+ * ' ', '\t', '\n', '\v', '\f' and '\r'. Identifier characters are the ASCII
+ * letters and digits accepted by isalnum() in the "C" locale.
+ */
+
+#include <stddef.h>
+
+/**
+ * The scanner implementations that can be selected.
+ */
+typedef enum {
+    SCAN_SCALAR = 0,
+    SCAN_SSE2 = 1,
+    SCAN_AVX2 = 2
+} ScanLevel;
+
+/**
+ * @brief Finds the next newline character.
+ *
+ * @param p The first character to examine.
+ * @param end One past the last character to examine.
+ * @return A pointer to the newline, or end if there is none.
+ */
+const char *scan_newline(const char *p, const char *end);
+
+/**
+ * @brief Skips leading blanks.
+ *
+ * @param p The first character to examine.
+ * @param end One past the last character to examine.
+ * @return A pointer to the first non-blank character, or end if there is none.
+ */
+const char *scan_skip_blanks(const char *p, const char *end);
+
+/**
+ * @brief Drops trailing blanks.
+ *
+ * @param start The first character of the text.
+ * @param end One past the last character of the text.
+ * @return One past the last non-blank character, or start if the text is blank.
+ */
+const char *scan_trim_end(const char *start, const char *end);
+
+/**
+ * @brief Counts leading identifier characters (ASCII letters and digits).
+ *
+ * @param p The first character to examine.
+ * @param length The number of characters to examine.
+ * @return The number of leading letters and digits.
+ */
+size_t scan_identifier_length(const char *p, size_t length);
+
+/**
+ * @brief Checks if a character is a blank.
+ *
+ * @param c The character to check.
+ * @return 1 if the character is a blank, 0 otherwise.
+ */
+int scan_is_blank(char c);
+
+/**
+ * @brief Returns the scanner implementation currently in use.
+ *
+ * @return The active scan level.
+ */
+ScanLevel scan_get_level(void);
+
+/**
+ * @brief Selects a scanner implementation, for benchmarks and comparisons.
+ *
+ * @param level The level to select.
+ * @return 0 on success, 1 if the CPU or the build does not support it.
+ */
+int scan_set_level(ScanLevel level);
+
+#endif
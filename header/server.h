@@ -0,0 +1,131 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+/*
+ * This header file contains declarations for the assembler server and its
+ * client. The server listens on a Unix domain socket and assembles the
+ * sources its clients send with the library API, on a fixed set of worker
+ * threads. Results are kept in a cache keyed by the options, the name and
+ * the SHA-256 digest of the contents of the source, so a source that did not change is answered
+ * without assembling it again.
+ *
+ * A connection carries any number of requests, each answered before the
+ * next one is read. A request is a header line followed by two payloads:
+ *
+ *     ASM1 <kind> <flags> <max-errors> <name-length> <data-length>\n
+ *     <name><data>
+ *
+ * kind is S when data is the source itself and P when data is the path of
+ * a source file the server reads. flags is a sum of REQUEST_ flags. The
+ * response is a header line followed by the outputs, in this order:
+ *
+ *     ASM1 <status> <outputs> <ic> <dc> <errors> <warnings> <am> <ob> <ent> <ext> <diagnostics>\n
+ *     <.am><.ob><.ent><.ext><diagnostics>
+ *
+ * status is 0 on success and 1 if the source has errors; outputs is a sum
+ * of RESPONSE_ flags telling which files exist; the last five numbers are
+ * the lengths of the payloads.
+ */
+
+#include "assemble.h"
+#include "output.h"
+
+#define PROTOCOL_MAGIC "ASM1"
+#define REQUEST_SOURCE 'S'
+#define REQUEST_PATH 'P'
+#define REQUEST_ONE_PASS 1
+#define REQUEST_JSON_DIAGNOSTICS 2
+#define RESPONSE_EXPANDED 1
+#define RESPONSE_OBJECT 2
+#define RESPONSE_ENTRIES 4
+#define RESPONSE_EXTERNS 8
+
+/**
+ * Says how the client assembles its files; the command line options it
+ * forwards to the server or applies itself.
+ */
+typedef struct {
+    AssembleOptions assemble;
+    int quiet;          /* Drop the progress messages */
+    int fail_fast;      /* Stop after the first file that fails */
+    int skip_unchanged; /* Leave output files alone if their contents did not change */
+} ClientOptions;
+
+/**
+ * Responses by request, shared by every thread that assembles.
+ */
+typedef struct ResultCache ResultCache;
+
+/**
+ * @brief Creates an empty result cache.
+ *
+ * @return The cache, or NULL if memory allocation failed.
+ */
+ResultCache *result_cache_create(void);
+
+/**
+ * @brief Releases a result cache and every response in it.
+ *
+ * @param cache The cache, or NULL.
+ */
+void result_cache_free(ResultCache *cache);
+
+/**
+ * @brief Appends the response for a source, assembling it only if the same
+ * name, options and contents are not in the cache.
+ *
+ * @param cache The result cache; it is safe to share between threads.
+ * @param name The name of the source, without extension.
+ * @param source The contents of the source.
+ * @param options How to assemble.
+ * @param response The buffer receiving the response, header line included.
+ * @return 0 on success, 1 if memory allocation failed.
+ */
+int assemble_cached(ResultCache *cache, const char *name, const SourceBuffer *source, const AssembleOptions *options, TextBuffer *response);
+
+/**
+ * @brief Writes the output files of a response like the command line does,
+ * then prints its progress message and diagnostics.
+ *
+ * @param name The file name the response is for, without extension.
+ * @param response The whole response, header line included.
+ * @param options The progress and output file options.
+ * @param stats How the output files are committed, and their counters.
+ * @return 0 if the file was assembled and written, 1 otherwise.
+ */
+int apply_response(const char *name, const TextBuffer *response, const ClientOptions *options, OutputStats *stats);
+
+/**
+ * @brief Writes the diagnostic for a source file that could not be read to
+ * stderr, using errno for the reason.
+ *
+ * @param filename The name of the file.
+ * @param format The format of the diagnostic.
+ */
+void report_unreadable_source(const char *filename, DiagnosticsFormat format);
+
+/**
+ * @brief Serves assemble requests on a Unix domain socket until SIGINT or SIGTERM.
+ *
+ * A stale socket left by a server that is gone is replaced; a socket a
+ * server still listens on is not.
+ *
+ * @param socket_path The path of the socket; it is removed on exit.
+ * @param threads The number of connections served at the same time.
+ * @return 0 on a clean shutdown, 1 if the socket could not be set up.
+ */
+int server_run(const char *socket_path, int threads);
+
+/**
+ * @brief Assembles files through a running server, writing the same
+ * output files and diagnostics as the command line.
+ *
+ * @param socket_path The path of the server's socket.
+ * @param names The file names, without the .as extension.
+ * @param name_count The number of file names.
+ * @param options How to assemble the files.
+ * @return 0 if every file was sent, 1 if the server could not be reached or the run stopped early.
+ */
+int client_run(const char *socket_path, char **names, int name_count, const ClientOptions *options);
+
+#endif
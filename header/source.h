@@ -0,0 +1,169 @@
+#ifndef SOURCE_H
+#define SOURCE_H
+
+/*
+ * This header file contains declarations for the input layer shared by the
+ * pre-processor and the first pass. A source file is mapped read-only (or
+ * read in one go when it cannot be mapped) and the passes walk over it as
+ * line views, so every input is read from the kernel exactly once per run.
+ */
+
+#include <stddef.h>
+
+/**
+ * Represents the whole contents of a source file in memory.
+ */
+typedef struct {
+    const char *data;     /* The contents, not null-terminated */
+    size_t length;        /* The number of bytes in data */
+    char *owned;          /* Heap buffer backing data, if it was read or built */
+    void *mapping;        /* Address of the read-only mapping, if it was mapped */
+    size_t mapping_length;
+} SourceBuffer;
+
+/**
+ * Represents a single line of a source buffer.
+ */
+typedef struct {
+    const char *start;    /* The first character of the line */
+    size_t length;        /* The number of characters, without the line terminator */
+    int has_newline;      /* 1 if the line was terminated by '\n' */
+    int number;           /* 1-based line number */
+} LineView;
+
+/**
+ * Walks over the lines of a source buffer.
+ */
+typedef struct {
+    const SourceBuffer *source;
+    size_t offset;
+    int line_number;
+} LineReader;
+
+/**
+ * Represents a growable text buffer used to build sources in memory.
+ */
+typedef struct {
+    char *data;
+    size_t length;
+    size_t capacity;
+} TextBuffer;
+
+/**
+ * @brief Loads a file into a source buffer.
+ *
+ * Regular files are mapped read-only. Files that cannot be mapped, such as
+ * pipes, are read into a heap buffer instead.
+ *
+ * @param source The source buffer to fill.
+ * @param filename The name of the file to load.
+ * @return 0 on success, 1 on failure (errno is set).
+ */
+int source_open(SourceBuffer *source, const char *filename);
+
+/**
+ * @brief Loads a file into a private heap buffer, never mapping it.
+ *
+ * Use it for files another process may truncate or rewrite while they
+ * are read: a mapping of a truncated file raises SIGBUS when touched,
+ * whereas a copy stays valid.
+ *
+ * @param source The source buffer to fill.
+ * @param filename The name of the file to load.
+ * @return 0 on success, 1 on failure (errno is set).
+ */
+int source_read(SourceBuffer *source, const char *filename);
+
+/**
+ * @brief Touches every page of a source buffer, so a mapped file is read
+ * from disk now instead of when the passes reach it.
+ *
+ * @param source The source buffer.
+ */
+void source_prefault(const SourceBuffer *source);
+
+/**
+ * @brief Reads the standard input, until end of file, into a source buffer.
+ *
+ * @param source The source buffer to fill.
+ * @return 0 on success, 1 on failure (errno is set).
+ */
+int source_read_stdin(SourceBuffer *source);
+
+/**
+ * @brief Creates a source buffer that takes ownership of a heap buffer.
+ *
+ * @param source The source buffer to fill.
+ * @param data The heap buffer; it is released by source_close.
+ * @param length The number of bytes in data.
+ */
+void source_from_memory(SourceBuffer *source, char *data, size_t length);
+
+/**
+ * @brief Releases the memory or mapping held by a source buffer.
+ *
+ * @param source The source buffer to release.
+ */
+void source_close(SourceBuffer *source);
+
+/**
+ * @brief Starts reading lines from the beginning of a source buffer.
+ *
+ * @param reader The line reader to initialize.
+ * @param source The source buffer to read from.
+ */
+void line_reader_init(LineReader *reader, const SourceBuffer *source);
+
+/**
+ * @brief Returns the next line of the source buffer.
+ *
+ * @param reader The line reader.
+ * @param line The line view to fill.
+ * @return 1 if a line was returned, 0 at the end of the buffer.
+ */
+int line_reader_next(LineReader *reader, LineView *line);
+
+/**
+ * @brief Copies a whole line into a text buffer, keeping its newline.
+ *
+ * The buffer is emptied first and grown to fit the line, so no line is
+ * ever cut off; its data is null-terminated.
+ *
+ * @param line The line to copy.
+ * @param text The destination buffer.
+ * @return 0 on success, 1 if memory allocation failed.
+ */
+int line_view_copy(const LineView *line, TextBuffer *text);
+
+/**
+ * @brief Makes room for more characters in a text buffer.
+ *
+ * Appending up to length more characters afterwards does not reallocate.
+ *
+ * @param text The text buffer.
+ * @param length The number of characters to make room for.
+ * @return 0 on success, 1 if memory allocation failed.
+ */
+int text_buffer_reserve(TextBuffer *text, size_t length);
+
+/**
+ * @brief Appends characters to a text buffer, growing it as needed.
+ *
+ * @param text The text buffer.
+ * @param str The characters to append.
+ * @param length The number of characters to append.
+ * @return 0 on success, 1 if memory allocation failed.
+ */
+int text_buffer_append(TextBuffer *text, const char *str, size_t length);
+
+/**
+ * @brief Appends a string to a text buffer as a quoted JSON string,
+ * escaping quotes, backslashes and control characters.
+ *
+ * @param text The text buffer.
+ * @param str The null-terminated string to append.
+ * @return 0 on success, 1 if memory allocation failed.
+ */
+int text_buffer_append_json(TextBuffer *text, const char *str);
+
+#endif
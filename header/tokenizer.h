@@ -0,0 +1,68 @@
+#ifndef TOKENIZER_H
+#define TOKENIZER_H
+
+/*
+ * This header file contains declarations for the line tokenizer used by the
+ * first pass. The tokenizer never writes into the line it is given: every
+ * token is returned as a (pointer, length) span into the original buffer,
+ * together with the column it starts at, so it is safe to use on read-only
+ * input and keeps no state between calls.
+ */
+
+#include <stddef.h>
+
+/* Maximum number of operand spans recorded for a single line.
+   One more than any instruction accepts, so surplus operands can be reported. */
+#define MAX_LINE_OPERANDS 3
+
+/**
+ * Represents a token as a view into a source line.
+ */
+typedef struct {
+    const char *start;
+    int length;
+    int column; /* 1-based column of the first character, 0 for an empty span */
+} Span;
+
+/**
+ * Represents the tokens of a single assembly line.
+ */
+typedef struct {
+    Span label;                          /* Label name without the ':' (empty if none) */
+    int has_label;
+    Span op;                             /* Mnemonic or directive name */
+    Span rest;                           /* Trimmed text following the mnemonic or directive */
+    Span operands[MAX_LINE_OPERANDS];    /* Comma separated, trimmed operands */
+    int operand_count;                   /* Number of operands found (may exceed MAX_LINE_OPERANDS) */
+} LineTokens;
+
+/**
+ * @brief Splits a line into label, mnemonic and operand spans.
+ *
+ * @param line The start of the line. It does not need to be null-terminated.
+ * @param length The number of characters in the line.
+ * @param tokens The structure receiving the spans.
+ * @return 1 if the line contains a token, 0 if it is blank.
+ */
+int tokenize_line(const char *line, size_t length, LineTokens *tokens);
+
+/**
+ * @brief Compares a span with a null-terminated string.
+ *
+ * @param span The span to compare.
+ * @param str The string to compare against.
+ * @return 1 if they are equal, 0 otherwise.
+ */
+int span_equals(Span span, const char *str);
+
+/**
+ * @brief Copies a span into a null-terminated buffer, truncating if needed.
+ *
+ * @param span The span to copy.
+ * @param buffer The destination buffer.
+ * @param size The size of the destination buffer.
+ * @return A pointer to the destination buffer.
+ */
+char *span_copy(Span span, char *buffer, size_t size);
+
+#endif
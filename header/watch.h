@@ -0,0 +1,27 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+/*
+ * This header file contains the declaration of the watch mode. The input
+ * files are assembled once, then again each time one of them is saved.
+ * The directories of the files are watched with inotify, so editors that
+ * save by renaming a new file over the old one are seen too. Changes that
+ * come in a burst are gathered until the files are quiet for a moment, and
+ * only the files that changed are assembled again. Results go through the
+ * same cache as the server, so saving a file back to an earlier contents
+ * is answered without assembling.
+ */
+
+#include "server.h"
+
+/**
+ * @brief Assembles files, then again each time they change, until interrupted.
+ *
+ * @param names The file names, without the .as extension.
+ * @param name_count The number of file names.
+ * @param options How to assemble the files.
+ * @return 1 if the files could not be watched; otherwise it does not return.
+ */
+int watch_run(char **names, int name_count, const ClientOptions *options);
+
+#endif
@@ -0,0 +1,132 @@
+/****************************************************************/
+/* Arena allocator: per-file bump allocation */
+/****************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+/* The strictest alignment a C90 object can need */
+typedef union {
+    long l;
+    double d;
+    void *p;
+    void (*f)(void);
+} ArenaAlign;
+
+#define ARENA_ALIGNMENT sizeof(ArenaAlign)
+#define ALIGN_UP(n) (((n) + ARENA_ALIGNMENT - 1) / ARENA_ALIGNMENT * ARENA_ALIGNMENT)
+#define CHUNK_HEADER ALIGN_UP(sizeof(ArenaChunk))
+
+/* Initializes an empty arena */
+void arena_init(Arena *arena, size_t chunk_size)
+{
+    arena->first = NULL;
+    arena->current = NULL;
+    arena->chunk_size = chunk_size;
+    arena->bytes = 0;
+    arena->allocations = 0;
+}
+
+/* Allocates a chunk with at least size usable bytes */
+static ArenaChunk *new_chunk(size_t size)
+{
+    ArenaChunk *chunk = malloc(CHUNK_HEADER + size);
+
+    if (chunk)
+    {
+        chunk->next = NULL;
+        chunk->size = size;
+        chunk->used = 0;
+    }
+    return chunk;
+}
+
+/* Allocates memory from an arena, aligned for any type */
+void *arena_alloc(Arena *arena, size_t size)
+{
+    ArenaChunk *chunk = arena->current;
+    size_t needed = ALIGN_UP(size > 0 ? size : 1);
+    size_t chunk_size;
+
+    /* Move on to the next kept chunk, or add one after the current chunk */
+    if (!chunk || chunk->size - chunk->used < needed)
+    {
+        if (chunk && chunk->next && chunk->next->size >= needed)
+        {
+            chunk = chunk->next;
+            chunk->used = 0;
+        }
+        else if (!chunk && arena->first && arena->first->size >= needed)
+        {
+            chunk = arena->first;
+            chunk->used = 0;
+        }
+        else
+        {
+            chunk_size = needed > arena->chunk_size ? needed : arena->chunk_size;
+            chunk = new_chunk(chunk_size);
+            if (!chunk)
+            {
+                return NULL;
+            }
+            if (arena->current)
+            {
+                chunk->next = arena->current->next;
+                arena->current->next = chunk;
+            }
+            else
+            {
+                chunk->next = arena->first;
+                arena->first = chunk;
+            }
+        }
+        arena->current = chunk;
+    }
+
+    chunk->used += needed;
+    arena->bytes += size;
+    arena->allocations++;
+    return (char *)chunk + CHUNK_HEADER + chunk->used - needed;
+}
+
+/* Copies length characters into the arena and null-terminates them */
+char *arena_strndup(Arena *arena, const char *str, size_t length)
+{
+    char *copy = arena_alloc(arena, length + 1);
+
+    if (copy)
+    {
+        memcpy(copy, str, length);
+        copy[length] = '\0';
+    }
+    return copy;
+}
+
+/* Copies a null-terminated string into the arena */
+char *arena_strdup(Arena *arena, const char *str)
+{
+    return arena_strndup(arena, str, strlen(str));
+}
+
+/* Releases every allocation at once; the chunks are kept for reuse */
+void arena_reset(Arena *arena)
+{
+    arena->current = NULL;
+    arena->bytes = 0;
+    arena->allocations = 0;
+}
+
+/* Returns every chunk of an arena to the system */
+void arena_free(Arena *arena)
+{
+    ArenaChunk *chunk = arena->first;
+    ArenaChunk *next;
+
+    while (chunk)
+    {
+        next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    arena_init(arena, arena->chunk_size);
+}
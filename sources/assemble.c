@@ -0,0 +1,146 @@
+/****************************************************************/
+/* Library interface: assembling from memory to memory */
+/****************************************************************/
+#include "assembler.h"
+#include "assemble.h"
+
+#define MAX_FILENAME_LENGTH 260
+#define EXTENSION_ROOM 4 /* Longest extension added to the name, ".as" or ".am" */
+
+/* Fills options with the defaults of the command line */
+void assemble_options_init(AssembleOptions *options)
+{
+    options->single_pass = 0;
+    options->max_errors = 0;
+    options->threads = 1;
+    options->diagnostics_format = DIAGNOSTICS_TEXT;
+}
+
+/* Runs every stage of one source on a state of its own; the stages and
+   their failure notes are those of the command line, minus the files */
+int assemble_buffer(const char *name, const char *data, size_t length, const AssembleOptions *options, AssembleResult *result)
+{
+    char sourceName[MAX_FILENAME_LENGTH];
+    char expandedName[MAX_FILENAME_LENGTH];
+    AssembleOptions defaults;
+    SourceBuffer source;
+    SourceBuffer expanded;
+    Diagnostics diagnostics;
+    AssemblerState *state = NULL;
+    Macro *macros = NULL;
+    int macroCount = 0;
+    int error = 0;
+
+    memset(result, 0, sizeof(*result));
+    result->ic = -1;
+    result->dc = -1;
+    if (options == NULL)
+    {
+        assemble_options_init(&defaults);
+        options = &defaults;
+    }
+
+    memset(&source, 0, sizeof(source));
+    memset(&expanded, 0, sizeof(expanded));
+    source.data = data;
+    source.length = length;
+    expanded.data = "";
+
+    diagnostics_init(&diagnostics, options->diagnostics_format);
+    diagnostics.max_errors = options->max_errors;
+    if (strlen(name) + EXTENSION_ROOM >= MAX_FILENAME_LENGTH)
+    {
+        diagnostics_set_file(&diagnostics, name);
+        report(&diagnostics, SEVERITY_ERROR, DIAG_IO, 0, 0, "Source name is too long");
+        error = 1;
+        goto done;
+    }
+    sprintf(sourceName, "%s.as", name);
+    sprintf(expandedName, "%s.am", name);
+    diagnostics_set_file(&diagnostics, sourceName);
+
+    state = init_assembler_state();
+    if (!state)
+    {
+        report(&diagnostics, SEVERITY_ERROR, DIAG_OUT_OF_MEMORY, 0, 0, "Failed to initialize assembler state");
+        error = 1;
+        goto done;
+    }
+    state->single_pass = options->single_pass;
+    state->chunk_threads = options->threads > 1 ? options->threads : 1;
+    state->diagnostics = &diagnostics;
+    state->output = NULL;
+
+    macros = readMacrosFromSource(&source, &macroCount, &error, &diagnostics, &state->arena);
+    if (error == 1)
+    {
+        report(&diagnostics, SEVERITY_NOTE, DIAG_STAGE_FAILED, 0, 0, "Failed to read macros; check the macro definitions");
+        goto done;
+    }
+    expandMacrosInSource(&source, NULL, macros, macroCount, &expanded, &error, &diagnostics, NULL);
+    if (error == 1)
+    {
+        report(&diagnostics, SEVERITY_NOTE, DIAG_STAGE_FAILED, 0, 0, "Failed to expand macros; check the macro usage");
+        goto done;
+    }
+
+    if (text_buffer_reserve(&result->expanded, expanded.length) != 0 ||
+        text_buffer_append(&result->expanded, expanded.data, expanded.length) != 0)
+    {
+        report(&diagnostics, SEVERITY_ERROR, DIAG_OUT_OF_MEMORY, 0, 0, "Failed to copy the expanded source");
+        error = 1;
+        goto done;
+    }
+
+    /* From here on, line numbers refer to the expanded source */
+    diagnostics_set_file(&diagnostics, expandedName);
+    first_pass(state, &expanded, macros, &macroCount, &error);
+    if (error == 1)
+    {
+        report(&diagnostics, SEVERITY_NOTE, DIAG_STAGE_FAILED, 0, 0, "First pass failed; no output files were written");
+        goto done;
+    }
+    result->ic = state->IC - MEMORY_START;
+    result->dc = state->DC;
+
+    update_entry_addresses(state);
+    if (build_output_files(state, &result->object, &result->entries, &result->externs) != 0)
+    {
+        report(&diagnostics, SEVERITY_NOTE, DIAG_STAGE_FAILED, 0, 0, "Second pass failed; no output files were written");
+        error = 1;
+    }
+
+done:
+    if (error)
+    {
+        free(result->object.data);
+        free(result->entries.data);
+        free(result->externs.data);
+        memset(&result->object, 0, sizeof(TextBuffer));
+        memset(&result->entries, 0, sizeof(TextBuffer));
+        memset(&result->externs, 0, sizeof(TextBuffer));
+    }
+    freeMacros(macros, macroCount);
+    source_close(&expanded);
+    free_assembler_state(state);
+
+    result->error_count = diagnostics.error_count;
+    result->warning_count = diagnostics.warning_count;
+    if (diagnostics_render(&diagnostics, &result->diagnostics) != 0)
+    {
+        error = 1;
+    }
+    diagnostics_free(&diagnostics);
+    return error;
+}
+
+/* Releases the buffers of a result */
+void assemble_result_free(AssembleResult *result)
+{
+    free(result->expanded.data);
+    free(result->object.data);
+    free(result->entries.data);
+    free(result->externs.data);
+    free(result->diagnostics.data);
+    memset(result, 0, sizeof(*result));
+}
@@ -2,13 +2,19 @@
 /* File containing integrity checks for pre-assembler, first pass, and second pass */
 /****************************************************************/
 #include "check.h"
+#include "scan.h"
 
 /* Constants for numeric values */
 #define MAX_IMMEDIATE_VALUE 2047
-#define MIN_IMMEDIATE_VALUE -2078
+#define MIN_IMMEDIATE_VALUE -2048
 #define MAX_REGISTER_NUMBER 7
 #define MIN_REGISTER_NUMBER 0
 
+/* Operand prefixes */
+#define IMMEDIATE_PREFIX '#'
+#define INDIRECT_PREFIX '*'
+#define REGISTER_PREFIX 'r'
+
 /* Arrays for reserved words */
 const char *instruction_set[] = {
     "mov", "cmp", "add", "sub", "lea",
@@ -38,13 +44,9 @@ int check_line_length(const char *line)
 /* Checks if the line is empty or contains only whitespace */
 int is_empty_or_whitespace(const char *line)
 {
-    while (*line)
-    {
-        if (!isspace((unsigned char)*line))
-            return 0;
-        line++;
-    }
-    return 1;
+    const char *end = line + strlen(line);
+
+    return scan_skip_blanks(line, end) == end;
 }
 
 /* Checks if the line is a valid comment (starts with ';') */
@@ -71,324 +73,138 @@ int isInSet(const char *word, const char *set[], int setSize)
     return 0; /* 0 - The word is not in the array */
 }
 
-/* Checks if the label is valid */
-int isValidLabel(const char *word, Macro *macros, int *macroCount)
+/* Checks a label name and copies it into name_copy.
+   Returns NULL if the name is valid, or the reason it is not */
+static const char *label_name_problem(const char *name, size_t length, char *name_copy, Macro *macros, int *macroCount)
 {
-    int length = strlen(word);
     int i;
-    char label[MAX_LABEL_LENGTH + 1];
 
     /* Check label length */
     if (length > MAX_LABEL_LENGTH)
-    { 
-
-        fprintf(stderr, "Error at line %d: Label '%s' is invalid: It is too long\n", __LINE__, word);
-        return 0; /* False */
+    {
+        return "It is too long";
     }
 
     /* Check first character */
-    if (!isalpha(word[0]))
+    if (length == 0 || !isalpha((unsigned char)name[0]))
     {
-        fprintf(stderr, "Error at line %d: Label '%s' is invalid: It must start with a letter\n", __LINE__, word);
-        return 0; /* False */
+        return "It must start with a letter";
     }
 
     /* Check remaining characters */
-    for (i = 1; i < length - 1; i++)
+    if (scan_identifier_length(name + 1, length - 1) != length - 1)
     {
-
-        if (!isalnum(word[i]))
-        {
-            fprintf(stderr, "Error at line %d: Label '%s' is invalid: It contains non-alphanumeric characters\n", __LINE__, word);
-            return 0; /* False */
-        }
+        return "It contains non-alphanumeric characters";
     }
 
-    /* Remove colon for reserved word check */
-    strncpy(label, word, length - 1);
-    label[length - 1] = '\0';
+    memcpy(name_copy, name, length);
+    name_copy[length] = '\0';
 
     /* Check if label is a reserved word */
-    if (isInSet(label, instruction_set, instruction_set_size) ||
-        isInSet(label, Guidelines_set, Guidelines_set_size) ||
-        isInSet(label, registers, registers_size))
+    if (isInSet(name_copy, instruction_set, instruction_set_size) ||
+        isInSet(name_copy, Guidelines_set, Guidelines_set_size) ||
+        isInSet(name_copy, registers, registers_size))
     {
-
-        fprintf(stderr, "Error at line %d: Label '%s' is invalid: It is a reserved word or a macro name\n", __LINE__, word);
-        return 0; /* False */
+        return "It is a reserved word or a macro name";
     }
 
     /* Check if label is a macro */
     for (i = 0; i < *macroCount; i++)
     {
-        if (strcmp(label, macros[i].name) == 0)
-        {
-            fprintf(stderr, "Error at line %d: Label '%s' is invalid: It is already defined as a macro\n", __LINE__, word);
-            return 0; /* False */
-        }
-    }
-
-
-    return 1; /* True */
-
-}
-
-/* Checks the integrity of data directive */
-int data_intergity_check(char *line)
-{
-    char *operands = my_strdup(line);
-    char *original_operands = operands; 
-    int error = 0;
-    char *token;
-    char *endptr;
-
-    while (isspace(*operands))
-        operands++;
-    if (*operands == '\0')
-    {
-        fprintf(stderr, "Error at line %d: No data values provided after .data\n", __LINE__);
-        error = 1;
-    }
-
-    if (has_invalid_characters(operands))
-    {
-        fprintf(stderr, "Error at line %d: Invalid characters in .data directive operands\n", __LINE__);
-        error = 1;
-    }
-
-    token = strtok(operands, ",");
-    while (token != NULL)
-    {
-        strtol(token, &endptr, 10);
-        if (*endptr != '\0' && !isspace(*endptr))
+        if (strcmp(name_copy, macros[i].name) == 0)
         {
-            fprintf(stderr, "Error at line %d: Invalid number format in .data directive operands\n", __LINE__);
-            error = 1;
+            return "It is already defined as a macro";
         }
-        token = strtok(NULL, ",");
     }
 
-    free(original_operands);  
-
-    if (error == 1)
-    {
-        return 1;
-    }
-
-    return 0;
+    return NULL;
 }
 
-/* Checks for invalid characters in data directive */
-int has_invalid_characters(const char *str)
-{
-    while (*str)
-    {
-        if (!isdigit(*str) && *str != '-' && *str != '+' && !isspace(*str) && *str != ',' && *str != ' ')
-        {
-            return 1; /* TRUE */
-        }
-        str++;
-    }
-    return 0; /* FALSE */
-}
-
-/* Checks the integrity of string directive */
-int string_intergity_check(char *line)
+/* Checks if the label is valid */
+int isValidLabel(AssemblerState *state, const char *word, size_t length, int column, Macro *macros, int *macroCount)
 {
-    int error = 0;
-    char *operands = my_strdup(line);
-    char *original_operands = operands;  
-
-    if (operands == NULL)
-    {
-        fprintf(stderr, "Error at line %d: There is no string.\n", __LINE__);
-        return 1;
-    }
+    char label[MAX_LABEL_LENGTH + 1];
+    const char *problem;
 
-    if (*operands != '"')
-    {
-        fprintf(stderr, "Error at line %d: String must start with a double quote (\").\n", __LINE__);
-        error = 1;
-    }
-    else
+    problem = label_name_problem(word, length, label, macros, macroCount);
+    if (problem != NULL)
     {
-        operands++;
-
-        while (*operands != '"' && *operands != '\0')
-        {
-            if (!isprint(*operands))
-            {
-                fprintf(stderr, "Error at line %d: Non-printable character found in string.\n", __LINE__);
-                error = 1;
-            }
-            operands++;
-        }
-
-        if (*operands != '"')
-        {
-            fprintf(stderr, "Error at line %d: String must end with a double quote (\").\n", __LINE__);
-            error = 1;
-        }
-        else
-        {
-            operands++;
-            while (*operands != '\0')
-            {
-                if (!isspace(*operands))
-                {
-                    fprintf(stderr, "Error at line %d: Additional characters found after the string.\n", __LINE__);
-                    error = 1;
-                }
-                operands++;
-            }
-        }
+        report(state->diagnostics, SEVERITY_ERROR, DIAG_INVALID_LABEL, state->current_line, column, "Label '%.*s' is invalid: %s", (int)length, word, problem);
+        return 0; /* False */
     }
 
-    free(original_operands);  
-
-    return error;
+    return 1; /* True */
 }
 
 /* Checks the integrity of entry directive */
-int entry_intergity_check(char *line, AssemblerState *state, Macro *macros, int *macroCount)
+int entry_intergity_check(Span operand, AssemblerState *state, Macro *macros, int *macroCount)
 
 {
     int error = 0;
-    char *operands = NULL;
-    char *label = NULL;
-    char *label_end;
-    int label_length;
-    int extraCharsFound = 0;
-char *trimmed_operands;
-    operands = my_strdup(line);
-    if (operands == NULL) {
-        fprintf(stderr, "Error at line %d: Memory allocation failed.\n", __LINE__);
-        return 1;
-    }
+    const char *label = operand.start;
+    const char *end = operand.start + operand.length;
+    const char *label_end;
 
-     trimmed_operands = operands;
-    while (isspace(*trimmed_operands))
-        trimmed_operands++; /* Remove leading spaces */
+    label = scan_skip_blanks(label, end); /* Remove leading spaces */
 
     /* Check for additional characters between the directive and the label */
-    if (*trimmed_operands != '\0' && !isalpha(*trimmed_operands))
+    if (label < end && !isalpha((unsigned char)*label))
     {
-        fprintf(stderr, "Error at line %d: Invalid character '%c' found between .entry and the label.\n", __LINE__, *trimmed_operands);
-        error = 1;
-        goto cleanup;
+        report(state->diagnostics, SEVERITY_ERROR, DIAG_INVALID_ENTRY, state->current_line, 0, "Invalid character '%c' found between .entry and the label", *label);
+        return 1;
     }
 
     /* Find the end of the label */
-    label_end = trimmed_operands;
-    while (*label_end != '\0' && !isspace(*label_end))
+    label_end = label;
+    while (label_end < end && !scan_is_blank(*label_end))
     {
         label_end++;
     }
 
-    label_length = label_end - trimmed_operands;
-    label = (char *)malloc(label_length + 1);
-    if (label == NULL)
-    {
-        fprintf(stderr, "Error at line %d: Memory allocation failed.\n", __LINE__);
-        error = 1;
-        goto cleanup;
-    }
-    strncpy(label, trimmed_operands, label_length);
-    label[label_length] = '\0';
-
     /* Check for additional characters after the label */
-    while (*label_end != '\0')
-    {
-        if (!isspace(*label_end))
-        {
-            extraCharsFound = 1;
-            break;
-        }
-        label_end++;
-    }
-
-    if (extraCharsFound)
+    if (scan_skip_blanks(label_end, end) != end)
     {
-        fprintf(stderr, "Error at line %d: Additional characters found after the label '%s'.\n", __LINE__, label);
+        report(state->diagnostics, SEVERITY_ERROR, DIAG_INVALID_ENTRY, state->current_line, 0, "Additional characters found after the label '%.*s'", (int)(label_end - label), label);
         error = 1;
     }
 
     /* Check label validity */
-    if (!error && !isValidLabel(label, macros, macroCount))
+    if (!error && !isValidLabel(state, label, (size_t)(label_end - label), 0, macros, macroCount))
     {
-        fprintf(stderr, "Error at line %d: Invalid label '%s' in .entry directive.\n", __LINE__, label);
         error = 1;
     }
 
-cleanup:
-    free(label);
-    free(operands);
-
     return error;
 }
 /* Checks the integrity of extern directive */
-int extern_intergity_check(char *line, AssemblerState *state)
+int extern_intergity_check(Span operand, AssemblerState *state)
 {
-    int error = 0;
-    char *operands = my_strdup(line);
-    char *label_end;
-    int label_length;
-    char *label = NULL;
-    int extraCharsFound = 0;
-
-    if (operands == NULL) {
-        fprintf(stderr, "Error: Memory allocation failed.\n");
-        return 1;
-    }
+    const char *label = operand.start;
+    const char *end = operand.start + operand.length;
+    const char *label_end;
 
-    while (isspace(*operands))
-        operands++;
+    label = scan_skip_blanks(label, end);
 
     /* Check for invalid characters before the label */
-    if (*operands != '\0' && !isalpha(*operands))
-    {
-        fprintf(stderr, "Error: Invalid character '%c' found between .extern and the label.\n", *operands);
-        error = 1;
-        goto cleanup;
-    }
-
-    label_end = operands;
-    while (*label_end != '\0' && !isspace(*label_end))
-    {
-        label_end++;
-    }
-
-    label_length = label_end - operands;
-    label = (char *)malloc(label_length + 1);
-    if (label == NULL)
+    if (label < end && !isalpha((unsigned char)*label))
     {
-        fprintf(stderr, "Error: Memory allocation failed.\n");
-        error = 1;
-        goto cleanup;
+        report(state->diagnostics, SEVERITY_ERROR, DIAG_INVALID_EXTERN, state->current_line, 0, "Invalid character '%c' found between .extern and the label", *label);
+        return 1;
     }
-    strncpy(label, operands, label_length);
-    label[label_length] = '\0';
 
-    while (*label_end != '\0')
+    label_end = label;
+    while (label_end < end && !scan_is_blank(*label_end))
     {
-        if (!isspace(*label_end))
-        {
-            extraCharsFound = 1;
-            break;
-        }
         label_end++;
     }
 
-    if (extraCharsFound)
+    if (scan_skip_blanks(label_end, end) != end)
     {
-        fprintf(stderr, "Error: Additional characters found after the label '%s'.\n", label);
-        error = 1;
+        report(state->diagnostics, SEVERITY_ERROR, DIAG_INVALID_EXTERN, state->current_line, 0, "Additional characters found after the label '%.*s'", (int)(label_end - label), label);
+        return 1;
     }
 
-cleanup:
-    free(label);
-    free(operands);
-    return error;
+    return 0;
 }
 
 /* Checks if the word is a reserved word */
@@ -404,17 +220,11 @@ int is_reserved_word(const char *word)
 }
 
 /* Checks if the label is already defined in the assembly state */
-int is_duplicate_label(const char *label, const AssemblerState *state)
+int is_duplicate_label(const char *label, size_t length, const AssemblerState *state)
 {
-    int i;
-    for (i = 0; i < state->label_count; i++)
-    {
-        if (strcmp(state->label_table[i].name, label) == 0)
-        {
-            return 1;
-        }
-    }
-    return 0;
+    int symbol = find_symbol_length(state, label, length);
+
+    return symbol != NO_SYMBOL && state->symbols[symbol].label != -1;
 }
 
 /* Checks if the instruction is valid (is a reserved word) */
@@ -423,12 +233,18 @@ int is_valid_instruction(const char *instruction)
     return is_reserved_word(instruction);
 }
 
-/* Checks if the immediate operand is valid (MIN_IMMEDIATE_VALUE <= value <= MAX_IMMEDIATE_VALUE) */
-int is_valid_immediate(const char *operand)
+/* Finds an instruction by a name that need not be null-terminated */
+const char *find_instruction(const char *name, size_t length)
 {
-    char *endptr;
-    long value = strtol(operand + 1, &endptr, 10);
-    return *endptr == '\0' && value >= MIN_IMMEDIATE_VALUE && value <= MAX_IMMEDIATE_VALUE;
+    int i;
+    for (i = 0; i < instruction_set_size; i++)
+    {
+        if (strncmp(instruction_set[i], name, length) == 0 && instruction_set[i][length] == '\0')
+        {
+            return instruction_set[i];
+        }
+    }
+    return NULL;
 }
 
 /* Checks if the number of operands is correct for the given instruction */
@@ -452,35 +268,119 @@ int check_operand_count(const char *instruction, int operand_count)
     return 0;
 }
 
-/* Checks if the operand is valid (immediate, register, or label) */
-int is_valid_operand(const char *operand, Macro *macros, int *macroCount)
+/* Parses the digits of an immediate operand (after the '#') */
+static int parse_immediate(const char *text, size_t length, short *value)
 {
-    if (operand[0] == '#')
+    size_t i = 0;
+    long number = 0;
+    int negative = 0;
+
+    if (i < length && (text[i] == '-' || text[i] == '+'))
+    {
+        negative = text[i] == '-';
+        i++;
+    }
+    if (i == length)
     {
-        return is_valid_immediate(operand);
+        return 0; /* No digits */
     }
 
-    if (operand[0] == '*')
+    for (; i < length; i++)
     {
-        return (strlen(operand) == 2 && operand[1] == 'r') ||
-               (strlen(operand) == 3 && operand[1] == 'r' && operand[2] >= '0' && operand[2] <= '7');
+        if (text[i] < '0' || text[i] > '9')
+        {
+            return 0;
+        }
+        /* Stop accumulating once out of range so long never overflows */
+        if (number <= MAX_IMMEDIATE_VALUE + 1)
+        {
+            number = number * 10 + (text[i] - '0');
+        }
     }
 
-    if (operand[0] == 'r' && strlen(operand) == 2)
+    if (negative)
+    {
+        number = -number;
+    }
+    if (number < MIN_IMMEDIATE_VALUE || number > MAX_IMMEDIATE_VALUE)
     {
-        return operand[1] >= '0' && operand[1] <= '7';
+        return 0;
+    }
+    *value = (short)number;
+    return 1;
+}
+
+/* Classifies an operand (immediate, register, indirect register or label) in
+   one scan, validates it and fills its record */
+int classify_operand(AssemblerState *state, const char *text, size_t length, Operand *operand, Macro *macros, int *macroCount)
+{
+    char name[MAX_LABEL_LENGTH + 1];
+    const char *problem;
+
+    operand->reg = -1;
+    operand->value = 0;
+    operand->symbol = NO_SYMBOL;
+
+    if (length == 0)
+    {
+        operand->mode = ADDRESSING_DIRECT;
+        report(state->diagnostics, SEVERITY_ERROR, DIAG_INVALID_OPERAND, state->current_line, source_column(state, text), "Missing operand");
+        return 0;
+    }
+
+    if (text[0] == IMMEDIATE_PREFIX)
+    {
+        operand->mode = ADDRESSING_IMMEDIATE;
+        if (!parse_immediate(text + 1, length - 1, &operand->value))
+        {
+            report(state->diagnostics, SEVERITY_ERROR, DIAG_INVALID_OPERAND, state->current_line, source_column(state, text),
+                   "Invalid immediate value '%.*s'", (int)length, text);
+            return 0;
+        }
+        return 1;
+    }
+
+    if (text[0] == INDIRECT_PREFIX)
+    {
+        operand->mode = ADDRESSING_INDIRECT_REGISTER;
+        if (length != 3 || text[1] != REGISTER_PREFIX ||
+            text[2] < '0' + MIN_REGISTER_NUMBER || text[2] > '0' + MAX_REGISTER_NUMBER)
+        {
+            report(state->diagnostics, SEVERITY_ERROR, DIAG_INVALID_OPERAND, state->current_line, source_column(state, text),
+                   "Invalid indirect register '%.*s'", (int)length, text);
+            return 0;
+        }
+        operand->reg = (signed char)(text[2] - '0');
+        return 1;
     }
 
-    return isValidLabel(operand, macros, macroCount);
+    if (length == 2 && text[0] == REGISTER_PREFIX &&
+        text[1] >= '0' + MIN_REGISTER_NUMBER && text[1] <= '0' + MAX_REGISTER_NUMBER)
+    {
+        operand->mode = ADDRESSING_DIRECT_REGISTER;
+        operand->reg = (signed char)(text[1] - '0');
+        return 1;
+    }
+
+    /* Anything else names a label */
+    operand->mode = ADDRESSING_DIRECT;
+    problem = label_name_problem(text, length, name, macros, macroCount);
+    if (problem != NULL)
+    {
+        report(state->diagnostics, SEVERITY_ERROR, DIAG_INVALID_OPERAND, state->current_line, source_column(state, text),
+               "Label '%.*s' is invalid: %s", (int)length, text, problem);
+        return 0;
+    }
+    operand->symbol = intern_symbol(state, name);
+    return operand->symbol != NO_SYMBOL;
 }
 
 /* Checks if the addressing mode is valid for the given instruction and operand */
-int is_valid_addressing_mode(const char *instruction, const char *operand, int is_source)
+int is_valid_addressing_mode(const char *instruction, const Operand *operand, int is_source)
 {
-    int is_immediate = (operand[0] == '#');
-    int is_direct_register = (operand[0] == 'r' && strlen(operand) == 2 && operand[1] >= '0' && operand[1] <= '7');
-    int is_indirect_register = (operand[0] == '*' && strlen(operand) == 3 && operand[1] == 'r' && operand[2] >= '0' && operand[2] <= '7');
-    int is_direct = (!is_immediate && !is_direct_register && !is_indirect_register);
+    int is_immediate = (operand->mode == ADDRESSING_IMMEDIATE);
+    int is_indirect_register = (operand->mode == ADDRESSING_INDIRECT_REGISTER);
+    int is_direct = (operand->mode == ADDRESSING_DIRECT);
 
     if (strcmp(instruction, "lea") == 0)
     {
@@ -521,16 +421,7 @@ int is_valid_addressing_mode(const char *instruction, const char *operand, int i
 /* Checks if a label exists in the assembly state */
 int label_exists(const AssemblerState *state, const char *name)
 {
-    int i;
-    for (i = 0; i < state->label_count; i++)
-    {
-        if (strcmp(state->label_table[i].name, name) == 0)
-        {
-            return 0;
-        }
-    }
-    fprintf(stderr, "Error at line %d: Label '%s' does not exist in the assembly state.\n", __LINE__, name);
-    return 1;
+    return is_duplicate_label(name, strlen(name), state) ? 0 : 1;
 }
 
 /********************************/
@@ -544,7 +435,6 @@ int is_valid_entry_label(const char *label)
     {
         if (!isupper(*label))
         {
-            fprintf(stderr, "Error at line %d: Invalid entry label '%s'. Entry labels must contain only uppercase letters.\n", __LINE__, label);
             return 0;
         }
         label++;
@@ -562,14 +452,7 @@ int is_entry_label_defined(const AssemblerState *state, const char *label)
 /* Checks if the extern label is defined as an entry in the assembly state */
 int is_extern_label_defined_as_entry(const AssemblerState *state, const char *label)
 {
-    int i;
-    for (i = 0; i < state->entry_count; i++)
-    {
-        if (strcmp(state->entry_table[i].name, label) == 0)
-        {
-            fprintf(stderr, "Error at line %d: Extern label '%s' is also defined as an entry label.\n", __LINE__, label);
-            return 0;
-        }
-    }
-    return 1;
+    int symbol = find_symbol(state, label);
+
+    return symbol != NO_SYMBOL && state->symbols[symbol].is_entry ? 0 : 1;
 }
@@ -0,0 +1,286 @@
+/****************************************************************/
+/* Diagnostics collector: buffered, sorted error reporting */
+/****************************************************************/
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include "diagnostics.h"
+#include "source.h"
+
+#define INITIAL_DIAGNOSTICS 32
+#define INITIAL_POOL_SIZE 4096
+#define MESSAGE_GUESS 256
+#define NO_FILE_NAME ((size_t)-1)
+
+static const char *severity_names[] = {"note", "warning", "error"};
+
+static const char *code_names[DIAG_CODE_COUNT] = {
+    "out-of-memory", "io", "line-too-long", "invalid-macro",
+    "invalid-label", "duplicate-label", "invalid-directive", "invalid-data",
+    "invalid-string", "invalid-entry", "invalid-extern", "invalid-instruction",
+    "operand-count", "invalid-operand", "addressing-mode", "undefined-label",
+    "symbol-conflict", "stage-failed", "indented-comment"};
+
+/* Initializes an empty collector */
+void diagnostics_init(Diagnostics *diagnostics, DiagnosticsFormat format)
+{
+    memset(diagnostics, 0, sizeof(*diagnostics));
+    diagnostics->file = -1;
+    diagnostics->file_name = NO_FILE_NAME;
+    diagnostics->format = format;
+}
+
+/* Releases the memory held by a collector */
+void diagnostics_free(Diagnostics *diagnostics)
+{
+    int max_errors = diagnostics->max_errors;
+
+    free(diagnostics->items);
+    free(diagnostics->text);
+    diagnostics_init(diagnostics, diagnostics->format);
+    diagnostics->max_errors = max_errors;
+}
+
+/* Makes room for length more bytes in the text pool */
+static int reserve_text(Diagnostics *diagnostics, size_t length)
+{
+    size_t capacity;
+    char *grown;
+
+    if (diagnostics->text_length + length <= diagnostics->text_capacity)
+    {
+        return 0;
+    }
+    capacity = diagnostics->text_capacity > 0 ? diagnostics->text_capacity : INITIAL_POOL_SIZE;
+    while (diagnostics->text_length + length > capacity)
+    {
+        capacity *= 2;
+    }
+    grown = realloc(diagnostics->text, capacity);
+    if (!grown)
+    {
+        return 1;
+    }
+    diagnostics->text = grown;
+    diagnostics->text_capacity = capacity;
+    return 0;
+}
+
+/* Sets the file that subsequent diagnostics refer to */
+void diagnostics_set_file(Diagnostics *diagnostics, const char *filename)
+{
+    size_t length = strlen(filename) + 1;
+
+    diagnostics->file++;
+    diagnostics->file_error_count = 0;
+    diagnostics->budget_reported = 0;
+    if (reserve_text(diagnostics, length) != 0)
+    {
+        diagnostics->file_name = NO_FILE_NAME;
+        return;
+    }
+    memcpy(diagnostics->text + diagnostics->text_length, filename, length);
+    diagnostics->file_name = diagnostics->text_length;
+    diagnostics->text_length += length;
+}
+
+/* Returns the name of the file a diagnostic refers to */
+static const char *file_name_of(const Diagnostics *diagnostics, size_t offset)
+{
+    return offset == NO_FILE_NAME ? "<unknown>" : diagnostics->text + offset;
+}
+
+/* Records a diagnostic for the current file */
+void report(Diagnostics *diagnostics, Severity severity, DiagnosticCode code, int line, int column, const char *format, ...)
+{
+    va_list args;
+    Diagnostic *items;
+    Diagnostic *item;
+    size_t room;
+    int length;
+    int capacity;
+
+    if (!diagnostics)
+        goto unbuffered;
+    if (severity == SEVERITY_ERROR)
+    {
+        diagnostics->error_count++;
+        diagnostics->file_error_count++;
+    }
+    else if (severity == SEVERITY_WARNING)
+        diagnostics->warning_count++;
+
+    if (diagnostics->count == diagnostics->capacity)
+    {
+        capacity = diagnostics->capacity > 0 ? diagnostics->capacity * 2 : INITIAL_DIAGNOSTICS;
+        items = realloc(diagnostics->items, capacity * sizeof(Diagnostic));
+        if (!items)
+            goto unbuffered;
+        diagnostics->items = items;
+        diagnostics->capacity = capacity;
+    }
+
+    /* Format straight into the pool, growing it once if the guess was short */
+    if (reserve_text(diagnostics, MESSAGE_GUESS) != 0)
+        goto unbuffered;
+    room = diagnostics->text_capacity - diagnostics->text_length;
+    va_start(args, format);
+    length = vsnprintf(diagnostics->text + diagnostics->text_length, room, format, args);
+    va_end(args);
+    if (length < 0)
+        goto unbuffered;
+    if ((size_t)length >= room)
+    {
+        if (reserve_text(diagnostics, (size_t)length + 1) != 0)
+            goto unbuffered;
+        va_start(args, format);
+        vsnprintf(diagnostics->text + diagnostics->text_length, (size_t)length + 1, format, args);
+        va_end(args);
+    }
+
+    item = &diagnostics->items[diagnostics->count];
+    item->severity = (unsigned char)severity;
+    item->code = (unsigned char)code;
+    item->file = diagnostics->file;
+    item->file_name = diagnostics->file_name;
+    item->line = line;
+    item->column = column;
+    item->message = diagnostics->text_length;
+    item->sequence = diagnostics->count;
+    diagnostics->text_length += (size_t)length + 1;
+    diagnostics->count++;
+    return;
+
+unbuffered:
+    /* No collector or out of memory: do not lose the diagnostic */
+    fprintf(stderr, "%s:%d:%d: %s: ", diagnostics ? file_name_of(diagnostics, diagnostics->file_name) : "<unknown>",
+            line, column, severity_names[severity]);
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    fprintf(stderr, " [%s]\n", code_names[code]);
+}
+
+/* Checks whether the current file has used up its error budget */
+int diagnostics_budget_exhausted(Diagnostics *diagnostics)
+{
+    if (!diagnostics || diagnostics->max_errors <= 0 || diagnostics->file_error_count < diagnostics->max_errors)
+    {
+        return 0;
+    }
+    if (!diagnostics->budget_reported)
+    {
+        diagnostics->budget_reported = 1;
+        report(diagnostics, SEVERITY_NOTE, DIAG_STAGE_FAILED, 0, 0, "Stopped after %d errors (--max-errors)", diagnostics->max_errors);
+    }
+    return 1;
+}
+
+/* Orders diagnostics by file, then line (whole-file ones last), column and recording order */
+static int compare_diagnostics(const void *a, const void *b)
+{
+    const Diagnostic *x = a;
+    const Diagnostic *y = b;
+    unsigned long x_line = x->line > 0 ? (unsigned long)x->line : (unsigned long)-1;
+    unsigned long y_line = y->line > 0 ? (unsigned long)y->line : (unsigned long)-1;
+
+    if (x->file != y->file)
+        return x->file < y->file ? -1 : 1;
+    if (x_line != y_line)
+        return x_line < y_line ? -1 : 1;
+    if (x->column != y->column)
+        return x->column < y->column ? -1 : 1;
+    return x->sequence < y->sequence ? -1 : (x->sequence > y->sequence);
+}
+
+/* Appends one formatted diagnostic to the output buffer */
+static int append_diagnostic(TextBuffer *out, const Diagnostics *diagnostics, const Diagnostic *item)
+{
+    char position[64];
+    const char *file = file_name_of(diagnostics, item->file_name);
+    const char *message = diagnostics->text + item->message;
+    int error = 0;
+
+    if (diagnostics->format == DIAGNOSTICS_JSON)
+    {
+        error |= text_buffer_append(out, "{\"file\":", 8);
+        error |= text_buffer_append_json(out, file);
+        sprintf(position, ",\"line\":%d,\"column\":%d,\"severity\":\"", item->line, item->column);
+        error |= text_buffer_append(out, position, strlen(position));
+        error |= text_buffer_append(out, severity_names[item->severity], strlen(severity_names[item->severity]));
+        error |= text_buffer_append(out, "\",\"code\":\"", 10);
+        error |= text_buffer_append(out, code_names[item->code], strlen(code_names[item->code]));
+        error |= text_buffer_append(out, "\",\"message\":", 12);
+        error |= text_buffer_append_json(out, message);
+        error |= text_buffer_append(out, "}\n", 2);
+        return error;
+    }
+
+    error |= text_buffer_append(out, file, strlen(file));
+    if (item->line > 0 && item->column > 0)
+        sprintf(position, ":%d:%d: ", item->line, item->column);
+    else if (item->line > 0)
+        sprintf(position, ":%d: ", item->line);
+    else
+        strcpy(position, ": ");
+    error |= text_buffer_append(out, position, strlen(position));
+    error |= text_buffer_append(out, severity_names[item->severity], strlen(severity_names[item->severity]));
+    error |= text_buffer_append(out, ": ", 2);
+    error |= text_buffer_append(out, message, strlen(message));
+    error |= text_buffer_append(out, " [", 2);
+    error |= text_buffer_append(out, code_names[item->code], strlen(code_names[item->code]));
+    error |= text_buffer_append(out, "]\n", 2);
+    return error;
+}
+
+/* Appends the recorded diagnostics to a buffer, sorted, and clears them */
+int diagnostics_render(Diagnostics *diagnostics, TextBuffer *out)
+{
+    size_t length;
+    int error = 0;
+    int i;
+
+    if (diagnostics->count == 0)
+    {
+        return 0;
+    }
+
+    qsort(diagnostics->items, (size_t)diagnostics->count, sizeof(Diagnostic), compare_diagnostics);
+    for (i = 0; i < diagnostics->count && !error; i++)
+    {
+        error = append_diagnostic(out, diagnostics, &diagnostics->items[i]);
+    }
+
+    /* Keep only the current file name in the pool */
+    diagnostics->count = 0;
+    diagnostics->text_length = 0;
+    if (diagnostics->file_name != NO_FILE_NAME)
+    {
+        length = strlen(diagnostics->text + diagnostics->file_name) + 1;
+        memmove(diagnostics->text, diagnostics->text + diagnostics->file_name, length);
+        diagnostics->file_name = 0;
+        diagnostics->text_length = length;
+    }
+    return error;
+}
+
+/* Writes the recorded diagnostics sorted, in a single write, and clears them */
+int diagnostics_flush(Diagnostics *diagnostics, FILE *stream)
+{
+    TextBuffer out = {NULL, 0, 0};
+    int error = diagnostics_render(diagnostics, &out);
+
+    /* Whatever could be formatted is written, even if memory ran out */
+    if (out.length > 0 && fwrite(out.data, 1, out.length, stream) != out.length)
+    {
+        error = 1;
+    }
+    if (out.length > 0)
+    {
+        fflush(stream);
+    }
+    free(out.data);
+    return error;
+}
@@ -0,0 +1,108 @@
+/****************************************************************/
+/* Content digest: SHA-256 of a source, for cache keys */
+/****************************************************************/
+
+#include <string.h>
+#include "digest.h"
+
+#define BLOCK_LENGTH 64
+#define WORD_MASK 0xFFFFFFFFUL /* unsigned long may be wider than 32 bits */
+
+#define ROTATE(x, n) ((((x) >> (n)) | ((x) << (32 - (n)))) & WORD_MASK)
+
+static const unsigned long round_constants[64] = {
+    0x428a2f98UL, 0x71374491UL, 0xb5c0fbcfUL, 0xe9b5dba5UL, 0x3956c25bUL, 0x59f111f1UL, 0x923f82a4UL, 0xab1c5ed5UL,
+    0xd807aa98UL, 0x12835b01UL, 0x243185beUL, 0x550c7dc3UL, 0x72be5d74UL, 0x80deb1feUL, 0x9bdc06a7UL, 0xc19bf174UL,
+    0xe49b69c1UL, 0xefbe4786UL, 0x0fc19dc6UL, 0x240ca1ccUL, 0x2de92c6fUL, 0x4a7484aaUL, 0x5cb0a9dcUL, 0x76f988daUL,
+    0x983e5152UL, 0xa831c66dUL, 0xb00327c8UL, 0xbf597fc7UL, 0xc6e00bf3UL, 0xd5a79147UL, 0x06ca6351UL, 0x14292967UL,
+    0x27b70a85UL, 0x2e1b2138UL, 0x4d2c6dfcUL, 0x53380d13UL, 0x650a7354UL, 0x766a0abbUL, 0x81c2c92eUL, 0x92722c85UL,
+    0xa2bfe8a1UL, 0xa81a664bUL, 0xc24b8b70UL, 0xc76c51a3UL, 0xd192e819UL, 0xd6990624UL, 0xf40e3585UL, 0x106aa070UL,
+    0x19a4c116UL, 0x1e376c08UL, 0x2748774cUL, 0x34b0bcb5UL, 0x391c0cb3UL, 0x4ed8aa4aUL, 0x5b9cca4fUL, 0x682e6ff3UL,
+    0x748f82eeUL, 0x78a5636fUL, 0x84c87814UL, 0x8cc70208UL, 0x90befffaUL, 0xa4506cebUL, 0xbef9a3f7UL, 0xc67178f2UL
+};
+
+/* Mixes one 64-byte block into the hash state */
+static void compress_block(unsigned long state[8], const unsigned char *block)
+{
+    unsigned long w[64];
+    unsigned long a, b, c, d, e, f, g, h;
+    unsigned long s0, s1, t1, t2;
+    int i;
+
+    for (i = 0; i < 16; i++)
+    {
+        w[i] = ((unsigned long)block[4 * i] << 24) | ((unsigned long)block[4 * i + 1] << 16) |
+               ((unsigned long)block[4 * i + 2] << 8) | (unsigned long)block[4 * i + 3];
+    }
+    for (i = 16; i < 64; i++)
+    {
+        s0 = ROTATE(w[i - 15], 7) ^ ROTATE(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        s1 = ROTATE(w[i - 2], 17) ^ ROTATE(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = (w[i - 16] + s0 + w[i - 7] + s1) & WORD_MASK;
+    }
+
+    a = state[0]; b = state[1]; c = state[2]; d = state[3];
+    e = state[4]; f = state[5]; g = state[6]; h = state[7];
+    for (i = 0; i < 64; i++)
+    {
+        s1 = ROTATE(e, 6) ^ ROTATE(e, 11) ^ ROTATE(e, 25);
+        t1 = (h + s1 + ((e & f) ^ (~e & g)) + round_constants[i] + w[i]) & WORD_MASK;
+        s0 = ROTATE(a, 2) ^ ROTATE(a, 13) ^ ROTATE(a, 22);
+        t2 = (s0 + ((a & b) ^ (a & c) ^ (b & c))) & WORD_MASK;
+        h = g; g = f; f = e;
+        e = (d + t1) & WORD_MASK;
+        d = c; c = b; b = a;
+        a = (t1 + t2) & WORD_MASK;
+    }
+    state[0] = (state[0] + a) & WORD_MASK; state[1] = (state[1] + b) & WORD_MASK;
+    state[2] = (state[2] + c) & WORD_MASK; state[3] = (state[3] + d) & WORD_MASK;
+    state[4] = (state[4] + e) & WORD_MASK; state[5] = (state[5] + f) & WORD_MASK;
+    state[6] = (state[6] + g) & WORD_MASK; state[7] = (state[7] + h) & WORD_MASK;
+}
+
+/* Computes the SHA-256 digest of a block of memory */
+void digest_compute(const char *data, size_t length, unsigned char digest[DIGEST_LENGTH])
+{
+    unsigned long state[8] = {
+        0x6a09e667UL, 0xbb67ae85UL, 0x3c6ef372UL, 0xa54ff53aUL,
+        0x510e527fUL, 0x9b05688cUL, 0x1f83d9abUL, 0x5be0cd19UL
+    };
+    unsigned char tail[2 * BLOCK_LENGTH];
+    const unsigned char *bytes = (const unsigned char *)data;
+    size_t remaining = length;
+    size_t tail_length;
+    unsigned long low_bits;
+    unsigned long high_bits;
+    int i;
+
+    for (; remaining >= BLOCK_LENGTH; remaining -= BLOCK_LENGTH, bytes += BLOCK_LENGTH)
+    {
+        compress_block(state, bytes);
+    }
+
+    /* The last bytes, a 1 bit, zeros, and the length in bits in 64 bits */
+    memset(tail, 0, sizeof(tail));
+    memcpy(tail, bytes, remaining);
+    tail[remaining] = 0x80;
+    tail_length = remaining + 9 <= BLOCK_LENGTH ? BLOCK_LENGTH : 2 * BLOCK_LENGTH;
+    low_bits = ((unsigned long)length << 3) & WORD_MASK;
+    high_bits = (unsigned long)(length >> 29); /* size_t may be only 32 bits wide */
+    for (i = 0; i < 4; i++)
+    {
+        tail[tail_length - 1 - i] = (unsigned char)((low_bits >> (8 * i)) & 0xFF);
+        tail[tail_length - 5 - i] = (unsigned char)((high_bits >> (8 * i)) & 0xFF);
+    }
+    compress_block(state, tail);
+    if (tail_length > BLOCK_LENGTH)
+    {
+        compress_block(state, tail + BLOCK_LENGTH);
+    }
+
+    for (i = 0; i < 8; i++)
+    {
+        digest[4 * i] = (unsigned char)(state[i] >> 24);
+        digest[4 * i + 1] = (unsigned char)(state[i] >> 16);
+        digest[4 * i + 2] = (unsigned char)(state[i] >> 8);
+        digest[4 * i + 3] = (unsigned char)state[i];
+    }
+}
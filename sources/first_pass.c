@@ -1,5 +1,8 @@
 #include "check.h"
 #include "assembler.h"
+#include "tokenizer.h"
+#include "source.h"
+#include "scan.h"
 
 
 /*
@@ -12,16 +15,8 @@
  * Returns a pointer to the initialized AssemblerState, or NULL if allocation fails.
  */
 
-#define WORD_SIZE 15
-#define OPCODE_SHIFT 11
-#define SRC_ADDRESSING_SHIFT 7
-#define DST_ADDRESSING_SHIFT 3
-#define ARE_BITS 0x4
-#define REG_WORD_MASK 0x4
-#define SRC_REG_SHIFT 6
-#define DST_REG_SHIFT 3
-#define EXTERNAL_LABEL_ARE 0x1 
-#define RELOCATABLE_LABEL_ARE 0x2
+#define DATA_MIN -16384 /* Smallest value of a signed 15-bit word */
+#define DATA_MAX 32767  /* Largest value of an unsigned 15-bit word */
 AssemblerState *init_assembler_state()
 {
  AssemblerState *state;
@@ -32,28 +27,29 @@ AssemblerState *init_assembler_state()
         perror("Failed to allocate memory for AssemblerState");
         return NULL;
     }
+    arena_init(&state->arena, ARENA_CHUNK_SIZE);
 
-    /* Allocate memory for instructions*/
-    state->memory = malloc(INITIAL_MEMORY_SIZE * sizeof(Instruction));
-    if (!state->memory)
+    /* Allocate memory for the memory image*/
+    state->words = malloc(INITIAL_MEMORY_SIZE * sizeof(unsigned short));
+    if (!state->words)
     {
         perror("Failed to allocate memory for instructions");
         free(state);
         return NULL;
     }
-    state->memory_size = 0;
     state->memory_capacity = INITIAL_MEMORY_SIZE;
+    state->relocations = NULL;
+    state->relocation_capacity = 0;
 
     /* Allocate memory for extern labels*/
     state->extern_table = malloc(INITIAL_TABLE_SIZE * sizeof(ExternLabel));
     if (!state->extern_table)
     {
         perror("Failed to allocate memory for extern table");
-        free(state->memory);
+        free(state->words);
         free(state);
         return NULL;
     }
-    state->extern_count = 0;
     state->extern_capacity = INITIAL_TABLE_SIZE;
 
     /* Allocate memory for label table*/
@@ -62,11 +58,10 @@ AssemblerState *init_assembler_state()
     {
         perror("Failed to allocate memory for label table");
         free(state->extern_table);
-        free(state->memory);
+        free(state->words);
         free(state);
         return NULL;
     }
-    state->label_count = 0;
     state->label_capacity = INITIAL_TABLE_SIZE;
 
     /* Allocate memory for entry labels*/
@@ -76,168 +71,313 @@ AssemblerState *init_assembler_state()
         perror("Failed to allocate memory for entry table");
         free(state->label_table);
         free(state->extern_table);
-        free(state->memory);
+        free(state->words);
         free(state);
         return NULL;
     }
-    state->entry_count = 0;
     state->entry_capacity = INITIAL_TABLE_SIZE;
 
+    /* Allocate memory for parsed statements, the data segment and the symbol table*/
+    state->fixups = NULL;
+    state->fixup_capacity = 0;
+    state->statements = malloc(INITIAL_TABLE_SIZE * sizeof(Statement));
+    state->data_values = malloc(INITIAL_MEMORY_SIZE * sizeof(int));
+    state->symbols = malloc(INITIAL_TABLE_SIZE * sizeof(Symbol));
+    state->symbol_buckets = malloc(SYMBOL_BUCKET_COUNT * sizeof(int));
+    state->bucket_count = SYMBOL_BUCKET_COUNT;
+    if (!state->statements || !state->data_values || !state->symbols || !state->symbol_buckets)
+    {
+        perror("Failed to allocate memory for statements");
+        free_assembler_state(state);
+        return NULL;
+    }
+    state->statement_capacity = INITIAL_TABLE_SIZE;
+    state->data_capacity = INITIAL_MEMORY_SIZE;
+    state->symbol_capacity = INITIAL_TABLE_SIZE;
+
     /* Initialize counters*/
-    state->IC = 100;
-    state->DC = 0;
+    reset_assembler_state(state);
 
     return state;
 }
-/* This function processes a data directive in an assembler, parsing comma-separated integer values.
-   It adds a label if provided, converts each value to binary, and stores them in the assembler's memory. */
-void handle_data_directive(AssemblerState *state, const char *label, const char *params, int validLabel)
-{
-    char *token;
-    char *params_copy;
-    char *saveptr;
-    int value;
-    char *word_binary;
 
-    params_copy = my_strdup(params);  
-    /* Add label to symbol table if it's valid and not empty */
+/* Empties the tables the passes fill, keeping every buffer and its capacity */
+void clear_assembler_tables(AssemblerState *state)
+{
+    int i;
 
-    if (label && label[0] != '\0' && validLabel == 0)
+    state->memory_size = 0;
+    state->relocation_count = 0;
+    state->label_count = 0;
+    state->entry_count = 0;
+    state->extern_count = 0;
+    state->statement_count = 0;
+    state->symbol_count = 0;
+    state->fixup_count = 0;
+    for (i = 0; i < state->bucket_count; i++)
     {
-        add_label(state, label, state->IC + state->DC);
+        state->symbol_buckets[i] = NO_SYMBOL;
     }
-        /* Tokenize the params string, splitting by commas */
-	token = strtok_r(params_copy, ",", &saveptr);
-    while (token != NULL)
+    state->IC = MEMORY_START;
+    state->DC = 0;
+}
+
+/* Empties the assembler state for the next file, keeping every buffer and its capacity */
+void reset_assembler_state(AssemblerState *state)
+{
+    clear_assembler_tables(state);
+    state->single_pass = 0;
+    state->chunk_threads = 1;
+    state->current_line = 0;
+    state->line_start = NULL;
+    state->diagnostics = NULL;
+    state->output = NULL;
+    arena_reset(&state->arena);
+}
+/* This function processes a data directive in a single scan: each comma-separated
+   integer is validated and appended to the data segment as soon as it is read.
+   On error the values of the line are dropped and the label is not defined. */
+int handle_data_directive(AssemblerState *state, Span label, const char *params, size_t length, int validLabel)
+{
+    char name[MAX_LABEL_LENGTH + 1];
+    const char *p = params;
+    const char *end = params + length;
+    const char *digits;
+    long value;
+    int negative;
+    int first = state->DC;
+    Statement *statement;
+
+    p = scan_skip_blanks(p, end);
+    if (p == end)
     {
-        token = trim(token);  /* Remove leading/trailing whitespace */
-        value = atoi(token);  /* Convert token to integer */
-        value &= 0x7FFF;      /* Mask to ensure 15-bit value */
-        
-        /* Check if memory needs to be expanded */
+        report(state->diagnostics, SEVERITY_ERROR, DIAG_INVALID_DATA, state->current_line, 0, "No data values provided after .data");
+        return 1;
+    }
 
-        if (state->memory_size >= state->memory_capacity)
+    for (;;)
+    {
+        /* Optional sign, then at least one digit */
+        negative = 0;
+        if (*p == '-' || *p == '+')
+        {
+            negative = *p == '-';
+            p++;
+        }
+        digits = p;
+        value = 0;
+        while (p < end && *p >= '0' && *p <= '9')
         {
-            state->memory_capacity *= 2;
-            state->memory = realloc(state->memory, state->memory_capacity * sizeof(Instruction));
-            if (!state->memory)
+            /* Stop accumulating once out of range so long never overflows */
+            if (value <= DATA_MAX + 1)
             {
-                perror("Failed to reallocate memory");
-                free(params_copy);   
-                return;
+                value = value * 10 + (*p - '0');
             }
+            p++;
         }
-        /* Convert integer to 15-bit binary string */
-
-        word_binary = int_to_binary(value, 15);  
-        if (word_binary != NULL)   
-        {            /* Store binary string in memory */
-
-            strcpy(state->memory[state->IC + state->DC].binary, word_binary);
-            state->memory[state->IC + state->DC].address = state->IC + state->DC;
-            free(word_binary);
-            state->DC++;
-            state->memory_size++;
+        if (p == digits)
+        {
+            report(state->diagnostics, SEVERITY_ERROR, DIAG_INVALID_DATA, state->current_line, source_column(state, digits), "Invalid number format in .data directive operands");
+            break;
         }
-        else
+        if (negative)
+        {
+            value = -value;
+        }
+        if (value < DATA_MIN || value > DATA_MAX)
+        {
+            report(state->diagnostics, SEVERITY_ERROR, DIAG_INVALID_DATA, state->current_line, source_column(state, digits), ".data value %ld does not fit in a word", value);
+            break;
+        }
+        if (append_data_value(state, (int)value) != 0)
         {
-            perror("Failed to allocate memory for word_binary");
+            break;
         }
 
-        token = strtok_r(NULL, ",", &saveptr);
+        /* A value is followed by the end of the list or by a comma and another value */
+        p = scan_skip_blanks(p, end);
+        if (p == end)
+        {
+            if (label.length != 0 && validLabel == 0)
+            {
+                add_data_label(state, span_copy(label, name, sizeof(name)), first);
+            }
+            statement = append_statement(state, STATEMENT_DATA);
+            if (!statement)
+            {
+                return 1;
+            }
+            statement->address = first;
+            statement->length = state->DC - first;
+            return 0;
+        }
+        if (*p != ',')
+        {
+            report(state->diagnostics, SEVERITY_ERROR, DIAG_INVALID_DATA, state->current_line, source_column(state, p), "Invalid characters in .data directive operands");
+            break;
+        }
+        p = scan_skip_blanks(p + 1, end);
+        if (p == end || *p == ',')
+        {
+            report(state->diagnostics, SEVERITY_ERROR, DIAG_INVALID_DATA, state->current_line, source_column(state, p), "Missing value in .data directive operands");
+            break;
+        }
     }
 
-    free(params_copy);
+    state->DC = first;
+    return 1;
 }
 
+/* Returns the character an escape sequence stands for, or -1 if it is unknown */
+static int string_escape_value(char c)
+{
+    switch (c)
+    {
+    case 'n': return '\n';
+    case 't': return '\t';
+    case 'r': return '\r';
+    case '0': return '\0';
+    case 'a': return '\a';
+    case 'b': return '\b';
+    case 'f': return '\f';
+    case 'v': return '\v';
+    case '\\': return '\\';
+    case '"': return '"';
+    case '\'': return '\'';
+    default: return -1;
+    }
+}
 
-
-/* Function to handle .string directive */
-void handle_string_directive(AssemblerState *state, const char *label, const char *params, int validLabel)
+/* Function to handle .string directive: the whole run is reserved in the data
+   segment up front and the characters are widened to words in bulk, decoding
+   escape sequences. On error nothing is added and the label is not defined. */
+int handle_string_directive(AssemblerState *state, Span label, const char *params, size_t length, int validLabel)
 {
-    char *start;
-    char *end;
-    char *word_binary;
-    char *null_binary;
-    /* Add label to symbol table if it's valid and not empty */
+    char name[MAX_LABEL_LENGTH + 1];
+    const char *end = params + length;
+    const char *text = params + 1;
+    const char *close;
+    size_t raw;
+    size_t i;
+    int has_escapes = 0;
+    int not_printable = 0;
+    int count = 0;
+    int value;
+    int *words;
+    Statement *statement;
 
-    if (label && label[0] != '\0' && validLabel == 0)
+    if (length == 0)
     {
-        add_label(state, label, state->IC + state->DC);
+        report(state->diagnostics, SEVERITY_ERROR, DIAG_INVALID_STRING, state->current_line, 0, "There is no string");
+        return 1;
+    }
+    if (params[0] != '"')
+    {
+        report(state->diagnostics, SEVERITY_ERROR, DIAG_INVALID_STRING, state->current_line, source_column(state, params), "String must start with a double quote (\")");
+        return 1;
     }
 
-    start = strchr(params, '"');
-    end = strrchr(params, '"');
+    /* Find the closing quote, stepping over escaped characters */
+    for (close = text; close < end && *close != '"'; close++)
+    {
+        if (*close == '\\')
+        {
+            has_escapes = 1;
+            if (++close == end)
+                break;
+        }
+    }
+    if (close >= end)
+    {
+        report(state->diagnostics, SEVERITY_ERROR, DIAG_INVALID_STRING, state->current_line, source_column(state, params), "String must end with a double quote (\")");
+        return 1;
+    }
+    if (close + 1 != end)
+    {
+        report(state->diagnostics, SEVERITY_ERROR, DIAG_INVALID_STRING, state->current_line, source_column(state, close + 1), "Additional characters found after the string");
+        return 1;
+    }
 
-    start++;
-    *end = '\0';
-    /* Process each character in the string */
+    /* The decoded string is never longer than its source, plus the terminator */
+    raw = (size_t)(close - text);
+    words = reserve_data_values(state, raw + 1);
+    if (!words)
+    {
+        return 1;
+    }
 
-    while (*start != '\0')
+    if (!has_escapes)
+    {
+        /* Plain strings are checked and widened in one straight loop */
+        for (i = 0; i < raw; i++)
+        {
+            not_printable |= (unsigned char)(text[i] - ' ') > '~' - ' ';
+            words[i] = (unsigned char)text[i];
+        }
+        count = (int)raw;
+    }
+    else
     {
-        if (state->memory_size >= state->memory_capacity)
+        for (i = 0; i < raw; i++)
         {
-            state->memory_capacity *= 2;
-            state->memory = realloc(state->memory, state->memory_capacity * sizeof(Instruction));
-            if (!state->memory)
+            not_printable |= (unsigned char)(text[i] - ' ') > '~' - ' ';
+            if (text[i] != '\\')
+            {
+                words[count++] = (unsigned char)text[i];
+                continue;
+            }
+            value = string_escape_value(text[++i]);
+            if (value < 0)
             {
-                perror("Failed to reallocate memory");
-                return;
+                report(state->diagnostics, SEVERITY_ERROR, DIAG_INVALID_STRING, state->current_line, source_column(state, text + i - 1), "Unknown escape sequence '\\%c' in string", text[i]);
+                return 1;
             }
+            words[count++] = value;
         }
-        /* Convert character to binary and store in memory */
-
-        word_binary = int_to_binary((int)*start, WORD_SIZE);
-        strcpy(state->memory[state->IC + state->DC].binary, word_binary);
-        state->memory[state->IC + state->DC].address = state->IC + state->DC;
-        free(word_binary);
-        state->DC++;
-        state->memory_size++;
-        start++;
+    }
+    if (not_printable)
+    {
+        report(state->diagnostics, SEVERITY_ERROR, DIAG_INVALID_STRING, state->current_line, source_column(state, params), "Non-printable character found in string");
+        return 1;
     }
 
     /* Add null terminator */
-    if (state->memory_size >= state->memory_capacity)
+    words[count++] = 0;
+
+    /* Add label to symbol table if it's valid and not empty */
+    if (label.length != 0 && validLabel == 0)
     {
-        state->memory_capacity *= 2;
-        state->memory = realloc(state->memory, state->memory_capacity * sizeof(Instruction));
-        if (!state->memory)
-        {
-            perror("Failed to reallocate memory");
-            return;
-        }
+        add_data_label(state, span_copy(label, name, sizeof(name)), state->DC);
     }
 
-    null_binary = int_to_binary(0, WORD_SIZE);
-    strcpy(state->memory[state->IC + state->DC].binary, null_binary);
-    state->memory[state->IC + state->DC].address = state->IC + state->DC;
-    free(null_binary);
-    state->DC++;
-    state->memory_size++;
+    statement = append_statement(state, STATEMENT_STRING);
+    if (!statement)
+    {
+        return 1;
+    }
+    statement->address = state->DC;
+    statement->length = count;
+    state->DC += count;
+    return 0;
 }
 
 
 /* Function to handle .entry directive */
-void handle_entry_directive(AssemblerState *state, const char *label)
+void handle_entry_directive(AssemblerState *state, Span label)
 {
-    int i;
+    int symbol = find_symbol_length(state, label.start, (size_t)label.length);
+    Statement *statement;
 
-    for (i = 0; i < state->extern_count; i++)
+    if (symbol != NO_SYMBOL && state->symbols[symbol].is_extern)
     {
-        if (strcmp(state->extern_table[i].name, label) == 0)
-        {
-            fprintf(stderr, "Error: label '%s' has already been declared as extern\n", label);
-            return;
-        }
+        report(state->diagnostics, SEVERITY_ERROR, DIAG_SYMBOL_CONFLICT, state->current_line, 0, "Label '%.*s' has already been declared as extern", label.length, label.start);
+        return;
     }
 
-    for (i = 0; i < state->entry_count; i++)
+    if (symbol != NO_SYMBOL && state->symbols[symbol].is_entry)
     {
-        if (strcmp(state->entry_table[i].name, label) == 0)
-        {
-            fprintf(stderr, "Warning: label '%s' has already been declared as an entry\n", label);
-            return;
-        }
+        report(state->diagnostics, SEVERITY_WARNING, DIAG_SYMBOL_CONFLICT, state->current_line, 0, "Label '%.*s' has already been declared as an entry", label.length, label.start);
+        return;
     }
 
     if (state->entry_count == state->entry_capacity)
@@ -246,41 +386,40 @@ void handle_entry_directive(AssemblerState *state, const char *label)
         state->entry_table = realloc(state->entry_table, state->entry_capacity * sizeof(EntryLabel));
         if (!state->entry_table)
         {
-            perror("Failed to reallocate entry table");
+            report(state->diagnostics, SEVERITY_ERROR, DIAG_OUT_OF_MEMORY, state->current_line, 0, "Failed to reallocate entry table");
             return;
         }
     }
     
-    state->entry_table[state->entry_count].name[MAX_LABEL_LENGTH] = '\0';
-    strncpy(state->entry_table[state->entry_count].name, label, MAX_LABEL_LENGTH);
+    /* The name is copied only once it is stored */
+    span_copy(label, state->entry_table[state->entry_count].name, sizeof(state->entry_table[0].name));
     state->entry_table[state->entry_count].address = -1; /* Initialize to -1 and update later */
+    symbol = intern_symbol(state, state->entry_table[state->entry_count].name);
     state->entry_count++;
+
+    if (symbol != NO_SYMBOL)
+    {
+        state->symbols[symbol].is_entry = 1;
+    }
+    statement = append_statement(state, STATEMENT_ENTRY);
+    if (statement)
+    {
+        statement->symbol = symbol;
+    }
 }
 
 
 /* Function to handle .extern directive */
-void handle_extern_directive(AssemblerState *state, const char *label)
+void handle_extern_directive(AssemblerState *state, Span label)
 {
-    int i;
+    int symbol = find_symbol_length(state, label.start, (size_t)label.length);
+    Statement *statement;
     /* Check if the label has already been declared as extern */
 
-    for (i = 0; i < state->extern_count; i++)
-    {
-        if (strcmp(state->extern_table[i].name, label) == 0)
-        {
-            fprintf(stderr, "Error: label '%s' has already been declared as extern\n", label);
-            return;
-        }
-    }
-    /* Check if the label has already been declared as entry */
-
-    for (i = 0; i < state->extern_count; i++)
+    if (symbol != NO_SYMBOL && state->symbols[symbol].is_extern)
     {
-        if (strcmp(state->extern_table[i].name, label) == 0)
-        {
-            fprintf(stderr, "Warning: label '%s' has already been declared as external\n", label);
-            return;
-        }
+        report(state->diagnostics, SEVERITY_ERROR, DIAG_SYMBOL_CONFLICT, state->current_line, 0, "Label '%.*s' has already been declared as extern", label.length, label.start);
+        return;
     }
     /* Expand entry table if it's full */
 
@@ -290,531 +429,228 @@ void handle_extern_directive(AssemblerState *state, const char *label)
         state->extern_table = realloc(state->extern_table, state->extern_capacity * sizeof(ExternLabel));
         if (!state->extern_table)
         {
-            perror("Failed to reallocate extern table");
+            report(state->diagnostics, SEVERITY_ERROR, DIAG_OUT_OF_MEMORY, state->current_line, 0, "Failed to reallocate extern table");
             return;
         }
     }
 
-    strncpy(state->extern_table[state->extern_count].name, label, MAX_LABEL_LENGTH);
-    state->extern_table[state->extern_count].name[MAX_LABEL_LENGTH] = '\0';
+    span_copy(label, state->extern_table[state->extern_count].name, sizeof(state->extern_table[0].name));
     state->extern_table[state->extern_count].address = -1; /* Initialize to -1 and update later */
+    symbol = intern_symbol(state, state->extern_table[state->extern_count].name);
     state->extern_count++;
+
+    if (symbol != NO_SYMBOL)
+    {
+        state->symbols[symbol].is_extern = 1;
+    }
+    statement = append_statement(state, STATEMENT_EXTERN);
+    if (statement)
+    {
+        statement->symbol = symbol;
+    }
 }
 
-int assemble_instruction(AssemblerState *state, const char *label, const char *op, const char *operand1, const char *operand2, int validLabel)
+/* Records an instruction statement and advances IC by the number of words it occupies */
+int assemble_instruction(AssemblerState *state, Span label, const char *op, const Operand *operands, int operand_count, int validLabel)
 { 
-    /* Variable declarations */
-    int error ;
-    int opcode ;
-    int src_addressing ;
-    int dst_addressing ;
-    int src_reg ;
-    int dst_reg ;
-    int immediate_value ;
-    char src_label[MAX_LABEL_LENGTH + 3] ;
-    char dst_label[MAX_LABEL_LENGTH + 3] ;
-    int first_word;
-    char *first_word_binary;
-    int reg_word;
-    char *reg_word_binary;
-    char *encoded_immediate;
-    int is_extern;
-    int i;
-
-    Instruction *new_memory; 
-    immediate_value = 0;
-     error = 0;
-     opcode = get_opcode(op);
-    src_addressing =0;
-     dst_addressing =0;
-    src_reg =-1;
-      dst_reg =-1;
-     memset(src_label, 0, sizeof(src_label));
-memset(dst_label, 0, sizeof(dst_label));
-
+    int error = 0;
+    char name[MAX_LABEL_LENGTH + 1];
+    Statement *statement;
 
     /* Add label to symbol table if it's valid and not empty */
-    if (label && label[0] != '\0' && validLabel == 0)
+    if (label.length != 0 && validLabel == 0)
     {
-        add_label(state, label, state->IC);
-    }
-
-    /* Handle single operand instructions */
-    if (is_single_operand_instruction(op))
-    {
-        if (operand2 != NULL)
+        add_label(state, span_copy(label, name, sizeof(name)), state->IC);
+        if (state->single_pass)
         {
-            return 0;
+            patch_label_fixups(state, find_symbol(state, name));
         }
-        operand2 = operand1;
-        operand1 = NULL;
     }
 
-    /* Process source operand */
-    if (operand1)
+    /* Single operand instructions only have a destination */
+    if (op != NULL && is_single_operand_instruction(op) && operand_count > 1)
     {
-        src_addressing = get_addressing_mode(operand1);
-        if (src_addressing == 1)
-        {
-            immediate_value = atoi(operand1 + 1);
-        }
-        else if (src_addressing == 4 || src_addressing == 8)
-        {
-            src_reg = get_register_number(src_addressing == 4 ? operand1 + 1 : operand1);
-        }
-        else
-        {
-            my_snprintf(src_label, sizeof(src_label), "\"%s\"", operand1);
-        }
+        return 0;
     }
 
-    /* Process destination operand */
-    if (operand2)
+    statement = append_statement(state, STATEMENT_INSTRUCTION);
+    if (!statement)
     {
-        dst_addressing = get_addressing_mode(operand2);
-        if (dst_addressing == 1)
-        {
-            immediate_value = atoi(operand2 + 1);
-        }
-        else if (dst_addressing == 4 || dst_addressing == 8)
-        {
-            dst_reg = get_register_number(dst_addressing == 4 ? operand2 + 1 : operand2);
-        }
-        else
-        {
-            my_snprintf(dst_label, sizeof(dst_label), "\"%s\"", operand2);
-        }
+        return 1;
     }
+    statement->opcode = (signed char)(op != NULL ? get_opcode(op) : -1);
+    statement->address = state->IC;
 
-    /* Construct first word of the instruction */
-    first_word = (opcode << OPCODE_SHIFT) | (src_addressing << SRC_ADDRESSING_SHIFT) | (dst_addressing << DST_ADDRESSING_SHIFT) | ARE_BITS;
-    first_word_binary = int_to_binary(first_word, WORD_SIZE);
-
-    /* Expand memory if needed */
-    if (state->memory_size >= state->memory_capacity)
+    /* A lone operand is the destination, a pair is source and destination */
+    if (operand_count == 1)
     {
-        state->memory_capacity *= 2;
-         new_memory = realloc(state->memory, state->memory_capacity * sizeof(Instruction));
-        if (!new_memory)
-        {
-            perror("Failed to reallocate memory");
-            free(state->memory);
-            return 1;
-        }
-        state->memory = new_memory;
+        statement->dst = operands[0];
     }
-
-    /* Store first word in memory */
-    strcpy(state->memory[state->IC].binary, first_word_binary);
-    free(first_word_binary);
-    state->memory[state->IC].address = state->IC;
-    strcpy(state->memory[state->IC].label, "");
-    state->IC++;
-    state->memory_size++;
-
-    /* Handle register-to-register instruction */
-    if ((src_addressing == 4 || src_addressing == 8) && (dst_addressing == 4 || dst_addressing == 8))
+    else if (operand_count > 1)
     {
-        reg_word = REG_WORD_MASK | (src_reg << SRC_REG_SHIFT) | (dst_reg << DST_REG_SHIFT);
-        reg_word_binary = int_to_binary(reg_word, WORD_SIZE);
-
-        if (state->memory_size >= state->memory_capacity)
-        {
-            state->memory_capacity *= 2;
-            state->memory = realloc(state->memory, state->memory_capacity * sizeof(Instruction));
-            if (!state->memory)
-            {
-                perror("Failed to reallocate memory");
-                return 1;
-            }
-        }
+        statement->src = operands[0];
+        statement->dst = operands[1];
+    }
 
-        strcpy(state->memory[state->IC].binary, reg_word_binary);
-        free(reg_word_binary);
-        state->memory[state->IC].address = state->IC;
-        strcpy(state->memory[state->IC].label, "");
-        state->IC++;
-        state->memory_size++;
+    /* One word for the instruction, one shared word for two register operands,
+       otherwise one word per operand */
+    statement->length = 1;
+    if ((statement->src.mode == ADDRESSING_INDIRECT_REGISTER || statement->src.mode == ADDRESSING_DIRECT_REGISTER) &&
+        (statement->dst.mode == ADDRESSING_INDIRECT_REGISTER || statement->dst.mode == ADDRESSING_DIRECT_REGISTER))
+    {
+        statement->length++;
     }
     else
     {
-        /* Handle source operand */
-        if (src_addressing == 1)
-        {
-            encoded_immediate = encode_immediate_operand(operand1);
-            if (encoded_immediate != NULL)
-            {
-                if (state->memory_size >= state->memory_capacity)
-                {
-                    state->memory_capacity *= 2;
-                    state->memory = realloc(state->memory, state->memory_capacity * sizeof(Instruction));
-                    if (!state->memory)
-                    {
-                        perror("Failed to reallocate memory");
-                        return 1;
-                    }
-                }
-
-                strcpy(state->memory[state->IC].binary, encoded_immediate);
-                free(encoded_immediate);
-                state->memory[state->IC].address = state->IC;
-                strcpy(state->memory[state->IC].label, "");
-                state->IC++;
-                state->memory_size++;
-            }
-            else
-            {
-                fprintf(stderr, "Error: Invalid immediate operand %s\n", operand1);
-                error = 1;
-            }
-        }
-        else if (src_addressing == 2)
-        {
-            if (state->memory_size >= state->memory_capacity)
-            {
-                state->memory_capacity *= 2;
-                state->memory = realloc(state->memory, state->memory_capacity * sizeof(Instruction));
-                if (!state->memory)
-                {
-                    perror("Failed to reallocate memory");
-                    return 1;
-                }
-            }
-
-            /* Check if the operand is an external label */
-            is_extern = 0;
-            for (i = 0; i < state->extern_count; i++)
-            {
-                if (strcmp(state->extern_table[i].name, operand1) == 0)
-                {
-                    is_extern = 1;
-                    break;
-                }
-            }
-
-            if (is_extern)
-            {
-                strcpy(state->memory[state->IC].binary, "000000000000001"); /* Use 001 for external labels */
-            }
-            else
-            {
-                strcpy(state->memory[state->IC].binary, "000000000000010"); /* Use 010 for non-external labels */
-            }
-            state->memory[state->IC].address = state->IC;
-            my_snprintf(state->memory[state->IC].label, sizeof(state->memory[state->IC].label), "%s", operand1);
-            state->IC++;
-            state->memory_size++;
-        }
-        else if (src_addressing == 4 || src_addressing == 8)
-        {
-            reg_word = REG_WORD_MASK | (src_reg << SRC_REG_SHIFT);
-            reg_word_binary = int_to_binary(reg_word, WORD_SIZE);
-
-            if (state->memory_size >= state->memory_capacity)
-            {
-                state->memory_capacity *= 2;
-                state->memory = realloc(state->memory, state->memory_capacity * sizeof(Instruction));
-                if (!state->memory)
-                {
-                    perror("Failed to reallocate memory");
-                    return 1;
-                }
-            }
-
-            strcpy(state->memory[state->IC].binary, reg_word_binary);
-            free(reg_word_binary);
-            state->memory[state->IC].address = state->IC;
-            strcpy(state->memory[state->IC].label, "");
-            state->IC++;
-            state->memory_size++;
-        }
+        if (statement->src.mode != ADDRESSING_NONE)
+            statement->length++;
+        if (statement->dst.mode != ADDRESSING_NONE)
+            statement->length++;
+    }
+    state->IC += statement->length;
 
-        /* Handle destination operand */
-        if (dst_addressing != 0)
+    /* In single-pass mode the words are written right away */
+    if (state->single_pass)
+    {
+        if (ensure_memory_capacity(state, state->IC) != 0)
         {
-            if (dst_addressing == 1)
-            {
-                encoded_immediate = encode_immediate_operand(operand2);
-                if (encoded_immediate != NULL)
-                {
-                    if (state->memory_size >= state->memory_capacity)
-                    {
-                        state->memory_capacity *= 2;
-                        state->memory = realloc(state->memory, state->memory_capacity * sizeof(Instruction));
-                        if (!state->memory)
-                        {
-                            perror("Failed to reallocate memory");
-                            return 1;
-                        }
-                    }
-
-                    strcpy(state->memory[state->IC].binary, encoded_immediate);
-                    free(encoded_immediate);
-                    state->memory[state->IC].address = state->IC;
-                    strcpy(state->memory[state->IC].label, "");
-                    state->IC++;
-                    state->memory_size++;
-                }
-                else
-                {
-                    fprintf(stderr, "Error: Invalid immediate operand %s\n", operand2);
-                    error = 1;
-                }
-            }
-            else if (dst_addressing == 2)
-            {
-                if (state->memory_size >= state->memory_capacity)
-                {
-                    state->memory_capacity *= 2;
-                    state->memory = realloc(state->memory, state->memory_capacity * sizeof(Instruction));
-                    if (!state->memory)
-                    {
-                        perror("Failed to reallocate memory");
-                        return 1;
-                    }
-                }
-
-                /* Check if the operand is an external label */
-                is_extern = 0;
-                for (i = 0; i < state->extern_count; i++)
-                {
-                    if (strcmp(state->extern_table[i].name, operand2) == 0)
-                    {
-                        is_extern = 1;
-                        break;
-                    }
-                }
-
-                if (is_extern)
-                {
-                    strcpy(state->memory[state->IC].binary, "000000000000001"); /* Use 001 for external labels */
-                }
-                else
-                {
-                    strcpy(state->memory[state->IC].binary, "000000000000010"); /* Use 010 for non-external labels */
-                }
-                state->memory[state->IC].address = state->IC;
-                my_snprintf(state->memory[state->IC].label, sizeof(state->memory[state->IC].label), "%s", operand2);
-                state->IC++;
-                state->memory_size++;
-            }
-            else if (dst_addressing == 4 || dst_addressing == 8)
-            {
-                reg_word = REG_WORD_MASK | (dst_reg << DST_REG_SHIFT);
-                reg_word_binary = int_to_binary(reg_word, WORD_SIZE);
-
-                if (state->memory_size >= state->memory_capacity)
-                {
-                    state->memory_capacity *= 2;
-                    state->memory = realloc(state->memory, state->memory_capacity * sizeof(Instruction));
-                    if (!state->memory)
-                    {
-                        perror("Failed to reallocate memory");
-                        return 1;
-                    }
-                }
-
-                strcpy(state->memory[state->IC].binary, reg_word_binary);
-                free(reg_word_binary);
-                state->memory[state->IC].address = state->IC;
-                strcpy(state->memory[state->IC].label, "");
-                state->IC++;
-                state->memory_size++;
-            }
+            return 1;
         }
+        error |= encode_instruction(state, statement);
     }
-    if(error == 1)
-    {
-        return 1;
-    }
-    return 0;
+
+    return error;
 }
             
 /* Function to process a single line of assembly code */
-int process_line(AssemblerState *state, char *line, Macro *macros, int *macroCount)
+int process_line(AssemblerState *state, const char *line, size_t length, Macro *macros, int *macroCount)
 {
     int error = 0;
-    char *label = NULL;
-    char *op = NULL;
-    char *operand1 = NULL;
-    char *operand2 = NULL;
+    LineTokens tokens;
+    const char *op;
+    Operand operands[MAX_LINE_OPERANDS];
     int validLabel = 0;
-    char *token;
-    char *afterData;
-    char *afterString;
-    char *afterEntry;
-    char *afterExtern;
     int operand_count;
-    char *operands[2];
     int i;
     int result;
 
     /* Check line length */
-    if (!check_line_length(line))
+    if (length > MAX_LINE_LENGTH)
     {
-        fprintf(stderr, "Error: line length exceeds the limit\n");
+        report(state->diagnostics, SEVERITY_ERROR, DIAG_LINE_TOO_LONG, state->current_line, 0, "Line length exceeds the limit of %d characters", MAX_LINE_LENGTH);
         error = 1;
     }
 
-    token = strtok(line, " \t");
-    if (token == NULL)
+    if (!tokenize_line(line, length, &tokens))
     {
         return 0;
     }
 
-    /* Check for label */
-    if (strchr(token, ':') != NULL)
+    /* Check for label; the tokens stay spans into the line and a name is
+       only copied when it is stored in a table */
+    if (tokens.has_label)
     {
-        label = token;
-        label[strlen(label) - 1] = '\0'; /* Remove colon */
-
-        if (!isValidLabel(label, macros, macroCount))
+        if (!isValidLabel(state, tokens.label.start, (size_t)tokens.label.length, source_column(state, tokens.label.start), macros, macroCount))
         {
-            fprintf(stderr, "Error: Invalid label\n");
             error = 1;
             validLabel = 1;
         }
-        if (is_duplicate_label(label, state))
+        if (is_duplicate_label(tokens.label.start, (size_t)tokens.label.length, state))
         {
-            fprintf(stderr, "Error: duplicate label definition\n");
+            report(state->diagnostics, SEVERITY_ERROR, DIAG_DUPLICATE_LABEL, state->current_line, source_column(state, tokens.label.start), "Duplicate definition of label '%.*s'", tokens.label.length, tokens.label.start);
             error = 1;
         }
-        /* Continue after label */
-        token = strtok(NULL, " \t");
-        if (token == NULL)
+        if (tokens.op.length == 0)
         {
-            fprintf(stderr, "Error: Label '%s' is followed by an empty line\n", label);
-            error = 1;
+            report(state->diagnostics, SEVERITY_ERROR, DIAG_INVALID_LABEL, state->current_line, source_column(state, tokens.label.start), "Label '%.*s' is followed by an empty line", tokens.label.length, tokens.label.start);
+            return 1;
         }
     }
 
-    op = token;
-
     /* Handle special instructions */
-    if (op[0] == '.')
+    if (tokens.op.length != 0 && tokens.op.start[0] == '.')
     {
-        if (strncmp(op, ".data", 5) == 0 && strlen(op) == 5)
+        if (span_equals(tokens.op, ".data"))
         {
-            afterData = strtok(NULL, "");
-
-            /* Check data integrity */
-            if (data_intergity_check(afterData) == 0)
+            if (handle_data_directive(state, tokens.label, tokens.rest.start, (size_t)tokens.rest.length, validLabel) != 0)
             {
-                afterData = trim(afterData);
-                handle_data_directive(state, label ? label : "", afterData, validLabel);
-            }
-            else
-            {
-                fprintf(stderr, "Invalid .data directive\n");
+                error = 1;
             }
         }
-        else if (strncmp(op, ".string", 7) == 0 && strlen(op) == 7)
+        else if (span_equals(tokens.op, ".string"))
         {
-            afterString = strtok(NULL, "");
-
-            /* Check string integrity */
-            if (string_intergity_check(afterString) == 0)
+            if (handle_string_directive(state, tokens.label, tokens.rest.start, (size_t)tokens.rest.length, validLabel) != 0)
             {
-                afterString = trim(afterString);
-                handle_string_directive(state, label ? label : "", afterString, validLabel);
-            }
-            else
-            {
-                fprintf(stderr, "Invalid .string directive\n");
+                error = 1;
             }
         }
-        else if (strncmp(op, ".entry", 6) == 0 && strlen(op) == 6)
+        else if (span_equals(tokens.op, ".entry"))
         {
-            afterEntry = strtok(NULL, "");
-
             /* Check entry integrity */
-            if (entry_intergity_check(afterEntry, state, macros, macroCount) == 0)
+            if (entry_intergity_check(tokens.rest, state, macros, macroCount) == 0)
             {
-                afterEntry = trim(afterEntry);
-                handle_entry_directive(state, afterEntry);
+                handle_entry_directive(state, tokens.rest);
             }
             else
             {
-                fprintf(stderr, "Invalid .entry directive\n");
+                error = 1;
             }
         }
-        else if (strncmp(op, ".extern", 7) == 0 && strlen(op) == 7)
+        else if (span_equals(tokens.op, ".extern"))
         {
-            afterExtern = strtok(NULL, "");
-
             /* Check extern integrity */
-            if (extern_intergity_check(afterExtern, state) == 0)
+            if (extern_intergity_check(tokens.rest, state) == 0)
             {
-                afterExtern = trim(afterExtern);
-                handle_extern_directive(state, afterExtern);
+                handle_extern_directive(state, tokens.rest);
             }
             else
             {
-                fprintf(stderr, "Invalid .extern directive\n");
+                error = 1;
             }
         }
         else
         {
-            fprintf(stderr, "Error: Invalid directive\n");
+            report(state->diagnostics, SEVERITY_ERROR, DIAG_INVALID_DIRECTIVE, state->current_line, source_column(state, tokens.op.start), "Invalid directive '%.*s'", tokens.op.length, tokens.op.start);
             error = 1;
         }
     }
     else
     {
-        /* Check instruction validity */
-        if (!is_valid_instruction(op))
+        /* Check instruction validity, then the operand count */
+        operand_count = tokens.operand_count;
+        op = find_instruction(tokens.op.start, (size_t)tokens.op.length);
+        if (op == NULL)
         {
-            fprintf(stderr, "Error: Invalid Instruction\n");
+            report(state->diagnostics, SEVERITY_ERROR, DIAG_INVALID_INSTRUCTION, state->current_line, source_column(state, tokens.op.start), "Invalid instruction '%.*s'", tokens.op.length, tokens.op.start);
             error = 1;
         }
-        /* Handle regular instructions */
-        operand1 = strtok(NULL, ",");
-        operand2 = strtok(NULL, "");
-
-        if (operand1)
-            operand1 = trim(operand1);
-        if (operand2)
-            operand2 = trim(operand2);
-
-        operand_count = 0;
-        if (operand1)
-            operand_count++;
-        if (operand2)
-            operand_count++;
-
-        /* Check operand count */
-        if (!check_operand_count(op, operand_count))
+        else if (!check_operand_count(op, operand_count))
         {
-            fprintf(stderr, "Error: Incorrect number of operands for instruction\n");
+            report(state->diagnostics, SEVERITY_ERROR, DIAG_OPERAND_COUNT, state->current_line, source_column(state, tokens.op.start), "Incorrect number of operands for instruction '%s'", op);
             error = 1;
         }
+        if (operand_count > MAX_LINE_OPERANDS)
+        {
+            operand_count = MAX_LINE_OPERANDS;
+        }
 
-        /* Check operand validity */
-        operands[0] = operand1;
-        operands[1] = operand2;
+        /* Classify and check each operand in one scan */
         for (i = 0; i < operand_count; i++)
         {
-            if (!is_valid_operand(operands[i], macros, macroCount))
-            {
-                fprintf(stderr, "Error: Invalid operand\n");
-                error = 1;
-            }
-
-            if (!is_valid_addressing_mode(op, operands[i], i == 0))
+            if (!classify_operand(state, tokens.operands[i].start, (size_t)tokens.operands[i].length, &operands[i], macros, macroCount))
             {
-                fprintf(stderr, "Error: Invalid addressing method for operand %s\n", i == 0 ? "Source" : "Destination");
                 error = 1;
             }
-
-            if (operands[i][0] == '#' && !is_valid_immediate(operands[i]))
+            else if (op == NULL || !is_valid_addressing_mode(op, &operands[i], i == 0))
             {
-                fprintf(stderr, "Error: Invalid immediate value\n");
+                report(state->diagnostics, SEVERITY_ERROR, DIAG_ADDRESSING_MODE, state->current_line, source_column(state, tokens.operands[i].start),
+                       "Invalid addressing method for %s operand of '%.*s'", i == 0 ? "source" : "destination", tokens.op.length, tokens.op.start);
                 error = 1;
             }
         }
 
         /* Assemble instruction */
-        result = assemble_instruction(state, label, op, operand1, operand2, validLabel);
+        result = assemble_instruction(state, tokens.label, op, operands, operand_count, validLabel);
         if (result == 1)
         {
             error = 1;
@@ -825,45 +661,189 @@ int process_line(AssemblerState *state, char *line, Macro *macros, int *macroCou
     else
         return 0;
 }
+/* Checks whether text starts with a directive name followed by a blank or the end */
+static int starts_with_directive(const char *p, const char *end, const char *name, size_t length)
+{
+    return (size_t)(end - p) >= length && memcmp(p, name, length) == 0 &&
+           ((size_t)(end - p) == length || scan_is_blank(p[length]));
+}
 
+/* Counts upper bounds on the statements, labels and words of a source */
+void count_source(const SourceBuffer *source, SourceCounts *counts)
+{
+    const char *p = source->data;
+    const char *end = source->data + source->length;
+    const char *line_end;
+    const char *next;
+    const char *colon;
+
+    memset(counts, 0, sizeof(*counts));
+    for (; p < end; p = next)
+    {
+        line_end = scan_newline(p, end);
+        next = line_end < end ? line_end + 1 : end;
+        p = scan_skip_blanks(p, line_end);
+        if (p == line_end || *p == ';')
+        {
+            continue;
+        }
+        counts->statements++;
 
+        /* Like the tokenizer, a label is a colon in the first word; a colon
+           further on sits in a string or a comment and starts no label */
+        for (colon = p; colon < line_end && !scan_is_blank(*colon) && *colon != ':'; colon++)
+            ;
+        if (colon < line_end && *colon == ':')
+        {
+            counts->labels++;
+            p = scan_skip_blanks(colon + 1, line_end);
+        }
 
-/* Function to perform the first pass of the assembler */
-void first_pass(AssemblerState *state, const char *filename, Macro *macros, int *macroCount, int *error)
+        if (starts_with_directive(p, line_end, ".data", 5))
+        {
+            /* One value per comma, plus the last one */
+            counts->data_values++;
+            for (; p < line_end; p++)
+            {
+                counts->data_values += *p == ',';
+            }
+        }
+        else if (starts_with_directive(p, line_end, ".string", 7))
+        {
+            /* The rest of the line holds the quoted characters and room for the terminator */
+            counts->data_values += (int)(line_end - p);
+        }
+        else if (starts_with_directive(p, line_end, ".entry", 6))
+        {
+            counts->entries++;
+        }
+        else if (starts_with_directive(p, line_end, ".extern", 7))
+        {
+            counts->externs++;
+        }
+        else if (p < line_end && *p != '.')
+        {
+            counts->instructions++;
+        }
+    }
+}
+
+/* Returns table grown to hold at least needed elements, or table itself if it is large enough or memory ran out */
+static void *reserve_table(AssemblerState *state, void *table, int *capacity, int needed, size_t size, int *error)
 {
-    FILE *file;
-    char line[MAX_LINE_LENGTH];
-    char *newline;
-    char *trimmed_line;
-    int result;
+    void *grown;
 
- 
-    file = fopen(filename, "r");
-    if (file == NULL)
+    if (needed <= *capacity)
     {
-        perror("Error opening file");
-        return;
+        return table;
+    }
+    grown = realloc(table, (size_t)needed * size);
+    if (!grown)
+    {
+        report(state->diagnostics, SEVERITY_ERROR, DIAG_OUT_OF_MEMORY, 0, 0, "Failed to allocate memory for %d table entries", needed);
+        *error = 1;
+        return table;
     }
+    *capacity = needed;
+    return grown;
+}
+
+/* Grows the tables of an assembler state to hold a whole source */
+int reserve_assembler_state(AssemblerState *state, const SourceCounts *counts)
+{
+    /* An instruction takes at most three words and refers to at most two symbols */
+    int references = 2 * counts->instructions;
+    int symbols = counts->labels + counts->entries + counts->externs + references;
+    int error = 0;
 
-    while (fgets(line, sizeof(line), file))
+    state->statements = reserve_table(state, state->statements, &state->statement_capacity, counts->statements, sizeof(Statement), &error);
+    state->label_table = reserve_table(state, state->label_table, &state->label_capacity, counts->labels, sizeof(Label), &error);
+    state->entry_table = reserve_table(state, state->entry_table, &state->entry_capacity, counts->entries, sizeof(EntryLabel), &error);
+    state->extern_table = reserve_table(state, state->extern_table, &state->extern_capacity, counts->externs, sizeof(ExternLabel), &error);
+    state->symbols = reserve_table(state, state->symbols, &state->symbol_capacity, symbols, sizeof(Symbol), &error);
+    if (reserve_symbol_buckets(state, symbols) != 0)
+    {
+        report(state->diagnostics, SEVERITY_ERROR, DIAG_OUT_OF_MEMORY, 0, 0, "Failed to allocate memory for %d table entries", symbols);
+        error = 1;
+    }
+    state->data_values = reserve_table(state, state->data_values, &state->data_capacity, counts->data_values, sizeof(int), &error);
+    state->relocations = reserve_table(state, state->relocations, &state->relocation_capacity, references, sizeof(Relocation), &error);
+    if (state->single_pass)
+    {
+        state->fixups = reserve_table(state, state->fixups, &state->fixup_capacity, references, sizeof(Fixup), &error);
+    }
+    if (error)
     {
-        newline = strchr(line, '\n');
-        if (newline)
-            *newline = '\0'; /* Remove newline character */
+        return 1;
+    }
+    return ensure_memory_capacity(state, MEMORY_START + 3 * counts->instructions + counts->data_values);
+}
 
-        trimmed_line = trim(line);
+/* Runs process_line over every line of a source; returns 1 if a line failed */
+int first_pass_lines(AssemblerState *state, const SourceBuffer *source, Macro *macros, int *macroCount)
+{
+    LineReader reader;
+    LineView line;
+    const char *start;
+    const char *end;
+    int error = 0;
 
-        if (trimmed_line[0] == '\0' || trimmed_line[0] == ';')
+    line_reader_init(&reader, source);
+    while (!diagnostics_budget_exhausted(state->diagnostics) && line_reader_next(&reader, &line))
+    {
+        state->current_line = line.number;
+        state->line_start = line.start;
+
+        /* Skip surrounding whitespace without touching the source */
+        start = scan_skip_blanks(line.start, line.start + line.length);
+        end = scan_trim_end(start, line.start + line.length);
+
+        if (start == end || *start == ';')
         {
             continue;
         }
-        result = process_line(state, trimmed_line, macros, macroCount);
-        if (result == 1)
- {
-            *error = 1;  /* Update the error value through the pointer */
+        if (process_line(state, start, (size_t)(end - start), macros, macroCount) == 1)
+        {
+            error = 1;
         }
+    }
+    state->line_start = NULL;
+    return error;
+}
+
+/* Function to perform the first pass of the assembler */
+void first_pass(AssemblerState *state, const SourceBuffer *source, Macro *macros, int *macroCount, int *error)
+{
+    SourceCounts counts;
+    int errors_before = state->diagnostics != NULL ? state->diagnostics->error_count : 0;
+
+    /* Size every table once, so the passes below do not reallocate */
+    count_source(source, &counts);
+    if (reserve_assembler_state(state, &counts) != 0)
+    {
+        *error = 1;
+        return;
+    }
 
+    /* A large source is split across threads when it can be; otherwise,
+       or if the split run has anything to report, it is read line by line */
+    if (!parallel_first_pass(state, source, macros, macroCount) &&
+        first_pass_lines(state, source, macros, macroCount) != 0)
+    {
+        *error = 1;  /* Update the error value through the pointer */
     }
 
-    fclose(file);
+    /* Any reported error fails the file, including ones from directive handlers */
+    if (state->diagnostics != NULL && state->diagnostics->error_count > errors_before)
+    {
+        *error = 1;
+    }
+
+    /* The data segment follows the code: move data labels after the final IC */
+    relocate_data_labels(state);
+
+    if (state->single_pass && finish_single_pass(state, *error == 0) != 0)
+    {
+        *error = 1;
+    }
 }
@@ -2,6 +2,7 @@
 /* File containing helper functions for pre-assembler, first pass, and second pass */
 /****************************************************************/
 #include "assembler.h"
+#include "scan.h"
 #include <ctype.h>
 #include <limits.h>
 
@@ -9,14 +10,9 @@
 #define RESERVED_WORD_COUNT 31
 #define BINARY_LENGTH 12
 #define MAX_OCTAL_LENGTH 6
-#define IMMEDIATE_MIN -2048
-#define IMMEDIATE_MAX 2047
-#define REGISTER_PREFIX 'r'
-#define IMMEDIATE_PREFIX '#'
-#define INDIRECT_PREFIX '*'
 #define COMMENT_PREFIX ';'
 
-char strings[RESERVED_WORD_NUM][MAX_RESERVED_WORD_LENGTH] = {
+const char strings[RESERVED_WORD_NUM][MAX_RESERVED_WORD_LENGTH] = {
     ".data", ".string", ".entry", ".extern", "define",
     "macr", "endmacr", 
     "mov", "cmp", "add", "sub", "lea",
@@ -29,71 +25,15 @@ char strings[RESERVED_WORD_NUM][MAX_RESERVED_WORD_LENGTH] = {
 /* General functions */
 /*******************/
 
-/* Custom implementation of strtok_r for Visual Studio compatibility */
-char *strtok_r(char *str, const char *delim, char **saveptr) 
-	{
-    char *token;
-
-    if (str == NULL)
- 	{
-        str = *saveptr;
-    }
-
-    str += strspn(str, delim);
-    if (*str == '\0') 
-	{
-        return NULL;
-    }
-
-    token = str;
-    str = strpbrk(token, delim);
-    if (str == NULL) 
-	{
-        *saveptr = strchr(token, '\0');
-    } else {
-        *str = '\0';
-        *saveptr = str + 1;
-    }
-
-    return token;
-}
-
 /* Trims leading and trailing whitespace from a string */
 char *trim(char *str)
 {
-    char *end;
-    while (isspace((unsigned char)*str))
-        str++;
-    if (*str == 0)
-        return str;
-    end = str + strlen(str) - 1;
-    while (end > str && isspace((unsigned char)*end))
-        end--;
-    end[1] = '\0';
-    return str;
-}
-
-/* Converts an integer to its binary representation */
-char *int_to_binary(int value, int bits)
-{
-    char *binary;
-    int i;
-
-    binary = (char *)malloc(bits + 1);
-    if (binary == NULL)
-    {
-        fprintf(stderr, "Error: Failed to allocate memory.\n");
-        return NULL;
-    }
-
-    binary[bits] = '\0';
-    for (i = bits - 1; i >= 0; i--)
-    {
-        binary[i] = (value & 1) ? '1' : '0';
-        value >>= 1;
-    }
+    char *end = str + strlen(str);
 
-    return binary;
+    str += scan_skip_blanks(str, end) - str;
+    end = str + (scan_trim_end(str, end) - str);
+    *end = '\0';
+    return str;
 }
 
 /* Creates a new file extension for the output file */
@@ -103,16 +43,14 @@ void addExtension(char* filename, const char* extension, char* result)
     strcat(result, extension);
 }
 
-/* Removes leading whitespace from a line */
-void trimLeadingWhitespace(char *str) 
+/* Removes leading whitespace from a line; returns 1 for an indented comment, which is left as is */
+int trimLeadingWhitespace(char *str) 
 {
-    char *start = str;
+    char *start;
+    size_t length = strlen(str);
     int is_comment = 0;
 
-    while (isspace((unsigned char)*start)) 
-{
-        start++;
-    }
+    start = str + (scan_skip_blanks(str, str + length) - str);
 
     if (*start == COMMENT_PREFIX) 
 {
@@ -123,16 +61,17 @@ void trimLeadingWhitespace(char *str)
  {
         if (str != start) 
 {
-            printf("Error: Leading whitespace before comment on line: %s\n", str);
+            return 1;
         }
     } 
 else 
 {
         if (start != str) 
 {
-            memmove(str, start, strlen(start) + 1);
+            memmove(str, start, length - (size_t)(start - str) + 1);
         }
     }
+    return 0;
 }
 
 /* Checks if a line has leading whitespace */
@@ -149,103 +88,34 @@ int has_leading_whitespace(const char *line)
  * Functions related to building the macro table - macro_table.c file
  ***************************************************************/
 
-/* Frees the memory allocated for the macro table */
+/* Frees the macro table; the names and bodies live in the file's arena */
 void freeMacros(Macro* macros, int macroCount)
  {
-    int i;
-    for (i = 0; i < macroCount; i++) 
-{
-        free(macros[i].name);
-        free(macros[i].content);
-    }
+    (void)macroCount;
     free(macros);
 }
 
-/* Custom implementation of strdup */
-char *my_strdup(const char *s)
- {
-    char *new_str;
-    size_t len;
-
-    if (s == NULL)
- {
-        return NULL;
-    }
-
-    len = strlen(s) + 1;
-    new_str = (char *)malloc(len);
-    
-    if (new_str == NULL)
- {
-        return NULL;
-    }
-
-    memcpy(new_str, s, len);
-    return new_str;
-}
-
-/* Checks if a line is a comment */
+/* Checks if a line is a comment (its first non-blank character is ';') */
 int is_comment(const char* line) 
 {
-    char* trim_line;
-    char* token;
-    int result;
-
-    trim_line = my_strdup(line);
-    if (trim_line == NULL) 
-{
-        return 0; /* Memory allocation failed, assume it's not a comment */
-    }
-
-    token = strtok(trim_line, " \t\n");
-    if (token != NULL && token[0] == COMMENT_PREFIX)
- {
-        result = 1; /* The line is a comment */
-    } 
-else
- {
-        result = 0; /* The line is not a comment */
-    }
+    const char* end = line + strlen(line);
+    const char* first = scan_skip_blanks(line, end);
 
-    free(trim_line);
-    return result;
+    return first < end && *first == COMMENT_PREFIX;
 }
 
 /* Checks if a line is empty */
 int is_empty_line(const char* line)
  {
-    char* trim_line;
-    char* token;
-    int result;
-
-    trim_line = my_strdup(line);
-    if (trim_line == NULL) {
-        return 1; /* Memory allocation failed, assume it's an empty line */
-    }
-
-    token = strtok(trim_line, " \t\n");
-    if (token == NULL) {
-        result = 1; /* The line is empty */
-    } else {
-        result = 0; /* The line is not empty */
-    }
-
-    free(trim_line);
-    return result;
+    return is_whitespace_line(line);
 }
 
 /* Checks if a line contains only whitespace characters */
 int is_whitespace_line(const char* line)
  {
-    while (*line) 
-{
-        if (!isspace(*line)) 
-{
-            return 0; /* Found a non-space character */
-        }
-        line++;
-    }
-    return 1; /* The entire line contains only whitespace characters */
+    const char* end = line + strlen(line);
+
+    return scan_skip_blanks(line, end) == end;
 }
 
 /* Checks if a line inside a macro is empty or contains only whitespace */
@@ -268,20 +138,11 @@ void add_label_for_check(AssemblerState* state, const char* name, int address)
         state->label_table[state->label_count].address = address;
         state->label_table[state->label_count].is_extern = 0;
         state->label_table[state->label_count].is_entry = 0;
+        state->label_table[state->label_count].is_data = 0;
         state->label_count++;
     }
 }
 
-/* Gets the register number from an operand */
-int get_register_number(const char *operand)
-{
-    if (operand[0] == REGISTER_PREFIX && isdigit(operand[1]))
-    {
-        return operand[1] - '0';
-    }
-    return -1; /* Not a register */
-}
-
 /* Gets the opcode for a given operation */
 int get_opcode(const char *operation)
 {
@@ -304,99 +165,285 @@ int get_opcode(const char *operation)
     return -1; /* Invalid operation */
 }
 
-char *encode_immediate_operand(const char *operand)
+/* Frees the memory allocated for the assembler state */
+void free_assembler_state(AssemblerState *state)
+{
+    if (state)
+    {
+        free(state->words);
+        free(state->relocations);
+        free(state->extern_table);
+        free(state->label_table);
+        free(state->entry_table);
+        free(state->statements);
+        free(state->data_values);
+        free(state->symbols);
+        free(state->symbol_buckets);
+        free(state->fixups);
+        arena_free(&state->arena);
+        free(state);
+    }
+}
+
+/* Adds a label to the assembler state */
+void add_label(AssemblerState *state, const char *name, int address)
+{
+    int symbol;
+
+    if (state->label_count == state->label_capacity)
+    {
+        state->label_capacity *= 2;
+        state->label_table = realloc(state->label_table, state->label_capacity * sizeof(Label));
+        if (!state->label_table)
+        {
+            report(state->diagnostics, SEVERITY_ERROR, DIAG_OUT_OF_MEMORY, state->current_line, 0, "Failed to reallocate label table");
+            return;
+        }
+    }
+
+    strncpy(state->label_table[state->label_count].name, name, MAX_LABEL_LENGTH);
+    state->label_table[state->label_count].name[MAX_LABEL_LENGTH] = '\0';
+    state->label_table[state->label_count].address = address;
+    state->label_table[state->label_count].is_entry = 0;
+    state->label_table[state->label_count].is_extern = 0;
+    state->label_table[state->label_count].is_data = 0;
+
+    symbol = intern_symbol(state, name);
+    if (symbol != NO_SYMBOL && state->symbols[symbol].label == -1)
+    {
+        state->symbols[symbol].label = state->label_count;
+    }
+    state->label_count++;
+}
+
+/* Adds a label defined by a data directive; its address is relative to the data segment */
+void add_data_label(AssemblerState *state, const char *name, int data_address)
+{
+    int count = state->label_count;
+
+    add_label(state, name, data_address);
+    if (state->label_count > count)
+    {
+        state->label_table[count].is_data = 1;
+    }
+}
+
+/* Moves data labels after the code segment once the final IC is known */
+void relocate_data_labels(AssemblerState *state)
 {
-    const char *number_str;
-    char *endptr;
-    long number;
-    char *result;
-    unsigned short unsigned_number;
     int i;
+    for (i = 0; i < state->label_count; i++)
+    {
+        if (state->label_table[i].is_data)
+        {
+            state->label_table[i].address += state->IC;
+        }
+    }
+}
+
+/* Hashes the significant characters of a symbol name; names are compared
+   on their first MAX_LABEL_LENGTH characters, so only those are hashed */
+static unsigned symbol_hash(const char *name, size_t length)
+{
+    unsigned hash = 5381;
+    size_t i;
 
-    if (operand == NULL || operand[0] != IMMEDIATE_PREFIX)
+    for (i = 0; i < length && i < MAX_LABEL_LENGTH; i++)
     {
-        return NULL; /* Not an immediate operand */
+        hash = hash * 33 + (unsigned char)name[i];
     }
+    return hash;
+}
 
-    number_str = operand + 1;
-    number = strtol(number_str, &endptr, 10);
+/* Rebuilds the symbol hash with a new number of buckets, a power of two */
+static int rehash_symbols(AssemblerState *state, int bucket_count)
+{
+    int *buckets;
+    unsigned bucket;
+    int i;
 
-    if (endptr == number_str || *endptr != '\0')
+    buckets = malloc((size_t)bucket_count * sizeof(int));
+    if (!buckets)
+    {
+        return 1;
+    }
+    for (i = 0; i < bucket_count; i++)
     {
-        return NULL; /* Invalid number */
+        buckets[i] = NO_SYMBOL;
     }
+    for (i = 0; i < state->symbol_count; i++)
+    {
+        bucket = symbol_hash(state->symbols[i].name, strlen(state->symbols[i].name)) & (unsigned)(bucket_count - 1);
+        state->symbols[i].next = buckets[bucket];
+        buckets[bucket] = i;
+    }
+    free(state->symbol_buckets);
+    state->symbol_buckets = buckets;
+    state->bucket_count = bucket_count;
+    return 0;
+}
 
-    if (number < IMMEDIATE_MIN || number > IMMEDIATE_MAX)
+/* Grows the symbol hash to hold the given number of symbols */
+int reserve_symbol_buckets(AssemblerState *state, int symbols)
+{
+    int bucket_count = state->bucket_count;
+
+    while (bucket_count < symbols && bucket_count <= INT_MAX / 2)
+    {
+        bucket_count *= 2;
+    }
+    if (bucket_count == state->bucket_count)
     {
-        return NULL; /* Number out of range */
+        return 0;
     }
+    return rehash_symbols(state, bucket_count);
+}
 
-    result = (char *)calloc(16, sizeof(char));
-    if (result == NULL)
+/* Looks up a symbol by name */
+int find_symbol(const AssemblerState *state, const char *name)
+{
+    return find_symbol_length(state, name, strlen(name));
+}
+
+/* Looks up a symbol by a name that need not be null-terminated */
+int find_symbol_length(const AssemblerState *state, const char *name, size_t length)
+{
+    int i;
+
+    if (length > MAX_LABEL_LENGTH)
     {
-        return NULL; /* Memory allocation failure */
+        length = MAX_LABEL_LENGTH;
     }
+    i = state->symbol_buckets[symbol_hash(name, length) & (unsigned)(state->bucket_count - 1)];
+    while (i != NO_SYMBOL)
+    {
+        if (memcmp(state->symbols[i].name, name, length) == 0 && state->symbols[i].name[length] == '\0')
+        {
+            return i;
+        }
+        i = state->symbols[i].next;
+    }
+    return NO_SYMBOL;
+}
 
-    unsigned_number = (unsigned short)(number & 0xFFF);
-    for (i = 11; i >= 0; i--)
+/* Returns the symbol for a name, adding it to the symbol table if needed */
+int intern_symbol(AssemblerState *state, const char *name)
+{
+    int symbol;
+    unsigned bucket;
+    Symbol *symbols;
+
+    symbol = find_symbol(state, name);
+    if (symbol != NO_SYMBOL)
     {
-        result[11 - i] = (unsigned_number & (1 << i)) ? '1' : '0';
+        return symbol;
     }
 
-    result[12] = '1';
-    result[13] = '0';
-    result[14] = '0';
-    result[15] = '\0';
+    if (state->symbol_count == state->symbol_capacity)
+    {
+        symbols = realloc(state->symbols, state->symbol_capacity * 2 * sizeof(Symbol));
+        if (!symbols)
+        {
+            report(state->diagnostics, SEVERITY_ERROR, DIAG_OUT_OF_MEMORY, state->current_line, 0, "Failed to reallocate symbol table");
+            return NO_SYMBOL;
+        }
+        state->symbols = symbols;
+        state->symbol_capacity *= 2;
+    }
 
-    return result;
+    /* Keep the chains short; if the bigger hash cannot be had, the old one still works */
+    if (state->symbol_count >= state->bucket_count)
+    {
+        reserve_symbol_buckets(state, state->symbol_count + 1);
+    }
+
+    symbol = state->symbol_count++;
+    bucket = symbol_hash(name, strlen(name)) & (unsigned)(state->bucket_count - 1);
+    strncpy(state->symbols[symbol].name, name, MAX_LABEL_LENGTH);
+    state->symbols[symbol].name[MAX_LABEL_LENGTH] = '\0';
+    state->symbols[symbol].label = -1;
+    state->symbols[symbol].is_extern = 0;
+    state->symbols[symbol].is_entry = 0;
+    state->symbols[symbol].fixups = NO_FIXUP;
+    state->symbols[symbol].next = state->symbol_buckets[bucket];
+    state->symbol_buckets[bucket] = symbol;
+    return symbol;
 }
 
+/* Appends an empty statement for the current line */
+Statement *append_statement(AssemblerState *state, int kind)
+{
+    Statement *statements;
+    Statement *statement;
+
+    if (state->statement_count == state->statement_capacity)
+    {
+        statements = realloc(state->statements, state->statement_capacity * 2 * sizeof(Statement));
+        if (!statements)
+        {
+            report(state->diagnostics, SEVERITY_ERROR, DIAG_OUT_OF_MEMORY, state->current_line, 0, "Failed to reallocate statements");
+            return NULL;
+        }
+        state->statements = statements;
+        state->statement_capacity *= 2;
+    }
+
+    statement = &state->statements[state->statement_count++];
+    memset(statement, 0, sizeof(*statement));
+    statement->kind = (unsigned char)kind;
+    statement->opcode = -1;
+    statement->src.reg = -1;
+    statement->src.symbol = NO_SYMBOL;
+    statement->dst.reg = -1;
+    statement->dst.symbol = NO_SYMBOL;
+    statement->symbol = NO_SYMBOL;
+    statement->line = state->current_line;
+    return statement;
+}
 
-/* Gets the addressing mode for an operand */
-int get_addressing_mode(const char *operand)
+/* Gets the 1-based column of a character in the current line */
+int source_column(const AssemblerState *state, const char *p)
 {
-    if (operand[0] == IMMEDIATE_PREFIX)
-        return 1; /* Immediate */
-    if (operand[0] == REGISTER_PREFIX)
-        return 8; /* Direct register */
-    if (operand[0] == INDIRECT_PREFIX)
-        return 4; /* Indirect register */
-    return 2;     /* Direct (label) */
+    return state->line_start != NULL ? (int)(p - state->line_start) + 1 : 0;
 }
 
-/* Frees the memory allocated for the assembler state */
-void free_assembler_state(AssemblerState *state)
+/* Appends a value to the data segment and advances DC */
+int append_data_value(AssemblerState *state, int value)
 {
-    if (state)
+    int *slot = reserve_data_values(state, 1);
+
+    if (!slot)
     {
-        free(state->memory);
-        free(state->extern_table);
-        free(state->label_table);
-        free(state->entry_table);
-        free(state);
+        return 1;
     }
+    *slot = value;
+    state->DC++;
+    return 0;
 }
 
-/* Adds a label to the assembler state */
-void add_label(AssemblerState *state, const char *name, int address)
+/* Makes room for values at the end of the data segment without advancing DC */
+int *reserve_data_values(AssemblerState *state, size_t count)
 {
-    if (state->label_count == state->label_capacity)
+    int *values;
+    size_t capacity = (size_t)state->data_capacity;
+
+    if ((size_t)state->DC + count > capacity)
     {
-        state->label_capacity *= 2;
-        state->label_table = realloc(state->label_table, state->label_capacity * sizeof(Label));
-        if (!state->label_table)
+        while ((size_t)state->DC + count > capacity)
         {
-            perror("Failed to reallocate label table");
-            return;
+            capacity *= 2;
         }
+        values = realloc(state->data_values, capacity * sizeof(int));
+        if (!values)
+        {
+            report(state->diagnostics, SEVERITY_ERROR, DIAG_OUT_OF_MEMORY, state->current_line, 0, "Failed to reallocate data segment");
+            return NULL;
+        }
+        state->data_values = values;
+        state->data_capacity = (int)capacity;
     }
 
-    strncpy(state->label_table[state->label_count].name, name, MAX_LABEL_LENGTH);
-    state->label_table[state->label_count].name[MAX_LABEL_LENGTH] = '\0';
-    state->label_table[state->label_count].address = address;
-    state->label_table[state->label_count].is_entry = 0;
-    state->label_table[state->label_count].is_extern = 0;
-    state->label_count++;
+    return state->data_values + state->DC;
 }
 
 /* Checks if an instruction has a single operand */
@@ -427,7 +474,7 @@ void update_entry_addresses(AssemblerState *state)
         int address = state->entry_table[i].address;
         if (address != -1)
         {
-            fprintf(stderr, "Error: Entry label '%s' not found in symbol table\n", state->entry_table[i].name);
+            report(state->diagnostics, SEVERITY_ERROR, DIAG_INVALID_ENTRY, 0, 0, "Entry label '%s' not found in symbol table", state->entry_table[i].name);
         }
         else
         {
@@ -439,34 +486,18 @@ void update_entry_addresses(AssemblerState *state)
 /* Prints the memory content of the assembler state */
 void print_memory(AssemblerState *state)
 {
-    int i, j;
-    for (i = 100; i < state->IC + state->DC; i++)
+    int i;
+    const Relocation *relocation;
+
+    for (i = MEMORY_START; i < state->IC + state->DC; i++)
     {
-        if (state->memory[i].label[0] != '\0')
-        {
-            int is_extern = 0;
-            for (j = 0; j < state->extern_count; j++)
-            {
-                if (strcmp(state->extern_table[j].name, state->memory[i].label) == 0)
-                {
-                    is_extern = 1;
-                    break;
-                }
-            }
-
-            if (is_extern)
-            {
-                printf("%04d \"%s\"\n", i, state->memory[i].label);
-            }
-            else
-            {
-                printf("%04d \"%s\"\n", i, state->memory[i].label);
-            }
-        }
-        else
-        {
-            printf("%04d %s\n", i, state->memory[i].binary);
-        }
+        printf("%04d %05o\n", i, state->words[i]);
+    }
+    for (i = 0; i < state->relocation_count; i++)
+    {
+        relocation = &state->relocations[i];
+        printf("%04d \"%s\"%s\n", relocation->address, state->symbols[relocation->symbol].name,
+               relocation->kind == RELOCATION_EXTERNAL ? " external" : "");
     }
 }
 
@@ -477,16 +508,13 @@ void print_memory(AssemblerState *state)
 /* Gets the address of a label from the assembler state */
 int get_label_address(AssemblerState *state, const char *label)
 {
-    int i;
-    for (i = 0; i < state->label_count; i++)
+    int symbol = find_symbol(state, label);
+
+    if (symbol == NO_SYMBOL || state->symbols[symbol].label == -1)
     {
-        if (strcmp(state->label_table[i].name, label) == 0)
-        {
-            return state->label_table[i].address;
-        }
+        return -1; /* Return -1 if the label is not found */
     }
-
-    return -1; /* Return -1 if the label is not found */
+    return state->label_table[state->symbols[symbol].label].address;
 }
 
 /* Converts a decimal number to its 12-bit binary representation */
@@ -504,18 +532,6 @@ void decimalToBinary12(int n, char *binaryStr)
     }
 }
 
-/* Converts a binary string to its decimal representation */
-int binaryToDecimal(const char *binaryStr)
-{
-    return (int)strtol(binaryStr, NULL, 2);
-}
-
-/* Converts a decimal number to its octal representation */
-void decimalToOctal(int decimal, char *octalStr)
-{
-    sprintf(octalStr, "%05o", decimal);
-}
-
 /* Creates a new file extension for the output file */
 void createExtension(const char *filename, char *outputFilename, const char *extension)
 {
@@ -528,19 +544,3 @@ void createExtension(const char *filename, char *outputFilename, const char *ext
     }
     strcat(outputFilename, extension);
 }
-/* This function formats a string with one argument into a buffer of limited size.
-   It returns the number of characters that would have been written if the buffer was large enough. */
-int my_snprintf(char *str, size_t size, const char *format, const char *arg) 
-{
-    char temp[1024];
-    int written;
-
-    written = sprintf(temp, format, arg);
-
-    if (size > 0) {
-        strncpy(str, temp, size - 1);
-        str[size - 1] = '\0';
-    }
-
-    return written;
-}
@@ -1,21 +1,27 @@
 #include "assembler.h"
+#include "source.h"
 
-#define MAX_LINE_LENGTH 100
 #define INITIAL_CONTENT_SIZE 256
 #define INITIAL_NAME_ARRAY_SIZE 10
 #define MACRO_START "macr"
 #define MACRO_END "endmacr"
 #define MACRO_START_LENGTH 4
 #define MACRO_END_LENGTH 7
+#define WHITESPACE " \t\n\v\f\r"
 
 
 
-/* Function to read macros from a file and insert them into a table */
-Macro* readMacrosFromFile(const char* filename, int* macroCount, int* error) 
+/* Function to read macros from a source buffer and insert them into a table */
+Macro* readMacrosFromSource(const SourceBuffer* source, int* macroCount, int* error, Diagnostics* diagnostics, Arena* arena) 
 {
-    FILE* file;
+    LineReader reader;
+    LineView view;
+    TextBuffer lineText = {NULL, 0, 0};
     Macro* macros = NULL;
-    char line[MAX_LINE_LENGTH];
+    Macro* grownMacros;
+    char** grownNames;
+    char* grownContent;
+    char* line;
     int inMacro = 0;
     char macroName[MAX_MACRO_NAME_LENGTH + 1];
     size_t contentSize = INITIAL_CONTENT_SIZE;
@@ -24,6 +30,7 @@ Macro* readMacrosFromFile(const char* filename, int* macroCount, int* error)
     char** macroNames;
     int macroNamesCount = 0;
     char* remaining;
+    size_t nameLen;
     size_t lineLen;
     size_t contentLen;
     int i;
@@ -33,7 +40,7 @@ Macro* readMacrosFromFile(const char* filename, int* macroCount, int* error)
     macroContent = malloc(contentSize);
     if (!macroContent) 
 	{
-        fprintf(stderr, "Error at line %d: Failed to allocate memory for macro content\n", lineNumber);
+        report(diagnostics, SEVERITY_ERROR, DIAG_OUT_OF_MEMORY, lineNumber, 0, "Failed to allocate memory for macro content");
         *error = 1; 
         return NULL; 
   	  }
@@ -43,43 +50,50 @@ Macro* readMacrosFromFile(const char* filename, int* macroCount, int* error)
     macroNames = malloc(nameArraySize * sizeof(char*));
     if (!macroNames) 
 	{
-        fprintf(stderr, "Error at line %d: Failed to allocate memory for macro names\n", lineNumber);
+        report(diagnostics, SEVERITY_ERROR, DIAG_OUT_OF_MEMORY, lineNumber, 0, "Failed to allocate memory for macro names");
         *error = 1; 
         free(macroContent);
         return NULL;
     }
 
-    /* Open the file for reading */
-    file = fopen(filename, "r");
-    if (file == NULL)
-	 {
-        fprintf(stderr, "Error: Failed to open file %s\n", filename);
-        *error = 1; 
-        return NULL; 
-    }
-
     *macroCount = 0;
 
-    /* Read the file line by line */
-    while (fgets(line, sizeof(line), file)) 
+    /* Read the source line by line */
+    line_reader_init(&reader, source);
+    while (!diagnostics_budget_exhausted(diagnostics) && line_reader_next(&reader, &view)) 
     {
         lineNumber++;  /* Increment line counter */
-        trimLeadingWhitespace(line);
+        if (line_view_copy(&view, &lineText) != 0)
+        {
+            report(diagnostics, SEVERITY_ERROR, DIAG_OUT_OF_MEMORY, lineNumber, 0, "Failed to allocate memory for line");
+            *error = 1;
+            break;
+        }
+        line = lineText.data;
+        if (trimLeadingWhitespace(line))
+        {
+            report(diagnostics, SEVERITY_WARNING, DIAG_INDENTED_COMMENT, lineNumber, 1, "Leading whitespace before comment");
+        }
         
         if (strncmp(line, MACRO_START, MACRO_START_LENGTH) == 0)
         {
             /* Found the start of a macro */
             remaining = line + MACRO_START_LENGTH; 
             while (isspace(*remaining)) remaining++;
-            if (sscanf(remaining, "%s", macroName) != 1 || !is_whitespace_line(remaining + strlen(macroName)))
+            nameLen = strcspn(remaining, WHITESPACE);
+            if (nameLen == 0 || !is_whitespace_line(remaining + nameLen))
  		{
-                fprintf(stderr, "Error at line %d: Invalid macro definition line '%s'\n", lineNumber, line); 
+                report(diagnostics, SEVERITY_ERROR, DIAG_INVALID_MACRO, lineNumber, 0, "Invalid macro definition line '%.*s'", (int)strcspn(line, "\r\n"), line); 
                 *error = 1; 
             }
 
-            if (strlen(macroName) > MAX_MACRO_NAME_LENGTH) 
+            /* Lines have no length limit here, so only the first characters of a long name are kept */
+            lineLen = nameLen < MAX_MACRO_NAME_LENGTH ? nameLen : MAX_MACRO_NAME_LENGTH;
+            memcpy(macroName, remaining, lineLen);
+            macroName[lineLen] = '\0';
+            if (nameLen > MAX_MACRO_NAME_LENGTH) 
 		{
-                fprintf(stderr, "Error at line %d: Macro name '%s' exceeds maximum length of 31 characters\n", lineNumber, macroName);
+                report(diagnostics, SEVERITY_ERROR, DIAG_INVALID_MACRO, lineNumber, 0, "Macro name '%s' exceeds maximum length of 31 characters", macroName);
                 *error = 1; 
             }
 
@@ -90,7 +104,7 @@ Macro* readMacrosFromFile(const char* filename, int* macroCount, int* error)
 	 	{
                 if (strcmp(macroNames[i], macroName) == 0) 
 		{
-                    fprintf(stderr, "Error at line %d: Duplicate macro name '%s'\n", lineNumber, macroName); 
+                    report(diagnostics, SEVERITY_ERROR, DIAG_INVALID_MACRO, lineNumber, 0, "Duplicate macro name '%s'", macroName); 
                     *error = 1; 
                 }
             }
@@ -98,19 +112,31 @@ Macro* readMacrosFromFile(const char* filename, int* macroCount, int* error)
             /* Increase the size of the macro names array if needed */
             if (macroNamesCount >= nameArraySize)
  		{
-                nameArraySize *= 2; 
-                macroNames = realloc(macroNames, nameArraySize * sizeof(char*));
-                if (!macroNames) 
+                grownNames = realloc(macroNames, nameArraySize * 2 * sizeof(char*));
+                if (!grownNames) 
 		{
-                    fprintf(stderr, "Error at line %d: Failed to reallocate memory for macro names\n", lineNumber); 
+                    report(diagnostics, SEVERITY_ERROR, DIAG_OUT_OF_MEMORY, lineNumber, 0, "Failed to reallocate memory for macro names"); 
                     *error = 1; 
+                    free(macroNames);
                     free(macroContent); 
-                    fclose(file); 
+                    free(lineText.data);
                     return macros; 
                 }
+                macroNames = grownNames;
+                nameArraySize *= 2; 
             }
 
-            macroNames[macroNamesCount++] = my_strdup(macroName);
+            macroNames[macroNamesCount] = arena_strdup(arena, macroName);
+            if (!macroNames[macroNamesCount])
+            {
+                report(diagnostics, SEVERITY_ERROR, DIAG_OUT_OF_MEMORY, lineNumber, 0, "Failed to allocate memory for macro name");
+                *error = 1;
+                free(macroNames);
+                free(macroContent);
+                free(lineText.data);
+                return macros;
+            }
+            macroNamesCount++;
             macroContent[0] = '\0'; 
         }
         else if (inMacro && strncmp(line, MACRO_END, MACRO_END_LENGTH) == 0) 
@@ -120,14 +146,33 @@ Macro* readMacrosFromFile(const char* filename, int* macroCount, int* error)
             while (isspace(*remaining)) remaining++; 
             if (*remaining != '\0') 
 		{
-                fprintf(stderr, "Error at line %d: Invalid endmacro line '%s'\n", lineNumber, line); 
+                report(diagnostics, SEVERITY_ERROR, DIAG_INVALID_MACRO, lineNumber, 0, "Invalid endmacro line '%.*s'", (int)strcspn(line, "\r\n"), line); 
                 *error = 1; 
             }
 
             inMacro = 0;
-            macros = realloc(macros, sizeof(Macro) * (*macroCount + 1)); 
-            macros[*macroCount].name = my_strdup(macroName); 
-            macros[*macroCount].content = my_strdup(macroContent); 
+            grownMacros = realloc(macros, sizeof(Macro) * (*macroCount + 1)); 
+            if (!grownMacros)
+            {
+                report(diagnostics, SEVERITY_ERROR, DIAG_OUT_OF_MEMORY, lineNumber, 0, "Failed to reallocate memory for macros");
+                *error = 1;
+                free(macroNames);
+                free(macroContent);
+                free(lineText.data);
+                return macros;
+            }
+            macros = grownMacros;
+            macros[*macroCount].name = arena_strdup(arena, macroName); 
+            macros[*macroCount].content = arena_strdup(arena, macroContent); 
+            if (!macros[*macroCount].name || !macros[*macroCount].content)
+            {
+                report(diagnostics, SEVERITY_ERROR, DIAG_OUT_OF_MEMORY, lineNumber, 0, "Failed to allocate memory for macro content");
+                *error = 1;
+                free(macroNames);
+                free(macroContent);
+                free(lineText.data);
+                return macros;
+            }
             (*macroCount)++; 
         }
         else if (inMacro)
@@ -140,19 +185,18 @@ Macro* readMacrosFromFile(const char* filename, int* macroCount, int* error)
 
                 if (contentLen + lineLen + 1 >= contentSize)
 		 {
-                    contentSize *= 2; 
-                    macroContent = realloc(macroContent, contentSize); 
-                    if (!macroContent) {
-                        fprintf(stderr, "Error at line %d: Failed to reallocate memory for macro content\n", lineNumber); 
+                    while (contentLen + lineLen + 1 >= contentSize)
+                        contentSize *= 2; 
+                    grownContent = realloc(macroContent, contentSize); 
+                    if (!grownContent) {
+                        report(diagnostics, SEVERITY_ERROR, DIAG_OUT_OF_MEMORY, lineNumber, 0, "Failed to reallocate memory for macro content"); 
                         *error = 1; 
-                        for (i = 0; i < macroNamesCount; i++) 
-		{
-                            free(macroNames[i]);
-                        }
                         free(macroNames); 
-                        fclose(file); 
+                        free(macroContent);
+                        free(lineText.data);
                         return macros; 
                     }
+                    macroContent = grownContent;
                 }
 
                 strcat(macroContent, line);
@@ -160,13 +204,9 @@ Macro* readMacrosFromFile(const char* filename, int* macroCount, int* error)
         }
     }
 
-    /* Clean up */
-    for (i = 0; i < macroNamesCount; i++) 
-	{
-        free(macroNames[i]);
-    }
+    /* Clean up; the names themselves live in the arena */
+    free(lineText.data);
     free(macroNames);
     free(macroContent);
-    fclose(file);
     return macros;
 }
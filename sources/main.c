@@ -1,124 +1,1181 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <limits.h>
+#include <stdarg.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "assembler.h"
 #include "check.h"
+#include "prefetch.h"
+#include "server.h"
+#include "watch.h"
 
 #define MAX_FILENAME_LENGTH 260
+#define MAX_LOG_LINE (3 * MAX_FILENAME_LENGTH)
 #define MIN_ARGUMENTS 2
+#define OPTION_PREFIX "--"
+#define OPTION_ONE_PASS "--one-pass"
+#define OPTION_DIAGNOSTICS_TEXT "--diagnostics=text"
+#define OPTION_DIAGNOSTICS_JSON "--diagnostics=json"
+#define OPTION_MAX_ERRORS "--max-errors"
+#define OPTION_FAIL_FAST "--fail-fast"
+#define OPTION_JOBS "-j"
+#define OPTION_QUIET "--quiet"
+#define OPTION_SUMMARY_JSON "--summary=json"
+#define OPTION_FILES_FROM "--files-from"
+#define OPTION_SKIP_UNCHANGED "--skip-unchanged"
+#define OPTION_SERVE "--serve="
+#define OPTION_CONNECT "--connect="
+#define OPTION_WATCH "--watch"
+#define OPTION_PREFETCH "--prefetch"
+#define STDIN_NAME "-"
+#define EXTENSION_ROOM 4        /* Longest extension added to a file name, ".ent" */
+#define INITIAL_JOB_CAPACITY 16
+#define DEFAULT_PREFETCH_DEPTH 4
+#define WRITES_PER_PREFETCH 4   /* Queued output files per prefetched source */
 
+/* The stages of one file; each runs as a separate task */
+typedef enum {
+    STAGE_PREPROCESS,           /* Read and expand the macros */
+    STAGE_FIRST_PASS,           /* Build the symbol table and record statements */
+    STAGE_SECOND_PASS,          /* Encode and write the output files */
+    STAGE_DONE
+} Stage;
 
-/* Main function: Entry point of the assembler program */
-int main(int argc, char *argv[])
-{
+/* One input file of the batch, with the data passed between its stages */
+typedef struct {
     char *filename;
-    char filenameWithExtension[MAX_FILENAME_LENGTH];
+    int index;                  /* Position on the command line */
+    long size;                  /* Size of the .as file, used to start big files first */
+    Stage stage;                /* The next stage to run */
+    int quiet;                  /* Drop the progress messages */
     char outputFilename[MAX_FILENAME_LENGTH];
-    char obFilename[MAX_FILENAME_LENGTH];
-    char entFilename[MAX_FILENAME_LENGTH];
-    char extFilename[MAX_FILENAME_LENGTH];
-    int macroCount;
-    int error;
     Macro *macros;
+    int macroCount;
+    SourceBuffer expanded;
     AssemblerState *state;
-    int i;
-    FILE *file_content;
+    TextBuffer log;             /* Progress messages, written to stdout */
+    Diagnostics diagnostics;    /* Written to stderr after the log */
+    OutputStats output;         /* Output files written and left unchanged */
+    int result;                 /* 0 on success, 1 if the file failed, 2 if the run must stop */
+    int done;
+    double stage_seconds[STAGE_DONE];
+    int expanded_written;       /* Whether the .am file was kept */
+    int ic;                     /* Code words, or -1 if the first pass did not finish */
+    int dc;                     /* Data words, or -1 if the first pass did not finish */
+    int has_entries;
+    int has_externs;
+    size_t arena_bytes;         /* Bytes taken from the state's arena */
+    size_t arena_allocations;   /* Allocations taken from the state's arena */
+} FileJob;
 
-    /* Check if enough arguments are provided */
-    if (argc < MIN_ARGUMENTS)
+/* A worker's double-ended queue of job indices. The owner pushes and pops
+   at the bottom, so it keeps working on the file it just advanced; other
+   workers steal from the top. */
+typedef struct {
+    int *tasks;
+    int top;
+    int bottom;
+    pthread_mutex_t lock;
+} TaskDeque;
+
+/* The batch shared by the worker threads */
+typedef struct {
+    FileJob *jobs;
+    int job_count;
+    int job_capacity;
+    AssemblerState **spare_states; /* Finished states, reset and reused by later files */
+    int spare_count;
+    int spare_capacity;
+    TaskDeque *deques;
+    int worker_count;
+    int stop_index;             /* Files after this one are not assembled */
+    int single_pass;
+    int chunk_threads;          /* Threads the first pass and .ob rendering of one file may use */
+    int fail_fast;
+    int summary;                /* Emit a JSON record per file on stdout */
+    int *order;                 /* Job indices, biggest file first in a parallel run */
+    Prefetcher *prefetcher;     /* Reads the sources ahead, or NULL */
+    pthread_mutex_t lock;
+    pthread_cond_t finished;    /* Signalled whenever a job is done */
+} JobQueue;
+
+/* A worker thread and the queue it belongs to */
+typedef struct {
+    JobQueue *queue;
+    int id;
+} Worker;
+
+/* Appends a formatted progress message to a file's log, unless it is quiet */
+static void log_printf(FileJob *job, const char *format, ...)
+{
+    char line[MAX_LOG_LINE];
+    va_list args;
+    int length;
+
+    if (job->quiet)
     {
-        fprintf(stderr, "Error: Not enough arguments, please insert file names.\n");
+        return;
+    }
+    va_start(args, format);
+    length = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (length < 0)
+    {
+        return;
+    }
+    if ((size_t)length >= sizeof(line))
+    {
+        length = (int)sizeof(line) - 1;
+    }
+    text_buffer_append(&job->log, line, (size_t)length);
+}
+
+/* Returns a monotonic time in seconds */
+static double now_seconds(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+/* Takes a spare assembler state, or creates one if there is none */
+static AssemblerState *acquire_state(JobQueue *queue)
+{
+    AssemblerState *state = NULL;
+
+    pthread_mutex_lock(&queue->lock);
+    if (queue->spare_count > 0)
+    {
+        state = queue->spare_states[--queue->spare_count];
+    }
+    pthread_mutex_unlock(&queue->lock);
+
+    if (!state)
+    {
+        return init_assembler_state();
+    }
+    reset_assembler_state(state);
+    return state;
+}
+
+/* Keeps a finished assembler state for a later file, or frees it if enough are kept */
+static void release_state(JobQueue *queue, AssemblerState *state)
+{
+    if (!state)
+    {
+        return;
+    }
+    pthread_mutex_lock(&queue->lock);
+    if (queue->spare_count < queue->spare_capacity)
+    {
+        queue->spare_states[queue->spare_count++] = state;
+        state = NULL;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    free_assembler_state(state);
+}
+
+/* Releases whatever a job still holds between stages */
+static void release_job(JobQueue *queue, FileJob *job)
+{
+    freeMacros(job->macros, job->macroCount);
+    job->macros = NULL;
+    job->macroCount = 0;
+    source_close(&job->expanded);
+    release_state(queue, job->state);
+    job->state = NULL;
+}
+
+/* Reads and expands the macros of a file */
+static int stage_preprocess(JobQueue *queue, FileJob *job)
+{
+    char filenameWithExtension[MAX_FILENAME_LENGTH];
+    SourceBuffer source;
+    int error = 0;
+
+    /* Add .as extension to the input filename */
+    addExtension(job->filename, ".as", filenameWithExtension);
+    diagnostics_set_file(&job->diagnostics, filenameWithExtension);
+
+    /* Load the input file once, or take it from the prefetcher; every stage works from this buffer */
+    error = queue->prefetcher ? prefetcher_take(queue->prefetcher, job->index, &source) : source_open(&source, filenameWithExtension);
+    if (error != 0)
+    {
+        report(&job->diagnostics, SEVERITY_ERROR, DIAG_IO, 0, 0, "Cannot read %s: %s", filenameWithExtension, strerror(errno));
         return 1;
     }
 
-    /* Process each input file */
-    for (i = 1; i < argc; ++i)
+    /* Add .am extension to the output filename */
+    addExtension(job->filename, ".am", job->outputFilename);
+
+    /* The state is taken now because its arena holds the macros */
+    log_printf(job, "Initializing assembler state for file: %s\n", job->outputFilename);
+    job->state = acquire_state(queue);
+    if (!job->state)
+    {
+        report(&job->diagnostics, SEVERITY_ERROR, DIAG_OUT_OF_MEMORY, 0, 0, "Failed to initialize assembler state");
+        source_close(&source);
+        return 2;
+    }
+    job->state->single_pass = queue->single_pass;
+    job->state->chunk_threads = queue->chunk_threads;
+    job->state->diagnostics = &job->diagnostics;
+    job->state->output = &job->output;
+
+    /* Read macros from the input file */
+    log_printf(job, "Reading macros from file: %s\n", filenameWithExtension);
+    job->macros = readMacrosFromSource(&source, &job->macroCount, &error, &job->diagnostics, &job->state->arena);
+    if (error == 1)
+    {
+        report(&job->diagnostics, SEVERITY_NOTE, DIAG_STAGE_FAILED, 0, 0, "Failed to read macros; check the macro definitions");
+        source_close(&source);
+        return 1;
+    }
+
+    /* Expand macros in the input file */
+    log_printf(job, "Expanding macros in file: %s\n", filenameWithExtension);
+    expandMacrosInSource(&source, job->outputFilename, job->macros, job->macroCount, &job->expanded, &error, &job->diagnostics, &job->output);
+    source_close(&source);
+    if (error == 1)
+    {
+        report(&job->diagnostics, SEVERITY_NOTE, DIAG_STAGE_FAILED, 0, 0, "Failed to expand macros; check the macro usage");
+        remove(job->outputFilename);
+        return 1;
+    }
+    log_printf(job, "Macros expanded successfully in file: %s\n", job->outputFilename);
+    job->expanded_written = 1;
+    return 0;
+}
+
+/* Runs the first pass over the expanded source */
+static int stage_first_pass(FileJob *job)
+{
+    int error = 0;
+
+    /* From here on, line numbers refer to the expanded file */
+    diagnostics_set_file(&job->diagnostics, job->outputFilename);
+
+    /* Run first pass; the macros and the expanded source are not needed after it */
+    log_printf(job, "Running first pass on file: %s\n", job->outputFilename);
+    first_pass(job->state, &job->expanded, job->macros, &job->macroCount, &error);
+    freeMacros(job->macros, job->macroCount);
+    job->macros = NULL;
+    job->macroCount = 0;
+    source_close(&job->expanded);
+    if (error == 1)
+    {
+        report(&job->diagnostics, SEVERITY_NOTE, DIAG_STAGE_FAILED, 0, 0, "First pass failed; no output files were written");
+        return 1;
+    }
+    job->ic = job->state->IC - MEMORY_START;
+    job->dc = job->state->DC;
+    return 0;
+}
+
+/* Encodes the program and writes the output files */
+static int stage_second_pass(FileJob *job)
+{
+    char obFilename[MAX_FILENAME_LENGTH];
+    int error = 0;
+
+    /* Update entry addresses */
+    log_printf(job, "Updating entry addresses...\n");
+    update_entry_addresses(job->state);
+
+    /* Run second pass */
+    addExtension(job->filename, ".ob", obFilename);
+    log_printf(job, "Running second pass on input file: %s, output file: %s\n", job->outputFilename, obFilename);
+    second_pass(job->state, job->outputFilename, obFilename, &error);
+    if (error == 1)
+    {
+        report(&job->diagnostics, SEVERITY_NOTE, DIAG_STAGE_FAILED, 0, 0, "Second pass failed; no output files were written");
+        remove(obFilename);
+        return 1;
+    }
+
+    log_printf(job, "Assembler process finished successfully for file: %s\n", job->filename);
+    job->has_entries = job->state->entry_count > 0;
+    job->has_externs = job->state->extern_count > 0;
+    return 0;
+}
+
+/* Runs the next stage of a job; returns 1 once the job is finished */
+static int run_stage(JobQueue *queue, FileJob *job)
+{
+    double start = now_seconds();
+    int result;
+
+    switch (job->stage)
+    {
+    case STAGE_PREPROCESS:
+        result = stage_preprocess(queue, job);
+        break;
+    case STAGE_FIRST_PASS:
+        result = stage_first_pass(job);
+        break;
+    case STAGE_SECOND_PASS:
+        result = stage_second_pass(job);
+        break;
+    default:
+        result = 0;
+        break;
+    }
+
+    job->stage_seconds[job->stage] = now_seconds() - start;
+    job->stage++;
+    if (result == 0 && job->stage != STAGE_DONE)
+    {
+        return 0;
+    }
+    job->result = result;
+    if (job->state)
     {
-        filename = argv[i];
-        macroCount = 0;
-        error = 0;
+        job->arena_bytes = job->state->arena.bytes;
+        job->arena_allocations = job->state->arena.allocations;
+    }
+    release_job(queue, job);
+    return 1;
+}
 
-        /* Add .as extension to the input filename */
-        addExtension(filename, ".as", filenameWithExtension);
+/* Tells whether a finished job stops the rest of the batch */
+static int job_stops_batch(const JobQueue *queue, const FileJob *job)
+{
+    return job->result == 2 || (job->result != 0 && queue->fail_fast);
+}
+
+/* Appends an output file to a summary record, or null if it was not written */
+static int append_output(TextBuffer *record, const char *key, const FileJob *job, const char *extension, int written)
+{
+    char filename[MAX_FILENAME_LENGTH];
+    int error = 0;
 
-        /* Check if the input file exists */
-        file_content = fopen(filenameWithExtension, "r");
-        if (!file_content)
+    error |= text_buffer_append(record, key, strlen(key));
+    if (!written)
+    {
+        return error | text_buffer_append(record, "null", 4);
+    }
+    addExtension(job->filename, extension, filename);
+    return error | text_buffer_append_json(record, filename);
+}
+
+/* Appends the JSON summary record of a finished job to its log */
+static void append_summary(FileJob *job)
+{
+    static const char *status_names[] = {"ok", "failed", "aborted"};
+    static const char *stage_names[STAGE_DONE] = {"preprocess", "first_pass", "second_pass"};
+    char filename[MAX_FILENAME_LENGTH];
+    char number[64];
+    TextBuffer *record = &job->log;
+    double total = 0;
+    int succeeded = job->result == 0;
+    int error = 0;
+    int i;
+
+    addExtension(job->filename, ".as", filename);
+    error |= text_buffer_append(record, "{\"file\":", 8);
+    error |= text_buffer_append_json(record, filename);
+    error |= text_buffer_append(record, ",\"status\":\"", 11);
+    error |= text_buffer_append(record, status_names[job->result], strlen(status_names[job->result]));
+    if (job->ic >= 0)
+        sprintf(number, "\",\"ic\":%d,\"dc\":%d", job->ic, job->dc);
+    else
+        strcpy(number, "\",\"ic\":null,\"dc\":null");
+    error |= text_buffer_append(record, number, strlen(number));
+    sprintf(number, ",\"errors\":%d,\"warnings\":%d", job->diagnostics.error_count, job->diagnostics.warning_count);
+    error |= text_buffer_append(record, number, strlen(number));
+
+    error |= append_output(record, ",\"outputs\":{\"am\":", job, ".am", job->expanded_written);
+    error |= append_output(record, ",\"ob\":", job, ".ob", succeeded);
+    error |= append_output(record, ",\"ent\":", job, ".ent", succeeded && job->has_entries);
+    error |= append_output(record, ",\"ext\":", job, ".ext", succeeded && job->has_externs);
+    sprintf(number, "},\"unchanged\":%d", job->output.unchanged);
+    error |= text_buffer_append(record, number, strlen(number));
+
+    sprintf(number, ",\"arena\":{\"bytes\":%lu,\"allocations\":%lu", (unsigned long)job->arena_bytes, (unsigned long)job->arena_allocations);
+    error |= text_buffer_append(record, number, strlen(number));
+    error |= text_buffer_append(record, "},\"time_ms\":{", 13);
+    for (i = 0; i < STAGE_DONE; i++)
+    {
+        sprintf(number, "\"%s\":%.3f,", stage_names[i], job->stage_seconds[i] * 1000.0);
+        error |= text_buffer_append(record, number, strlen(number));
+        total += job->stage_seconds[i];
+    }
+    sprintf(number, "\"total\":%.3f}}\n", total * 1000.0);
+    error |= text_buffer_append(record, number, strlen(number));
+    (void)error; /* A truncated record is still written; memory is all that ran out */
+}
+
+/* Waits for a job's queued output files. If one could not be written,
+   the job fails like a synchronous write would have failed it: the
+   .ob, .ent and .ext files are removed, and the .am file too if it was
+   the one that failed. */
+static void finish_writes(FileJob *job)
+{
+    static const char *extensions[] = {".ob", ".ent", ".ext"};
+    char filename[MAX_FILENAME_LENGTH];
+    size_t i;
+
+    if (output_wait(&job->output) == 0)
+    {
+        return;
+    }
+    report(&job->diagnostics, SEVERITY_ERROR, DIAG_IO, 0, 0, "Cannot write %s: %s", job->output.failed_file, strerror(job->output.failed_errno));
+    report(&job->diagnostics, SEVERITY_NOTE, DIAG_STAGE_FAILED, 0, 0, "Writing the output files failed; no output files were written");
+    for (i = 0; i < sizeof(extensions) / sizeof(extensions[0]); i++)
+    {
+        addExtension(job->filename, extensions[i], filename);
+        remove(filename);
+    }
+    addExtension(job->filename, ".am", filename);
+    if (strcmp(job->output.failed_file, filename) == 0)
+    {
+        remove(filename);
+        job->expanded_written = 0;
+    }
+    if (job->result == 0)
+    {
+        job->result = 1;
+    }
+}
+
+/* Writes a finished job's log, summary and diagnostics, then releases them */
+static void emit_job(const JobQueue *queue, FileJob *job)
+{
+    finish_writes(job);
+    if (queue->summary)
+    {
+        append_summary(job);
+    }
+    if (job->log.length > 0)
+    {
+        fwrite(job->log.data, 1, job->log.length, stdout);
+    }
+    fflush(stdout);
+    diagnostics_flush(&job->diagnostics, stderr);
+    free(job->log.data);
+    job->log.data = NULL;
+    job->log.length = 0;
+    job->log.capacity = 0;
+    diagnostics_free(&job->diagnostics);
+}
+
+/* Pushes a task at the bottom of a deque */
+static void deque_push(TaskDeque *deque, int task)
+{
+    pthread_mutex_lock(&deque->lock);
+    deque->tasks[deque->bottom++] = task;
+    pthread_mutex_unlock(&deque->lock);
+}
+
+/* Pops the task at the bottom of a deque; returns -1 if it is empty */
+static int deque_pop(TaskDeque *deque)
+{
+    int task = -1;
+
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom > deque->top)
+    {
+        task = deque->tasks[--deque->bottom];
+    }
+    if (deque->bottom == deque->top)
+    {
+        deque->top = 0;
+        deque->bottom = 0;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return task;
+}
+
+/* Takes the task at the top of a deque; returns -1 if it is empty */
+static int deque_steal(TaskDeque *deque)
+{
+    int task = -1;
+
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom > deque->top)
+    {
+        task = deque->tasks[deque->top++];
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return task;
+}
+
+/* Finds the next task of a worker: its own first, then one stolen from the others */
+static int next_task(JobQueue *queue, int id)
+{
+    int task = deque_pop(&queue->deques[id]);
+    int i;
+
+    for (i = 1; task == -1 && i < queue->worker_count; i++)
+    {
+        task = deque_steal(&queue->deques[(id + i) % queue->worker_count]);
+    }
+    return task;
+}
+
+/* Worker thread: runs stage tasks until no deque has work left.
+   Tasks are only created by the worker that ran the previous stage,
+   so once every deque is empty no more work can appear. */
+static void *worker_main(void *arg)
+{
+    Worker *worker = arg;
+    JobQueue *queue = worker->queue;
+    FileJob *job;
+    int skip;
+    int task;
+
+    while ((task = next_task(queue, worker->id)) != -1)
+    {
+        job = &queue->jobs[task];
+
+        pthread_mutex_lock(&queue->lock);
+        skip = job->index > queue->stop_index;
+        pthread_mutex_unlock(&queue->lock);
+        if (skip)
         {
-            fprintf(stderr, "Error: Failed to read file %s. Make sure the file exists and you have the necessary permissions.\n", filenameWithExtension);
+            release_job(queue, job);
             continue;
         }
-        fclose(file_content);
-
-        /* Add .am extension to the output filename */
-        addExtension(filename, ".am", outputFilename);
 
-        /* Read macros from the input file */
-        printf("Reading macros from file: %s\n", filenameWithExtension);
-        macros = readMacrosFromFile(filenameWithExtension, &macroCount, &error);
-        if (error == 1)
+        if (!run_stage(queue, job))
         {
-            fprintf(stderr, "Error: Failed to read macros from file %s. Check the file for syntax errors in macro definitions.\n", filenameWithExtension);
-            freeMacros(macros, macroCount);
+            deque_push(&queue->deques[worker->id], task);
             continue;
         }
 
-        /* Expand macros in the input file */
-        printf("Expanding macros in file: %s\n", filenameWithExtension);
-        expandMacrosInFile(filenameWithExtension, outputFilename, macros, macroCount, &error);
-        if (error == 1)
+        pthread_mutex_lock(&queue->lock);
+        job->done = 1;
+        if (job_stops_batch(queue, job) && job->index < queue->stop_index)
         {
-            fprintf(stderr, "Error: Failed to expand macros in file %s. Check the file for invalid macro usage.\n", filenameWithExtension);
-            freeMacros(macros, macroCount);
-            remove(outputFilename);
-            continue;
+            queue->stop_index = job->index;
         }
-        freeMacros(macros, macroCount);
-        printf("Macros expanded successfully in file: %s\n", outputFilename);
+        pthread_cond_broadcast(&queue->finished);
+        pthread_mutex_unlock(&queue->lock);
+    }
+    return NULL;
+}
+
+/* Emits the finished jobs from *emitted up to limit, in order. Unless wait
+   is set, it stops at the first job whose output files are still being
+   written. Returns 1 if an emitted job stops the batch. */
+static int emit_finished(const JobQueue *queue, int *emitted, int limit, int wait)
+{
+    FileJob *job;
 
-        /* Initialize assembler state */
-        printf("Initializing assembler state for file: %s\n", outputFilename);
-        state = init_assembler_state();
-        if (!state)
+    while (*emitted < limit)
+    {
+        job = &queue->jobs[*emitted];
+        if (!wait && !output_done(&job->output))
+        {
+            return 0;
+        }
+        emit_job(queue, job);
+        (*emitted)++;
+        if (job_stops_batch(queue, job))
         {
-            fprintf(stderr, "Error: Failed to initialize assembler state. This might be due to memory allocation issues.\n");
             return 1;
         }
+    }
+    return 0;
+}
+
+/* Assembles the jobs one after another; returns 1 if the batch was stopped.
+   A file is emitted once its output files are on disk, so the next file is
+   assembled while the writer thread is still busy with the previous one;
+   a file that can stop the batch is waited for before going on. */
+static int run_sequential(JobQueue *queue)
+{
+    FileJob *job;
+    int emitted = 0;
+    int i;
 
-        /* Run first pass */
-        printf("Running first pass on file: %s\n", outputFilename);
-        first_pass(state, outputFilename, macros, &macroCount, &error);
-        if (error == 1)
+    for (i = 0; i < queue->job_count; i++)
+    {
+        job = &queue->jobs[i];
+        while (!job->done)
         {
-            fprintf(stderr, "Error: First pass failed for file %s. Check the file for syntax errors or invalid instructions.\n", outputFilename);
-            free_assembler_state(state);
-            continue;
+            job->done = run_stage(queue, job);
+        }
+        if (emit_finished(queue, &emitted, i + 1, queue->fail_fast || job_stops_batch(queue, job)))
+        {
+            return 1;
         }
+    }
+    return emit_finished(queue, &emitted, queue->job_count, 1);
+}
+
+/* Orders jobs by decreasing file size, then by position */
+static int compare_job_size(const void *a, const void *b)
+{
+    const FileJob *x = *(FileJob *const *)a;
+    const FileJob *y = *(FileJob *const *)b;
 
-        /* Update entry addresses */
-        printf("Updating entry addresses...\n");
-        update_entry_addresses(state);
+    if (x->size != y->size)
+        return x->size > y->size ? -1 : 1;
+    return x->index - y->index;
+}
 
-        /* Create output filenames */
-        addExtension(filename, ".ob", obFilename);
-        entFilename[0] = '\0';
-        extFilename[0] = '\0';
+/* Sets the order the files are started in: biggest first when by_size is
+   set, so a huge file starts right away instead of when its turn on the
+   command line comes, and input order otherwise. Returns 0 on success. */
+static int order_jobs(JobQueue *queue, int by_size)
+{
+    char filenameWithExtension[MAX_FILENAME_LENGTH];
+    struct stat info;
+    FileJob **sorted;
+    int i;
 
-        /* Run second pass */
-        printf("Running second pass on input file: %s, output file: %s\n", outputFilename, obFilename);
-        second_pass(state, outputFilename, obFilename, &error);
-        if (error == 1)
+    queue->order = malloc((queue->job_count > 0 ? queue->job_count : 1) * sizeof(int));
+    sorted = malloc((queue->job_count > 0 ? queue->job_count : 1) * sizeof(FileJob *));
+    if (!queue->order || !sorted)
+    {
+        free(queue->order);
+        free(sorted);
+        queue->order = NULL;
+        return 1;
+    }
+    for (i = 0; i < queue->job_count; i++)
+    {
+        if (by_size)
         {
-            fprintf(stderr, "Error: Second pass failed for file %s. This might be due to unresolved symbols or other assembly errors.\n", outputFilename);
-            remove(obFilename);
-            remove(entFilename);
-            remove(extFilename);
-            free_assembler_state(state);
-            continue;
+            addExtension(queue->jobs[i].filename, ".as", filenameWithExtension);
+            queue->jobs[i].size = stat(filenameWithExtension, &info) == 0 ? (long)info.st_size : 0;
         }
+        sorted[i] = &queue->jobs[i];
+    }
+    if (by_size)
+    {
+        qsort(sorted, (size_t)queue->job_count, sizeof(FileJob *), compare_job_size);
+    }
+    for (i = 0; i < queue->job_count; i++)
+    {
+        queue->order[i] = sorted[i]->index;
+    }
+    free(sorted);
+    return 0;
+}
 
-        /* Clean up and finish */
-        free_assembler_state(state);
-        state = NULL;
-        printf("Assembler process finished successfully for file: %s\n", filename);
+/* Deals the files to the workers' deques in the order set by order_jobs */
+static int seed_deques(JobQueue *queue)
+{
+    TaskDeque *deque;
+    int i;
+
+    if (!queue->order)
+    {
+        return 1;
     }
 
+    /* The owner pops from the bottom, so each deque gets its biggest file last */
+    for (i = queue->job_count - 1; i >= 0; i--)
+    {
+        deque = &queue->deques[i % queue->worker_count];
+        deque->tasks[deque->bottom++] = queue->order[i];
+    }
+    return 0;
+}
+
+/* Assembles the jobs as stage tasks on a work-stealing pool and emits
+   them in input order, so the output is the same as in a sequential run.
+   Returns 1 if the batch was stopped. */
+static int run_parallel(JobQueue *queue, int thread_count)
+{
+    pthread_t *threads;
+    Worker *workers;
+    FileJob *job;
+    int started = 0;
+    int stopped = 0;
+    int i;
+
+    threads = malloc(thread_count * sizeof(pthread_t));
+    workers = malloc(thread_count * sizeof(Worker));
+    queue->deques = calloc(thread_count, sizeof(TaskDeque));
+    queue->worker_count = thread_count;
+    for (i = 0; queue->deques != NULL && i < thread_count; i++)
+    {
+        queue->deques[i].tasks = malloc(queue->job_count * sizeof(int));
+        if (!queue->deques[i].tasks)
+        {
+            break;
+        }
+        pthread_mutex_init(&queue->deques[i].lock, NULL);
+    }
+    if (!threads || !workers || !queue->deques || i < thread_count || seed_deques(queue) != 0)
+    {
+        thread_count = i;
+        stopped = -1;
+    }
+
+    for (started = 0; stopped == 0 && started < thread_count; started++)
+    {
+        workers[started].queue = queue;
+        workers[started].id = started;
+        if (pthread_create(&threads[started], NULL, worker_main, &workers[started]) != 0)
+        {
+            break;
+        }
+    }
+
+    /* Without any worker, the deques are drained by the sequential path */
+    if (stopped != 0 || started == 0)
+    {
+        stopped = run_sequential(queue);
+    }
+    else
+    {
+        /* Tasks left in a deque whose worker failed to start are stolen by the others */
+        for (i = 0; i < queue->job_count && !stopped; i++)
+        {
+            job = &queue->jobs[i];
+            pthread_mutex_lock(&queue->lock);
+            while (!job->done)
+            {
+                pthread_cond_wait(&queue->finished, &queue->lock);
+            }
+            pthread_mutex_unlock(&queue->lock);
+
+            emit_job(queue, job);
+            stopped = job_stops_batch(queue, job);
+        }
+        for (i = 0; i < started; i++)
+        {
+            pthread_join(threads[i], NULL);
+        }
+    }
+
+    for (i = 0; i < thread_count; i++)
+    {
+        pthread_mutex_destroy(&queue->deques[i].lock);
+        free(queue->deques[i].tasks);
+    }
+    free(queue->deques);
+    free(workers);
+    free(threads);
+    return stopped;
+}
+
+/* Adds an input file to the batch; returns 0 on success */
+static int add_job(JobQueue *queue, char *filename)
+{
+    FileJob *jobs;
+    int capacity;
+
+    if (strlen(filename) + EXTENSION_ROOM >= MAX_FILENAME_LENGTH)
+    {
+        fprintf(stderr, "Error: File name too long: %s\n", filename);
+        return 1;
+    }
+    if (queue->job_count == queue->job_capacity)
+    {
+        capacity = queue->job_capacity > 0 ? queue->job_capacity * 2 : INITIAL_JOB_CAPACITY;
+        jobs = realloc(queue->jobs, capacity * sizeof(FileJob));
+        if (!jobs)
+        {
+            perror("Failed to allocate memory for the file list");
+            return 1;
+        }
+        queue->jobs = jobs;
+        queue->job_capacity = capacity;
+    }
+    memset(&queue->jobs[queue->job_count], 0, sizeof(FileJob));
+    queue->jobs[queue->job_count].filename = filename;
+    queue->jobs[queue->job_count].index = queue->job_count;
+    queue->job_count++;
     return 0;
 }
+
+/* Adds the files listed in a manifest, one name per line; blank lines and
+   lines starting with '#' are skipped. The names are kept in names, which
+   must outlive the batch. Returns 0 on success. */
+static int read_manifest(JobQueue *queue, const char *path, TextBuffer *names)
+{
+    SourceBuffer manifest;
+    char *line;
+    char *end;
+    char *next;
+    int result;
+
+    result = strcmp(path, STDIN_NAME) == 0 ? source_read_stdin(&manifest) : source_open(&manifest, path);
+    if (result != 0)
+    {
+        fprintf(stderr, "Error: Cannot read file list %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    /* Copy the manifest once and cut it into names in place */
+    result = text_buffer_append(names, manifest.data, manifest.length);
+    source_close(&manifest);
+    if (result != 0)
+    {
+        perror("Failed to allocate memory for the file list");
+        return 1;
+    }
+
+    for (line = names->data; line != NULL && line < names->data + names->length; line = next)
+    {
+        end = memchr(line, '\n', (size_t)(names->data + names->length - line));
+        if (!end)
+        {
+            end = names->data + names->length;
+        }
+        next = end + 1;
+        *end = '\0';
+        while (end > line && isspace((unsigned char)end[-1]))
+        {
+            *--end = '\0';
+        }
+        while (isspace((unsigned char)*line))
+        {
+            line++;
+        }
+        if (*line == '\0' || *line == '#')
+        {
+            continue;
+        }
+        if (add_job(queue, line) != 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Parses a non-negative count; returns 0 on success */
+static int parse_count(const char *text, int *count)
+{
+    char *end;
+    long value;
+
+    errno = 0;
+    value = strtol(text, &end, 10);
+    if (end == text || *end != '\0' || errno != 0 || value < 0 || value > INT_MAX)
+    {
+        return 1;
+    }
+    *count = (int)value;
+    return 0;
+}
+
+/* Returns the number of online processors, at least 1 */
+static int processor_count(void)
+{
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return count > 0 && count <= INT_MAX ? (int)count : 1;
+}
+
+/* Main function: Entry point of the assembler program */
+int main(int argc, char *argv[])
+{
+    JobQueue queue;
+    DiagnosticsFormat format = DIAGNOSTICS_TEXT;
+    TextBuffer names = {NULL, 0, 0};
+    ClientOptions client;
+    Prefetcher prefetcher;
+    OutputWriter *writer = NULL;
+    char **client_names;
+    char **source_names = NULL;
+    const char *manifest = NULL;
+    const char *serve_path = NULL;
+    const char *connect_path = NULL;
+    const char *count_text;
+    const char *count_option;
+    int *count_target;
+    int single_pass = 0;
+    int fail_fast = 0;
+    int quiet = 0;
+    int skip_unchanged = 0;
+    int watch = 0;
+    int unchanged = 0;
+    int max_errors = 0;
+    int prefetch = DEFAULT_PREFETCH_DEPTH;
+    int jobs = 1;
+    int stopped = 1;
+    int i;
+
+    /* Check if enough arguments are provided */
+    if (argc < MIN_ARGUMENTS)
+    {
+        fprintf(stderr, "Error: Not enough arguments, please insert file names.\n");
+        return 1;
+    }
+
+    memset(&queue, 0, sizeof(queue));
+
+    /* Read options; everything else is an input file */
+    for (i = 1; i < argc; ++i)
+    {
+        count_text = NULL;
+        count_option = NULL;
+        count_target = NULL;
+        if (strcmp(argv[i], OPTION_ONE_PASS) == 0)
+        {
+            single_pass = 1;
+        }
+        else if (strcmp(argv[i], OPTION_DIAGNOSTICS_TEXT) == 0)
+        {
+            format = DIAGNOSTICS_TEXT;
+        }
+        else if (strcmp(argv[i], OPTION_DIAGNOSTICS_JSON) == 0)
+        {
+            format = DIAGNOSTICS_JSON;
+        }
+        else if (strcmp(argv[i], OPTION_FAIL_FAST) == 0)
+        {
+            fail_fast = 1;
+        }
+        else if (strcmp(argv[i], OPTION_QUIET) == 0)
+        {
+            quiet = 1;
+        }
+        else if (strcmp(argv[i], OPTION_SKIP_UNCHANGED) == 0)
+        {
+            skip_unchanged = 1;
+        }
+        else if (strcmp(argv[i], OPTION_WATCH) == 0)
+        {
+            watch = 1;
+        }
+        else if (strcmp(argv[i], OPTION_SUMMARY_JSON) == 0)
+        {
+            queue.summary = 1;
+        }
+        else if (strcmp(argv[i], OPTION_MAX_ERRORS) == 0)
+        {
+            count_option = OPTION_MAX_ERRORS;
+            count_target = &max_errors;
+            count_text = i + 1 < argc ? argv[++i] : "";
+        }
+        else if (strncmp(argv[i], OPTION_MAX_ERRORS "=", strlen(OPTION_MAX_ERRORS) + 1) == 0)
+        {
+            count_option = OPTION_MAX_ERRORS;
+            count_target = &max_errors;
+            count_text = argv[i] + strlen(OPTION_MAX_ERRORS) + 1;
+        }
+        else if (strcmp(argv[i], OPTION_PREFETCH) == 0)
+        {
+            count_option = OPTION_PREFETCH;
+            count_target = &prefetch;
+            count_text = i + 1 < argc ? argv[++i] : "";
+        }
+        else if (strncmp(argv[i], OPTION_PREFETCH "=", strlen(OPTION_PREFETCH) + 1) == 0)
+        {
+            count_option = OPTION_PREFETCH;
+            count_target = &prefetch;
+            count_text = argv[i] + strlen(OPTION_PREFETCH) + 1;
+        }
+        else if (strcmp(argv[i], OPTION_JOBS) == 0)
+        {
+            count_option = OPTION_JOBS;
+            count_target = &jobs;
+            count_text = i + 1 < argc ? argv[++i] : "";
+        }
+        else if (strncmp(argv[i], OPTION_JOBS, strlen(OPTION_JOBS)) == 0)
+        {
+            count_option = OPTION_JOBS;
+            count_target = &jobs;
+            count_text = argv[i] + strlen(OPTION_JOBS);
+        }
+        else if (strcmp(argv[i], OPTION_FILES_FROM) == 0 && i + 1 < argc && manifest == NULL)
+        {
+            manifest = argv[++i];
+        }
+        else if (strncmp(argv[i], OPTION_FILES_FROM "=", strlen(OPTION_FILES_FROM) + 1) == 0 && manifest == NULL)
+        {
+            manifest = argv[i] + strlen(OPTION_FILES_FROM) + 1;
+        }
+        else if (strncmp(argv[i], OPTION_SERVE, strlen(OPTION_SERVE)) == 0 && serve_path == NULL)
+        {
+            serve_path = argv[i] + strlen(OPTION_SERVE);
+        }
+        else if (strncmp(argv[i], OPTION_CONNECT, strlen(OPTION_CONNECT)) == 0 && connect_path == NULL)
+        {
+            connect_path = argv[i] + strlen(OPTION_CONNECT);
+        }
+        else if (argv[i][0] == '-')
+        {
+            fprintf(stderr, "Error: Unknown or repeated option %s.\n", argv[i]);
+            goto cleanup;
+        }
+        else if (add_job(&queue, argv[i]) != 0)
+        {
+            goto cleanup;
+        }
+
+        if (count_text != NULL && parse_count(count_text, count_target) != 0)
+        {
+            fprintf(stderr, "Error: %s expects a non-negative number, got '%s'.\n", count_option, count_text);
+            goto cleanup;
+        }
+    }
+
+    /* Files named in the manifest come after the ones on the command line */
+    if (manifest != NULL && read_manifest(&queue, manifest, &names) != 0)
+    {
+        goto cleanup;
+    }
+
+    /* -j 0 uses one thread per processor */
+    if (jobs == 0)
+    {
+        jobs = processor_count();
+    }
+
+    /* Server mode: -j is the number of connections served at once */
+    if (serve_path != NULL)
+    {
+        if (queue.job_count > 0 || connect_path != NULL || watch)
+        {
+            fprintf(stderr, "Error: %s takes no input files or other modes.\n", OPTION_SERVE "PATH");
+            goto cleanup;
+        }
+        stopped = server_run(serve_path, jobs);
+        goto cleanup;
+    }
+
+    /* Client and watch modes: the files are assembled through the result cache,
+       by a running server or by this process */
+    if (connect_path != NULL || watch)
+    {
+        if (connect_path != NULL && watch)
+        {
+            fprintf(stderr, "Error: %s cannot be used with %s.\n", OPTION_WATCH, OPTION_CONNECT "PATH");
+            goto cleanup;
+        }
+        if (queue.summary)
+        {
+            fprintf(stderr, "Error: %s cannot be used with %s.\n", OPTION_SUMMARY_JSON, watch ? OPTION_WATCH : OPTION_CONNECT "PATH");
+            goto cleanup;
+        }
+        if (watch && queue.job_count == 0)
+        {
+            fprintf(stderr, "Error: %s needs input files.\n", OPTION_WATCH);
+            goto cleanup;
+        }
+        client_names = malloc((queue.job_count > 0 ? queue.job_count : 1) * sizeof(char *));
+        if (!client_names)
+        {
+            fprintf(stderr, "Error: Memory allocation failed\n");
+            goto cleanup;
+        }
+        for (i = 0; i < queue.job_count; i++)
+        {
+            client_names[i] = queue.jobs[i].filename;
+        }
+        assemble_options_init(&client.assemble);
+        client.assemble.single_pass = single_pass;
+        client.assemble.max_errors = max_errors;
+        client.assemble.diagnostics_format = format;
+        client.quiet = quiet;
+        client.fail_fast = fail_fast;
+        client.skip_unchanged = skip_unchanged;
+        if (watch)
+        {
+            client.assemble.threads = jobs;
+            stopped = watch_run(client_names, queue.job_count, &client);
+        }
+        else
+        {
+            stopped = client_run(connect_path, client_names, queue.job_count, &client);
+        }
+        free(client_names);
+        goto cleanup;
+    }
+
+    /* Threads left over when there are fewer files than -j go to each
+       file, whose first pass and .ob rendering can split a large source across them */
+    queue.chunk_threads = 1;
+    if (jobs > queue.job_count)
+    {
+        queue.chunk_threads = queue.job_count > 0 ? jobs / queue.job_count : 1;
+        jobs = queue.job_count;
+    }
+
+    for (i = 0; i < queue.job_count; i++)
+    {
+        diagnostics_init(&queue.jobs[i].diagnostics, format);
+        queue.jobs[i].diagnostics.max_errors = max_errors;
+        queue.jobs[i].quiet = quiet;
+        queue.jobs[i].output.skip_unchanged = skip_unchanged;
+        queue.jobs[i].ic = -1;
+        queue.jobs[i].dc = -1;
+    }
+    queue.stop_index = queue.job_count;
+    queue.single_pass = single_pass;
+    queue.fail_fast = fail_fast;
+
+    /* Keep a few finished states around so files reuse their tables */
+    queue.spare_capacity = jobs > 1 ? 2 * jobs : 1;
+    queue.spare_states = malloc(queue.spare_capacity * sizeof(AssemblerState *));
+    if (!queue.spare_states)
+    {
+        queue.spare_capacity = 0;
+    }
+    pthread_mutex_init(&queue.lock, NULL);
+    pthread_cond_init(&queue.finished, NULL);
+
+    /* With more than one file, a reader thread loads the next sources while
+       the current ones are assembled, and a writer thread puts the output
+       files on disk; either one is simply left out if it cannot start */
+    if (order_jobs(&queue, jobs > 1) == 0 && prefetch > 0 && queue.job_count > 1)
+    {
+        source_names = malloc(queue.job_count * sizeof(char *));
+        for (i = 0; source_names != NULL && i < queue.job_count; i++)
+        {
+            source_names[i] = queue.jobs[i].filename;
+        }
+        if (source_names != NULL && prefetcher_start(&prefetcher, source_names, ".as", queue.order, queue.job_count, prefetch) == 0)
+        {
+            queue.prefetcher = &prefetcher;
+        }
+        writer = output_writer_start(WRITES_PER_PREFETCH * prefetch);
+        for (i = 0; i < queue.job_count; i++)
+        {
+            queue.jobs[i].output.writer = writer;
+        }
+    }
+
+    /* Each file's log and diagnostics are emitted together, in input order */
+    stopped = jobs > 1 ? run_parallel(&queue, jobs) : run_sequential(&queue);
+
+    /* Files past a stop may still have outputs queued */
+    output_writer_stop(writer);
+    if (queue.prefetcher)
+    {
+        prefetcher_stop(queue.prefetcher);
+    }
+    free(source_names);
+    free(queue.order);
+
+    if (skip_unchanged && !quiet)
+    {
+        for (i = 0; i < queue.job_count; i++)
+        {
+            unchanged += queue.jobs[i].output.unchanged;
+        }
+        printf("Skipped %d unchanged output file%s\n", unchanged, unchanged == 1 ? "" : "s");
+    }
+
+    pthread_cond_destroy(&queue.finished);
+    pthread_mutex_destroy(&queue.lock);
+    for (i = 0; i < queue.spare_count; i++)
+    {
+        free_assembler_state(queue.spare_states[i]);
+    }
+    free(queue.spare_states);
+
+cleanup:
+    for (i = 0; i < queue.job_count; i++)
+    {
+        free(queue.jobs[i].log.data);
+        diagnostics_free(&queue.jobs[i].diagnostics);
+    }
+    free(queue.jobs);
+    free(names.data);
+
+    return stopped;
+}
@@ -0,0 +1,96 @@
+/****************************************************************/
+/* Single-pass assembly: fixup chains for forward references */
+/****************************************************************/
+#include "assembler.h"
+
+/*
+ * In single-pass mode the first pass encodes every instruction as soon as it
+ * is parsed. A direct operand whose symbol is not yet a known code label is
+ * written as a placeholder and recorded as a fixup. Fixups are kept in one
+ * array in source order and chained per symbol, so that defining a label
+ * patches exactly the words that refer to it. Whatever is still open at the
+ * end of the file (data labels, externals declared late, undefined symbols)
+ * is patched once the data segment has been relocated.
+ */
+
+/* Records a reference to a symbol from the word at address */
+int record_fixup(AssemblerState *state, int symbol, int address, int line)
+{
+    Fixup *fixups;
+    Fixup *fixup;
+
+    if (state->fixup_count == state->fixup_capacity)
+    {
+        fixups = realloc(state->fixups, (state->fixup_capacity ? state->fixup_capacity * 2 : INITIAL_TABLE_SIZE) * sizeof(Fixup));
+        if (!fixups)
+        {
+            report(state->diagnostics, SEVERITY_ERROR, DIAG_OUT_OF_MEMORY, state->current_line, 0, "Failed to reallocate fixup table");
+            return 1;
+        }
+        state->fixups = fixups;
+        state->fixup_capacity = state->fixup_capacity ? state->fixup_capacity * 2 : INITIAL_TABLE_SIZE;
+    }
+
+    fixup = &state->fixups[state->fixup_count];
+    fixup->address = address;
+    fixup->symbol = symbol;
+    fixup->line = line;
+    fixup->next = state->symbols[symbol].fixups;
+    state->symbols[symbol].fixups = state->fixup_count;
+    state->fixup_count++;
+    return 0;
+}
+
+/* Patches every recorded reference to a code label that has just been defined */
+void patch_label_fixups(AssemblerState *state, int symbol)
+{
+    int i;
+
+    if (symbol == NO_SYMBOL || state->symbols[symbol].is_extern)
+    {
+        return;
+    }
+    for (i = state->symbols[symbol].fixups; i != NO_FIXUP; i = state->fixups[i].next)
+    {
+        resolve_symbol_word(state, symbol, state->fixups[i].address, state->fixups[i].line);
+    }
+}
+
+/* Completes a single-pass run: places the data segment and patches the references still open */
+int finish_single_pass(AssemblerState *state, int report_undefined)
+{
+    int error = 0;
+    int i;
+    const Fixup *fixup;
+    const Symbol *symbol;
+
+    if (encode_data_segment(state) != 0)
+    {
+        return 1;
+    }
+
+    /* Walk the fixups in source order so errors come out as in the two-pass mode */
+    for (i = 0; i < state->fixup_count && !diagnostics_budget_exhausted(state->diagnostics); i++)
+    {
+        fixup = &state->fixups[i];
+        symbol = &state->symbols[fixup->symbol];
+
+        if (!symbol->is_extern && symbol->label != -1 && !state->label_table[symbol->label].is_data)
+        {
+            continue; /* Patched when the code label was defined */
+        }
+        if (symbol->is_extern || symbol->label != -1)
+        {
+            resolve_symbol_word(state, fixup->symbol, fixup->address, fixup->line);
+        }
+        else if (report_undefined)
+        {
+            error |= resolve_symbol_word(state, fixup->symbol, fixup->address, fixup->line);
+        }
+        else
+        {
+            error = 1;
+        }
+    }
+    return error;
+}
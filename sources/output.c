@@ -0,0 +1,430 @@
+/****************************************************************/
+/* Output layer: buffered files committed with write and rename */
+/****************************************************************/
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "output.h"
+
+#define TEMP_SUFFIX_LENGTH 32
+#define MAX_TEMP_ATTEMPTS 100
+#define COMPARE_CHUNK_SIZE 65536
+
+/* A commit waiting for the writer thread; it owns its filename and data */
+typedef struct {
+    OutputStats *stats;
+    char *filename;
+    char *data;
+    size_t length;
+} QueuedCommit;
+
+/* The writer thread and its ring of queued commits */
+struct OutputWriter {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;   /* Signalled when a commit is queued or the writer stops */
+    pthread_cond_t not_full;    /* Signalled when a commit is taken */
+    pthread_cond_t finished;    /* Signalled when a commit is done */
+    QueuedCommit *ring;
+    int capacity;
+    int head;
+    int count;
+    int stopping;
+};
+
+/* Creates a new temporary file next to filename; returns its descriptor, or -1 */
+static int open_temporary(const char *filename, char *temp_name)
+{
+    int attempt;
+    int fd;
+
+    for (attempt = 0; attempt < MAX_TEMP_ATTEMPTS; attempt++)
+    {
+        sprintf(temp_name, "%s.%ld.%d.tmp", filename, (long)getpid(), attempt);
+        fd = open(temp_name, O_WRONLY | O_CREAT | O_EXCL, 0666);
+        if (fd >= 0 || errno != EEXIST)
+        {
+            return fd;
+        }
+    }
+    return -1;
+}
+
+/* Writes all of data to a descriptor, resuming after short writes */
+static int write_all(int fd, const char *data, size_t length)
+{
+    ssize_t count;
+
+    while (length > 0)
+    {
+        count = write(fd, data, length);
+        if (count < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return 1;
+        }
+        data += count;
+        length -= (size_t)count;
+    }
+    return 0;
+}
+
+/* Checks whether a file exists and holds exactly the given contents.
+   The sizes are compared first, so a changed file is usually told apart
+   without reading it; otherwise it is compared chunk by chunk and the
+   first difference ends the read. */
+static int file_has_contents(const char *filename, const char *data, size_t length)
+{
+    char *chunk;
+    struct stat info;
+    ssize_t count;
+    int fd;
+    int same = 0;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        return 0;
+    }
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || (size_t)info.st_size != length)
+    {
+        close(fd);
+        return 0;
+    }
+
+    chunk = malloc(COMPARE_CHUNK_SIZE);
+    if (chunk)
+    {
+        same = 1;
+        while (same && length > 0)
+        {
+            count = read(fd, chunk, length < COMPARE_CHUNK_SIZE ? length : COMPARE_CHUNK_SIZE);
+            if (count < 0 && errno == EINTR)
+                continue;
+            same = count > 0 && memcmp(chunk, data, (size_t)count) == 0;
+            if (same)
+            {
+                data += count;
+                length -= (size_t)count;
+            }
+        }
+        free(chunk);
+    }
+    close(fd);
+    return same;
+}
+
+/* Writes a file in one go to a temporary name and renames it into place;
+   sets *unchanged instead if skip_unchanged is set and the file is identical */
+static int commit_file(int skip_unchanged, const char *filename, const char *data, size_t length, int *unchanged)
+{
+    char *temp_name;
+    struct stat info;
+    int fd;
+    int saved_errno;
+
+    *unchanged = skip_unchanged && file_has_contents(filename, data, length);
+    if (*unchanged)
+    {
+        return 0;
+    }
+
+    temp_name = malloc(strlen(filename) + TEMP_SUFFIX_LENGTH);
+    if (!temp_name)
+    {
+        errno = ENOMEM;
+        return 1;
+    }
+
+    fd = open_temporary(filename, temp_name);
+    if (fd < 0)
+    {
+        free(temp_name);
+        return 1;
+    }
+
+    /* The rename replaces the file, so a file being overwritten passes its
+       owner and permissions on; the owner only if we may set it. The owner
+       goes first, since changing it can clear the set-user-ID bits. */
+    if (stat(filename, &info) == 0 && S_ISREG(info.st_mode))
+    {
+        if (fchown(fd, info.st_uid, info.st_gid) != 0)
+        {
+            /* Keep our own owner */
+        }
+        if (fchmod(fd, info.st_mode & 07777) != 0)
+        {
+            saved_errno = errno;
+            close(fd);
+            goto failed;
+        }
+    }
+    if (write_all(fd, data, length) != 0)
+    {
+        saved_errno = errno;
+        close(fd);
+        goto failed;
+    }
+    if (close(fd) != 0)
+    {
+        saved_errno = errno;
+        goto failed;
+    }
+    if (rename(temp_name, filename) != 0)
+    {
+        saved_errno = errno;
+        goto failed;
+    }
+    free(temp_name);
+    return 0;
+
+failed:
+    remove(temp_name);
+    free(temp_name);
+    errno = saved_errno;
+    return 1;
+}
+
+/* Writer thread: commits the queued files in order until it is stopped
+   and the queue is empty */
+static void *writer_main(void *arg)
+{
+    OutputWriter *writer = arg;
+    QueuedCommit commit;
+    int unchanged;
+    int result;
+    int saved_errno;
+
+    pthread_mutex_lock(&writer->lock);
+    for (;;)
+    {
+        while (writer->count == 0 && !writer->stopping)
+        {
+            pthread_cond_wait(&writer->not_empty, &writer->lock);
+        }
+        if (writer->count == 0)
+        {
+            break;
+        }
+        commit = writer->ring[writer->head];
+        writer->head = (writer->head + 1) % writer->capacity;
+        writer->count--;
+        pthread_cond_signal(&writer->not_full);
+        pthread_mutex_unlock(&writer->lock);
+
+        result = commit_file(commit.stats->skip_unchanged, commit.filename, commit.data, commit.length, &unchanged);
+        saved_errno = errno;
+
+        pthread_mutex_lock(&writer->lock);
+        if (result != 0)
+        {
+            if (commit.stats->failed++ == 0)
+            {
+                commit.stats->failed_errno = saved_errno;
+                sprintf(commit.stats->failed_file, "%.*s", OUTPUT_NAME_LENGTH - 1, commit.filename);
+            }
+        }
+        else if (unchanged)
+        {
+            commit.stats->unchanged++;
+        }
+        else
+        {
+            commit.stats->written++;
+        }
+        commit.stats->pending--;
+        pthread_cond_broadcast(&writer->finished);
+        free(commit.filename);
+        free(commit.data);
+    }
+    pthread_mutex_unlock(&writer->lock);
+    return NULL;
+}
+
+/* Starts a background writer thread with a queue of the given size */
+OutputWriter *output_writer_start(int capacity)
+{
+    OutputWriter *writer = calloc(1, sizeof(OutputWriter));
+
+    if (!writer)
+    {
+        return NULL;
+    }
+    writer->capacity = capacity > 0 ? capacity : 1;
+    writer->ring = malloc(writer->capacity * sizeof(QueuedCommit));
+    if (!writer->ring)
+    {
+        free(writer);
+        return NULL;
+    }
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->not_empty, NULL);
+    pthread_cond_init(&writer->not_full, NULL);
+    pthread_cond_init(&writer->finished, NULL);
+    if (pthread_create(&writer->thread, NULL, writer_main, writer) != 0)
+    {
+        writer->stopping = 1;
+        output_writer_stop(writer);
+        return NULL;
+    }
+    return writer;
+}
+
+/* Finishes the queued commits, then stops and frees the writer */
+void output_writer_stop(OutputWriter *writer)
+{
+    int started;
+
+    if (!writer)
+    {
+        return;
+    }
+    pthread_mutex_lock(&writer->lock);
+    started = !writer->stopping;
+    writer->stopping = 1;
+    pthread_cond_signal(&writer->not_empty);
+    pthread_mutex_unlock(&writer->lock);
+    if (started)
+    {
+        pthread_join(writer->thread, NULL);
+    }
+
+    pthread_cond_destroy(&writer->finished);
+    pthread_cond_destroy(&writer->not_full);
+    pthread_cond_destroy(&writer->not_empty);
+    pthread_mutex_destroy(&writer->lock);
+    free(writer->ring);
+    free(writer);
+}
+
+/* Queues a commit whose data the writer frees once it is written;
+   returns 1 if it could not be queued, in which case data is still the caller's */
+static int queue_commit(OutputStats *stats, const char *filename, char *data, size_t length)
+{
+    OutputWriter *writer = stats->writer;
+    QueuedCommit commit;
+
+    commit.stats = stats;
+    commit.data = data;
+    commit.length = length;
+    commit.filename = malloc(strlen(filename) + 1);
+    if (!commit.filename)
+    {
+        return 1;
+    }
+    strcpy(commit.filename, filename);
+
+    pthread_mutex_lock(&writer->lock);
+    while (writer->count == writer->capacity)
+    {
+        pthread_cond_wait(&writer->not_full, &writer->lock);
+    }
+    writer->ring[(writer->head + writer->count) % writer->capacity] = commit;
+    writer->count++;
+    stats->pending++;
+    pthread_cond_signal(&writer->not_empty);
+    pthread_mutex_unlock(&writer->lock);
+    return 0;
+}
+
+/* Writes a file in one go and moves it into place on the calling thread */
+static int commit_now(OutputStats *stats, const char *filename, const char *data, size_t length)
+{
+    int unchanged;
+
+    if (commit_file(stats && stats->skip_unchanged, filename, data, length, &unchanged) != 0)
+    {
+        return 1;
+    }
+    if (stats && unchanged)
+    {
+        stats->unchanged++;
+    }
+    else if (stats)
+    {
+        stats->written++;
+    }
+    return 0;
+}
+
+/* Writes a file in one go and moves it into place, or queues a copy on the stats' writer */
+int output_commit(OutputStats *stats, const char *filename, const char *data, size_t length)
+{
+    char *copy;
+
+    /* Without the memory for the copy, the file is simply written here */
+    if (stats && stats->writer)
+    {
+        copy = malloc(length > 0 ? length : 1);
+        if (copy)
+        {
+            memcpy(copy, data, length);
+            if (queue_commit(stats, filename, copy, length) == 0)
+            {
+                return 0;
+            }
+            free(copy);
+        }
+    }
+    return commit_now(stats, filename, data, length);
+}
+
+/* Tells whether every commit queued through stats is done */
+int output_done(OutputStats *stats)
+{
+    int done;
+
+    if (!stats->writer)
+    {
+        return 1;
+    }
+    pthread_mutex_lock(&stats->writer->lock);
+    done = stats->pending == 0;
+    pthread_mutex_unlock(&stats->writer->lock);
+    return done;
+}
+
+/* Waits for the commits queued through stats; returns how many failed */
+int output_wait(OutputStats *stats)
+{
+    if (!stats->writer)
+    {
+        return stats->failed;
+    }
+    pthread_mutex_lock(&stats->writer->lock);
+    while (stats->pending > 0)
+    {
+        pthread_cond_wait(&stats->writer->finished, &stats->writer->lock);
+    }
+    pthread_mutex_unlock(&stats->writer->lock);
+    return stats->failed;
+}
+
+/* Writes a text buffer to a file with output_commit */
+int output_commit_text(OutputStats *stats, const char *filename, const TextBuffer *text)
+{
+    return output_commit(stats, filename, text->data != NULL ? text->data : "", text->length);
+}
+
+/* Writes a text buffer to a file, handing the buffer itself to the stats'
+   writer rather than copying it */
+int output_commit_buffer(OutputStats *stats, const char *filename, TextBuffer *text)
+{
+    if (stats && stats->writer && queue_commit(stats, filename, text->data, text->length) == 0)
+    {
+        text->data = NULL;
+        text->length = 0;
+        text->capacity = 0;
+        return 0;
+    }
+    return commit_now(stats, filename, text->data != NULL ? text->data : "", text->length);
+}
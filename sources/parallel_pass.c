@@ -0,0 +1,400 @@
+/****************************************************************/
+/* Parallel passes: chunked parsing of one large source and     */
+/* range-split rendering of a large object file                 */
+/****************************************************************/
+#define _POSIX_C_SOURCE 200112L
+
+#include <pthread.h>
+#include "assembler.h"
+#include "scan.h"
+
+#define MIN_CHUNK_BYTES 65536 /* Smaller sources are not worth a thread */
+#define MIN_RENDER_WORDS 16384 /* Smaller ranges of the image are not worth a thread */
+
+/*
+ * A chunk is parsed exactly like a whole file, by process_line on a state
+ * of its own: addresses count from the start of the chunk's code and data,
+ * line numbers from its first line, and symbol indices are its own. Merging
+ * appends the chunks to the real state in source order, so symbols are
+ * interned in the order of their first use and labels, entries, externs,
+ * statements and data come out as the sequential pass would have produced
+ * them. Only the few checks that look back at earlier lines (a label
+ * defined twice, an entry or extern declared again) can span two chunks;
+ * they are redone while merging, and any hit sends the file back to the
+ * sequential pass, which reports it. So does an error in any chunk; the
+ * warnings of the chunks are replayed once they are all merged, with
+ * their line numbers moved by the lines of the chunks before them.
+ */
+
+/* One chunk of the source and the state that parses it */
+typedef struct {
+    SourceBuffer source;      /* A view of the chunk; it owns nothing */
+    AssemblerState *state;
+    Diagnostics diagnostics;
+    Macro *macros;
+    int *macroCount;
+    int lines;                /* Lines in the chunk */
+    int error;
+} FirstPassChunk;
+
+/* Thread entry point: parses one chunk */
+static void *parse_chunk(void *arg)
+{
+    FirstPassChunk *chunk = arg;
+    SourceCounts counts;
+    const char *p = chunk->source.data;
+    const char *end = chunk->source.data + chunk->source.length;
+
+    count_source(&chunk->source, &counts);
+    if (reserve_assembler_state(chunk->state, &counts) != 0)
+    {
+        chunk->error = 1;
+        return NULL;
+    }
+    chunk->error = first_pass_lines(chunk->state, &chunk->source, chunk->macros, chunk->macroCount);
+
+    /* Every chunk but the last ends with a newline, so it has one line per newline */
+    for (; (p = scan_newline(p, end)) < end; p++)
+    {
+        chunk->lines++;
+    }
+    return NULL;
+}
+
+/* Checks whether a name was declared with .extern */
+static int is_extern_name(const AssemblerState *state, const char *name)
+{
+    int symbol = find_symbol(state, name);
+
+    return symbol != NO_SYMBOL && state->symbols[symbol].is_extern;
+}
+
+/* Checks whether a name was declared with .entry */
+static int is_entry_name(const AssemblerState *state, const char *name)
+{
+    int symbol = find_symbol(state, name);
+
+    return symbol != NO_SYMBOL && state->symbols[symbol].is_entry;
+}
+
+/* Checks the lines of a chunk that would have looked back into earlier chunks */
+static int chunk_conflicts(const AssemblerState *state, const AssemblerState *part, const int *symbols)
+{
+    int i;
+
+    for (i = 0; i < part->symbol_count; i++)
+    {
+        if (part->symbols[i].label != -1 && state->symbols[symbols[i]].label != -1)
+        {
+            return 1; /* Duplicate label */
+        }
+    }
+    for (i = 0; i < part->extern_count; i++)
+    {
+        if (is_extern_name(state, part->extern_table[i].name))
+        {
+            return 1; /* Extern declared again */
+        }
+    }
+    for (i = 0; i < part->entry_count; i++)
+    {
+        if (is_extern_name(state, part->entry_table[i].name) || is_entry_name(state, part->entry_table[i].name))
+        {
+            return 1; /* Entry that is an extern, or declared again */
+        }
+    }
+    return 0;
+}
+
+/* Maps a chunk's symbol index to the merged one */
+static int map_symbol(const int *symbols, int symbol)
+{
+    return symbol == NO_SYMBOL ? NO_SYMBOL : symbols[symbol];
+}
+
+/* Appends one parsed chunk to the state; returns 1 if the chunks must be parsed sequentially instead */
+static int merge_chunk(AssemblerState *state, const FirstPassChunk *chunk, int line_offset, int *symbols)
+{
+    const AssemblerState *part = chunk->state;
+    int code_offset = state->IC - MEMORY_START;
+    int data_offset = state->DC;
+    const Label *label;
+    Statement *statement;
+    int *values;
+    int i;
+
+    /* Symbols first, in the order the chunk met them */
+    for (i = 0; i < part->symbol_count; i++)
+    {
+        symbols[i] = intern_symbol(state, part->symbols[i].name);
+        if (symbols[i] == NO_SYMBOL)
+        {
+            return 1;
+        }
+    }
+    if (chunk_conflicts(state, part, symbols))
+    {
+        return 1;
+    }
+    for (i = 0; i < part->symbol_count; i++)
+    {
+        state->symbols[symbols[i]].is_extern |= part->symbols[i].is_extern;
+        state->symbols[symbols[i]].is_entry |= part->symbols[i].is_entry;
+    }
+
+    for (i = 0; i < part->label_count; i++)
+    {
+        label = &part->label_table[i];
+        if (label->is_data)
+            add_data_label(state, label->name, label->address + data_offset);
+        else
+            add_label(state, label->name, label->address + code_offset);
+    }
+
+    /* The tables were sized for the whole source, so the chunks fit */
+    if (state->entry_count + part->entry_count > state->entry_capacity ||
+        state->extern_count + part->extern_count > state->extern_capacity)
+    {
+        return 1;
+    }
+    memcpy(state->entry_table + state->entry_count, part->entry_table, (size_t)part->entry_count * sizeof(EntryLabel));
+    state->entry_count += part->entry_count;
+    memcpy(state->extern_table + state->extern_count, part->extern_table, (size_t)part->extern_count * sizeof(ExternLabel));
+    state->extern_count += part->extern_count;
+
+    for (i = 0; i < part->statement_count; i++)
+    {
+        statement = append_statement(state, part->statements[i].kind);
+        if (!statement)
+        {
+            return 1;
+        }
+        *statement = part->statements[i];
+        statement->line += line_offset;
+        if (statement->kind == STATEMENT_INSTRUCTION)
+            statement->address += code_offset;
+        else if (statement->kind == STATEMENT_DATA || statement->kind == STATEMENT_STRING)
+            statement->address += data_offset;
+        statement->src.symbol = map_symbol(symbols, statement->src.symbol);
+        statement->dst.symbol = map_symbol(symbols, statement->dst.symbol);
+        statement->symbol = map_symbol(symbols, statement->symbol);
+    }
+
+    values = reserve_data_values(state, (size_t)part->DC);
+    if (!values)
+    {
+        return 1;
+    }
+    memcpy(values, part->data_values, (size_t)part->DC * sizeof(int));
+    state->DC += part->DC;
+    state->IC += part->IC - MEMORY_START;
+    return 0;
+}
+
+/* Records the diagnostics of a merged chunk on the state, in the order the chunk found them */
+static void replay_diagnostics(AssemblerState *state, const Diagnostics *diagnostics, int line_offset)
+{
+    const Diagnostic *item;
+    int i;
+
+    for (i = 0; i < diagnostics->count; i++)
+    {
+        item = &diagnostics->items[i];
+        report(state->diagnostics, (Severity)item->severity, (DiagnosticCode)item->code,
+               item->line > 0 ? item->line + line_offset : 0, item->column, "%s", diagnostics->text + item->message);
+    }
+}
+
+/* Runs the first pass of a large source on several threads */
+int parallel_first_pass(AssemblerState *state, const SourceBuffer *source, Macro *macros, int *macroCount)
+{
+    FirstPassChunk *chunks;
+    pthread_t *threads;
+    int *started;
+    int *symbols = NULL;
+    const char *start = source->data;
+    const char *end = source->data + source->length;
+    const char *cut;
+    int chunk_count = state->chunk_threads;
+    int line_offset = 0;
+    int merged = 1;
+    int i;
+
+    /* Splitting cannot keep the error budget or the single-pass fixups exact */
+    if (state->single_pass || (state->diagnostics != NULL && state->diagnostics->max_errors > 0))
+    {
+        return 0;
+    }
+    if ((size_t)chunk_count > source->length / MIN_CHUNK_BYTES)
+    {
+        chunk_count = (int)(source->length / MIN_CHUNK_BYTES);
+    }
+    if (chunk_count < 2)
+    {
+        return 0;
+    }
+
+    chunks = calloc((size_t)chunk_count, sizeof(FirstPassChunk));
+    threads = malloc((size_t)chunk_count * sizeof(pthread_t));
+    started = calloc((size_t)chunk_count, sizeof(int));
+    if (!chunks || !threads || !started)
+    {
+        free(chunks);
+        free(threads);
+        free(started);
+        return 0;
+    }
+
+    /* Cut the source into chunks of about the same size, after a newline */
+    for (i = 0; i < chunk_count; i++)
+    {
+        cut = i == chunk_count - 1 ? end : source->data + source->length / chunk_count * (i + 1);
+        if (cut < start)
+            cut = start;
+        cut = scan_newline(cut, end);
+        if (cut < end)
+            cut++;
+        chunks[i].source.data = start;
+        chunks[i].source.length = (size_t)(cut - start);
+        chunks[i].macros = macros;
+        chunks[i].macroCount = macroCount;
+        diagnostics_init(&chunks[i].diagnostics, DIAGNOSTICS_TEXT);
+        chunks[i].state = init_assembler_state();
+        if (chunks[i].state)
+            chunks[i].state->diagnostics = &chunks[i].diagnostics;
+        else
+            merged = 0;
+        start = cut;
+    }
+
+    /* The calling thread parses the first chunk itself */
+    for (i = 1; i < chunk_count && merged; i++)
+    {
+        started[i] = pthread_create(&threads[i], NULL, parse_chunk, &chunks[i]) == 0;
+        if (!started[i])
+        {
+            parse_chunk(&chunks[i]);
+        }
+    }
+    if (merged)
+    {
+        parse_chunk(&chunks[0]);
+    }
+    for (i = 1; i < chunk_count; i++)
+    {
+        if (started[i])
+        {
+            pthread_join(threads[i], NULL);
+        }
+    }
+
+    /* Errors are left to the sequential pass, which reports them in order */
+    for (i = 0; i < chunk_count && merged; i++)
+    {
+        merged = !chunks[i].error && chunks[i].diagnostics.error_count == 0;
+    }
+    for (i = 0; i < chunk_count && merged; i++)
+    {
+        free(symbols);
+        symbols = malloc((size_t)(chunks[i].state->symbol_count + 1) * sizeof(int));
+        merged = symbols != NULL && merge_chunk(state, &chunks[i], line_offset, symbols) == 0;
+        line_offset += chunks[i].lines;
+    }
+    if (!merged)
+    {
+        clear_assembler_tables(state);
+    }
+    for (i = 0, line_offset = 0; i < chunk_count && merged; i++)
+    {
+        replay_diagnostics(state, &chunks[i].diagnostics, line_offset);
+        line_offset += chunks[i].lines;
+    }
+
+    for (i = 0; i < chunk_count; i++)
+    {
+        free_assembler_state(chunks[i].state);
+        diagnostics_free(&chunks[i].diagnostics);
+    }
+    free(symbols);
+    free(chunks);
+    free(threads);
+    free(started);
+    return merged;
+}
+
+/* One address range of the object file and where its lines go */
+typedef struct {
+    const AssemblerState *state;
+    char *out;
+    int from;
+    int to;
+} RenderRange;
+
+/* Thread entry point: renders one range */
+static void *render_range(void *arg)
+{
+    RenderRange *range = arg;
+
+    render_object_words(range->state, range->out, range->from, range->to);
+    return NULL;
+}
+
+/* Renders the word lines of the object file on several threads */
+void parallel_render_object(const AssemblerState *state, char *out, int end)
+{
+    RenderRange *ranges = NULL;
+    pthread_t *threads = NULL;
+    int *started = NULL;
+    int range_count = state->chunk_threads;
+    int words = end - MEMORY_START;
+    int i;
+
+    if (range_count > words / MIN_RENDER_WORDS)
+    {
+        range_count = words / MIN_RENDER_WORDS;
+    }
+    if (range_count >= 2)
+    {
+        ranges = malloc((size_t)range_count * sizeof(RenderRange));
+        threads = malloc((size_t)range_count * sizeof(pthread_t));
+        started = calloc((size_t)range_count, sizeof(int));
+    }
+    if (!ranges || !threads || !started)
+    {
+        free(ranges);
+        free(threads);
+        free(started);
+        render_object_words(state, out, MEMORY_START, end);
+        return;
+    }
+
+    for (i = 0; i < range_count; i++)
+    {
+        ranges[i].state = state;
+        ranges[i].from = MEMORY_START + (int)((long)words * i / range_count);
+        ranges[i].to = MEMORY_START + (int)((long)words * (i + 1) / range_count);
+        ranges[i].out = out + object_text_offset(ranges[i].from);
+    }
+
+    /* The calling thread renders the first range itself */
+    for (i = 1; i < range_count; i++)
+    {
+        started[i] = pthread_create(&threads[i], NULL, render_range, &ranges[i]) == 0;
+        if (!started[i])
+        {
+            render_range(&ranges[i]);
+        }
+    }
+    render_range(&ranges[0]);
+    for (i = 1; i < range_count; i++)
+    {
+        if (started[i])
+        {
+            pthread_join(threads[i], NULL);
+        }
+    }
+
+    free(ranges);
+    free(threads);
+    free(started);
+}
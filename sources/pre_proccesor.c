@@ -1,53 +1,71 @@
 #include "assembler.h"
+#include "source.h"
+#include "output.h"
+#include "scan.h"
 
 #define MAX_LINE_SIZE 256
 #define MACRO_START "macr"
 #define MACRO_END "endmacr"
 #define MACRO_START_LENGTH 4
 #define MACRO_END_LENGTH 7
+#define WHITESPACE " \t\n\v\f\r"
 
  
 
-/* Function to expand macros in the input file */
-void expandMacrosInFile(const char* inputFilename, char* outputFilename, Macro* macros, int macroCount, int* error) {
-    FILE* inputFile;
-    FILE* outputFile;
-    char line[MAX_LINE_SIZE];
+/* Appends the non-blank lines of a macro body, reading the body in place;
+   returns 1 if memory allocation failed */
+static int append_macro_body(TextBuffer* output, const char* content)
+{
+    const char* end = content + strlen(content);
+    const char* endOfLine;
+    int failed = 0;
+
+    while (content < end)
+    {
+        endOfLine = memchr(content, '\n', (size_t)(end - content));
+        if (!endOfLine)
+        {
+            endOfLine = end;
+        }
+        if (scan_skip_blanks(content, endOfLine) != endOfLine)
+        {
+            failed |= text_buffer_append(output, content, (size_t)(endOfLine - content));
+            failed |= text_buffer_append(output, "\n", 1);
+        }
+        content = endOfLine + 1;
+    }
+    return failed;
+}
+
+/* Function to expand macros in the input source, producing the expanded source and the .am file */
+void expandMacrosInSource(const SourceBuffer* input, const char* outputFilename, Macro* macros, int macroCount, SourceBuffer* expanded, int* error, Diagnostics* diagnostics, OutputStats* stats) {
+    LineReader reader;
+    LineView view;
+    TextBuffer output = {NULL, 0, 0};
+    TextBuffer lineText = {NULL, 0, 0};
+    char* line;
     int lineNumber = 0;
     int replaced;
+    int outOfMemory = 0;
     char macroName[MAX_LINE_SIZE];
+    size_t nameLength;
     char* remaining;
     int i, j;
-    char* macroLine;
-    char* macroLinePtr;
-    char* endOfLine;
     char* remaining_end;
 
-    /* Open input file for reading */
+    /* Without macro calls the expansion is the size of the input */
+    text_buffer_reserve(&output, input->length);
 
-    inputFile = fopen(inputFilename, "r");
-    if (inputFile == NULL) 
-    {
-        fprintf(stderr, "Error at line %d: Failed to open input file\n", lineNumber);
-        perror("Error details");
-        *error = 1;
-        return; 
-    }
-
-    /* Open output file for writing */
-    outputFile = fopen(outputFilename, "w");
-    if (outputFile == NULL)
- {
-        fprintf(stderr, "Error at line %d: Failed to create output file\n", lineNumber);
-        perror("Error details");
-        fclose(inputFile);
-        *error = 1;
-        return; 
-    }
-
-    /* Process each line in the input file */
-    while (fgets(line, sizeof(line), inputFile))
+    /* Process each line in the input source */
+    line_reader_init(&reader, input);
+    while (!outOfMemory && !diagnostics_budget_exhausted(diagnostics) && line_reader_next(&reader, &view))
     {
+        outOfMemory |= line_view_copy(&view, &lineText);
+        if (outOfMemory)
+        {
+            break;
+        }
+        line = lineText.data;
         trimLeadingWhitespace(line);
         lineNumber++;
         
@@ -56,7 +74,7 @@ void expandMacrosInFile(const char* inputFilename, char* outputFilename, Macro*
         /* Write comments and empty lines directly to output file */
         if (is_comment(line) || is_empty_line(line)) 
 	{
-            fputs(line, outputFile);
+            outOfMemory |= text_buffer_append(&output, line, strlen(line));
             continue;
         }
 
@@ -67,40 +85,36 @@ void expandMacrosInFile(const char* inputFilename, char* outputFilename, Macro*
 	{
             remaining = line + MACRO_START_LENGTH;
             while (isspace(*remaining)) remaining++;
-            if (sscanf(remaining, "%s", macroName) != 1 || !is_whitespace_line(remaining + strlen(macroName)))
+            nameLength = strcspn(remaining, WHITESPACE);
+            if (nameLength == 0 || !is_whitespace_line(remaining + nameLength))
 	 {
-                fprintf(stderr, "Error at line %d: Invalid macro definition line '%s'\n", lineNumber, line);
+                report(diagnostics, SEVERITY_ERROR, DIAG_INVALID_MACRO, lineNumber, 0, "Invalid macro definition line '%.*s'", (int)strcspn(line, "\r\n"), line);
                 *error = 1;
             }
 
+            /* A name too long for macroName cannot be a macro name anyway */
+            nameLength = nameLength < sizeof(macroName) - 1 ? nameLength : sizeof(macroName) - 1;
+            memcpy(macroName, remaining, nameLength);
+            macroName[nameLength] = '\0';
+
             /* Replace macro with its content */
             for (j = 0; j < macroCount; j++) {
                 if (strcmp(macroName, macros[j].name) == 0) 
 		{
-                    macroLine = my_strdup(macros[j].content);
-                    macroLinePtr = macroLine;
-                    while (*macroLinePtr) {
-                        endOfLine = strchr(macroLinePtr, '\n');
-                        if (endOfLine) *endOfLine = '\0';
-                        if (!is_empty_macro_line(macroLinePtr)) 
-			{
-                            fputs(macroLinePtr, outputFile);
-
- 
-                                fputs("\n", outputFile);
-                            
-                        }
-                        if (!endOfLine) break;
-                        macroLinePtr = endOfLine + 1;
-                    }
-                    free(macroLine);
+                    outOfMemory |= append_macro_body(&output, macros[j].content);
                     replaced = 1;
                 }
             }
 
             /* Skip lines until end of macro definition */
-            while (fgets(line, sizeof(line), inputFile))
+            while (!outOfMemory && line_reader_next(&reader, &view))
             {
+                outOfMemory |= line_view_copy(&view, &lineText);
+                if (outOfMemory)
+                {
+                    break;
+                }
+                line = lineText.data;
                 lineNumber++;
                 trimLeadingWhitespace(line);
                 if (strncmp(line, MACRO_END, MACRO_END_LENGTH) == 0)
@@ -108,11 +122,15 @@ void expandMacrosInFile(const char* inputFilename, char* outputFilename, Macro*
                     break;
                 }
             }
+            if (outOfMemory)
+            {
+                break;
+            }
             remaining_end = line + MACRO_END_LENGTH;
             while (isspace(*remaining_end)) remaining_end++;
             if (*remaining_end != '\0')
 		 {
-                fprintf(stderr, "Error at line %d: Invalid endmacro line '%s'\n", lineNumber, line);
+                report(diagnostics, SEVERITY_ERROR, DIAG_INVALID_MACRO, lineNumber, 0, "Invalid endmacro line '%.*s'", (int)strcspn(line, "\r\n"), line);
                 *error = 1;
             }
         }
@@ -123,22 +141,8 @@ void expandMacrosInFile(const char* inputFilename, char* outputFilename, Macro*
 	{
                 if (strncmp(line, macros[i].name, strlen(macros[i].name)) == 0)
 	 {
-                    macroLine = my_strdup(macros[i].content);
-                    macroLinePtr = macroLine;
-                    while (*macroLinePtr) {
-                        endOfLine = strchr(macroLinePtr, '\n');
-                        if (endOfLine) *endOfLine = '\0';
-                        if (!is_empty_macro_line(macroLinePtr))
-			 {
-                            fputs(macroLinePtr, outputFile);
-                                 fputs("\n", outputFile);
-                            
-                        }
-                        if (!endOfLine) break;
-                        macroLinePtr = endOfLine + 1;
-                    }
-                    free(macroLine);
-                    fputs(line + strlen(macros[i].name), outputFile);
+                    outOfMemory |= append_macro_body(&output, macros[i].content);
+                    outOfMemory |= text_buffer_append(&output, line + strlen(macros[i].name), strlen(line + strlen(macros[i].name)));
                     replaced = 1;
                 }
             }
@@ -146,11 +150,28 @@ void expandMacrosInFile(const char* inputFilename, char* outputFilename, Macro*
 
         /* Write original line if no replacement occurred */
         if (!replaced) {
-            fputs(line, outputFile);
+            outOfMemory |= text_buffer_append(&output, line, strlen(line));
         }
     }
+    free(lineText.data);
+
+    /* A partial expansion must not reach the .am file or the first pass */
+    if (outOfMemory)
+    {
+        report(diagnostics, SEVERITY_ERROR, DIAG_OUT_OF_MEMORY, lineNumber, 0, "Failed to allocate memory for the expanded source");
+        *error = 1;
+    }
+
+    /* Write the expanded source to the .am file in one go, if there is one
+       and the expansion succeeded; a failed expansion's file is removed anyway */
+    if (outputFilename != NULL && *error != 1 && output_commit_text(stats, outputFilename, &output) != 0)
+    {
+        report(diagnostics, SEVERITY_ERROR, DIAG_IO, 0, 0, "Cannot write %s: %s", outputFilename, strerror(errno));
+        free(output.data);
+        *error = 1;
+        return;
+    }
 
-    /* Close input and output files */
-    fclose(inputFile);
-    fclose(outputFile);
+    /* Hand the expanded text to the first pass */
+    source_from_memory(expanded, output.data, output.length);
 }
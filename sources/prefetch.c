@@ -0,0 +1,172 @@
+/****************************************************************/
+/* Prefetching reader: loading batch sources ahead of the stages */
+/****************************************************************/
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "prefetch.h"
+
+#define MAX_FILENAME_LENGTH 260
+
+/* Where a file is in the prefetcher */
+typedef enum {
+    PREFETCH_PENDING,           /* Nobody has started loading it */
+    PREFETCH_LOADING,           /* The reader or a stage is loading it */
+    PREFETCH_READY,             /* Loaded by the reader, waiting to be taken */
+    PREFETCH_TAKEN
+} PrefetchState;
+
+/* Opens a file and reads its pages in; returns 0 or the errno of the failure */
+static int load_source(const Prefetcher *prefetcher, int index, SourceBuffer *source)
+{
+    char filename[MAX_FILENAME_LENGTH];
+
+    if (strlen(prefetcher->names[index]) + strlen(prefetcher->extension) >= sizeof(filename))
+    {
+        memset(source, 0, sizeof(*source));
+        source->data = "";
+        return ENAMETOOLONG;
+    }
+    sprintf(filename, "%s%s", prefetcher->names[index], prefetcher->extension);
+    if (source_open(source, filename) != 0)
+    {
+        return errno;
+    }
+    source_prefault(source);
+    return 0;
+}
+
+/* Reader thread: loads the files in order, staying at most depth files ahead */
+static void *reader_main(void *arg)
+{
+    Prefetcher *prefetcher = arg;
+    int index;
+    int error;
+
+    pthread_mutex_lock(&prefetcher->lock);
+    for (;;)
+    {
+        while (!prefetcher->stopping && prefetcher->ready >= prefetcher->depth)
+        {
+            pthread_cond_wait(&prefetcher->changed, &prefetcher->lock);
+        }
+        while (prefetcher->next < prefetcher->count &&
+               prefetcher->states[prefetcher->order[prefetcher->next]] != PREFETCH_PENDING)
+        {
+            prefetcher->next++;
+        }
+        if (prefetcher->stopping || prefetcher->next == prefetcher->count)
+        {
+            break;
+        }
+
+        index = prefetcher->order[prefetcher->next++];
+        prefetcher->states[index] = PREFETCH_LOADING;
+        pthread_mutex_unlock(&prefetcher->lock);
+        error = load_source(prefetcher, index, &prefetcher->sources[index]);
+        pthread_mutex_lock(&prefetcher->lock);
+
+        prefetcher->errors[index] = error;
+        prefetcher->states[index] = PREFETCH_READY;
+        prefetcher->ready++;
+        pthread_cond_broadcast(&prefetcher->changed);
+    }
+    pthread_mutex_unlock(&prefetcher->lock);
+    return NULL;
+}
+
+/* Starts the reader thread */
+int prefetcher_start(Prefetcher *prefetcher, char **names, const char *extension, const int *order, int count, int depth)
+{
+    memset(prefetcher, 0, sizeof(*prefetcher));
+    prefetcher->names = names;
+    prefetcher->extension = extension;
+    prefetcher->order = order;
+    prefetcher->count = count;
+    prefetcher->depth = depth > 0 ? depth : 1;
+    prefetcher->sources = calloc((size_t)(count > 0 ? count : 1), sizeof(SourceBuffer));
+    prefetcher->states = calloc((size_t)(count > 0 ? count : 1), sizeof(int));
+    prefetcher->errors = calloc((size_t)(count > 0 ? count : 1), sizeof(int));
+    if (!prefetcher->sources || !prefetcher->states || !prefetcher->errors)
+    {
+        free(prefetcher->sources);
+        free(prefetcher->states);
+        free(prefetcher->errors);
+        return 1;
+    }
+    pthread_mutex_init(&prefetcher->lock, NULL);
+    pthread_cond_init(&prefetcher->changed, NULL);
+    if (pthread_create(&prefetcher->thread, NULL, reader_main, prefetcher) != 0)
+    {
+        pthread_cond_destroy(&prefetcher->changed);
+        pthread_mutex_destroy(&prefetcher->lock);
+        free(prefetcher->sources);
+        free(prefetcher->states);
+        free(prefetcher->errors);
+        return 1;
+    }
+    return 0;
+}
+
+/* Takes a file, loading it here if the reader has not started on it */
+int prefetcher_take(Prefetcher *prefetcher, int index, SourceBuffer *source)
+{
+    int error;
+
+    pthread_mutex_lock(&prefetcher->lock);
+    while (prefetcher->states[index] == PREFETCH_LOADING)
+    {
+        pthread_cond_wait(&prefetcher->changed, &prefetcher->lock);
+    }
+    if (prefetcher->states[index] == PREFETCH_READY)
+    {
+        *source = prefetcher->sources[index];
+        error = prefetcher->errors[index];
+        prefetcher->states[index] = PREFETCH_TAKEN;
+        prefetcher->ready--;
+        pthread_cond_broadcast(&prefetcher->changed);
+        pthread_mutex_unlock(&prefetcher->lock);
+    }
+    else
+    {
+        prefetcher->states[index] = PREFETCH_TAKEN;
+        pthread_mutex_unlock(&prefetcher->lock);
+        error = load_source(prefetcher, index, source);
+    }
+
+    if (error != 0)
+    {
+        source_close(source);
+        errno = error;
+        return 1;
+    }
+    return 0;
+}
+
+/* Stops the reader thread and releases the files nobody took */
+void prefetcher_stop(Prefetcher *prefetcher)
+{
+    int i;
+
+    pthread_mutex_lock(&prefetcher->lock);
+    prefetcher->stopping = 1;
+    pthread_cond_broadcast(&prefetcher->changed);
+    pthread_mutex_unlock(&prefetcher->lock);
+    pthread_join(prefetcher->thread, NULL);
+
+    for (i = 0; i < prefetcher->count; i++)
+    {
+        if (prefetcher->states[i] == PREFETCH_READY)
+        {
+            source_close(&prefetcher->sources[i]);
+        }
+    }
+    pthread_cond_destroy(&prefetcher->changed);
+    pthread_mutex_destroy(&prefetcher->lock);
+    free(prefetcher->sources);
+    free(prefetcher->states);
+    free(prefetcher->errors);
+}
@@ -0,0 +1,335 @@
+/****************************************************************/
+/* Scalar and vectorized character scanners */
+/****************************************************************/
+#include <string.h>
+#include "scan.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SCAN_HAVE_X86 1
+#include <immintrin.h>
+#else
+#define SCAN_HAVE_X86 0
+#endif
+
+#define SSE2_WIDTH 16
+#define AVX2_WIDTH 32
+
+/**
+ * The set of scanners making up one implementation level.
+ */
+typedef struct {
+    const char *(*newline)(const char *p, const char *end);
+    const char *(*skip_blanks)(const char *p, const char *end);
+    const char *(*trim_end)(const char *start, const char *end);
+    size_t (*identifier_length)(const char *p, size_t length);
+} ScanOps;
+
+/*******************/
+/* Scalar scanners */
+/*******************/
+
+/* Checks if a character is a blank (isspace in the "C" locale) */
+int scan_is_blank(char c)
+{
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+/* Checks if a character is an ASCII letter or digit */
+static int is_identifier_char(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9');
+}
+
+static const char *scalar_newline(const char *p, const char *end)
+{
+    while (p < end && *p != '\n')
+        p++;
+    return p;
+}
+
+static const char *scalar_skip_blanks(const char *p, const char *end)
+{
+    while (p < end && scan_is_blank(*p))
+        p++;
+    return p;
+}
+
+static const char *scalar_trim_end(const char *start, const char *end)
+{
+    while (end > start && scan_is_blank(end[-1]))
+        end--;
+    return end;
+}
+
+static size_t scalar_identifier_length(const char *p, size_t length)
+{
+    size_t i = 0;
+    while (i < length && is_identifier_char(p[i]))
+        i++;
+    return i;
+}
+
+static const ScanOps scalar_ops = {
+    scalar_newline, scalar_skip_blanks, scalar_trim_end, scalar_identifier_length};
+
+#if SCAN_HAVE_X86
+
+/*****************/
+/* SSE2 scanners */
+/*****************/
+
+/* Marks the bytes of v that are blanks: ' ' or '\t'..'\r' */
+__attribute__((target("sse2"))) static __m128i sse2_blank_bytes(__m128i v)
+{
+    __m128i control = _mm_sub_epi8(v, _mm_set1_epi8('\t'));
+    __m128i in_range = _mm_cmpeq_epi8(_mm_min_epu8(control, _mm_set1_epi8('\r' - '\t')), control);
+    return _mm_or_si128(in_range, _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')));
+}
+
+/* Marks the bytes of v that are ASCII letters or digits */
+__attribute__((target("sse2"))) static __m128i sse2_identifier_bytes(__m128i v)
+{
+    __m128i digit = _mm_sub_epi8(v, _mm_set1_epi8('0'));
+    __m128i letter = _mm_sub_epi8(_mm_or_si128(v, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+    __m128i is_digit = _mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit);
+    __m128i is_letter = _mm_cmpeq_epi8(_mm_min_epu8(letter, _mm_set1_epi8('z' - 'a')), letter);
+    return _mm_or_si128(is_digit, is_letter);
+}
+
+__attribute__((target("sse2"))) static const char *sse2_newline(const char *p, const char *end)
+{
+    const __m128i newline = _mm_set1_epi8('\n');
+    int mask;
+
+    while (end - p >= SSE2_WIDTH)
+    {
+        mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)p), newline));
+        if (mask != 0)
+            return p + __builtin_ctz((unsigned)mask);
+        p += SSE2_WIDTH;
+    }
+    return scalar_newline(p, end);
+}
+
+__attribute__((target("sse2"))) static const char *sse2_skip_blanks(const char *p, const char *end)
+{
+    int mask;
+
+    while (end - p >= SSE2_WIDTH)
+    {
+        mask = ~_mm_movemask_epi8(sse2_blank_bytes(_mm_loadu_si128((const __m128i *)p))) & 0xFFFF;
+        if (mask != 0)
+            return p + __builtin_ctz((unsigned)mask);
+        p += SSE2_WIDTH;
+    }
+    return scalar_skip_blanks(p, end);
+}
+
+__attribute__((target("sse2"))) static const char *sse2_trim_end(const char *start, const char *end)
+{
+    int mask;
+
+    while (end - start >= SSE2_WIDTH)
+    {
+        mask = ~_mm_movemask_epi8(sse2_blank_bytes(_mm_loadu_si128((const __m128i *)(end - SSE2_WIDTH)))) & 0xFFFF;
+        if (mask != 0)
+            return end - SSE2_WIDTH + (31 - __builtin_clz((unsigned)mask)) + 1;
+        end -= SSE2_WIDTH;
+    }
+    return scalar_trim_end(start, end);
+}
+
+__attribute__((target("sse2"))) static size_t sse2_identifier_length(const char *p, size_t length)
+{
+    size_t i = 0;
+    int mask;
+
+    while (length - i >= SSE2_WIDTH)
+    {
+        mask = ~_mm_movemask_epi8(sse2_identifier_bytes(_mm_loadu_si128((const __m128i *)(p + i)))) & 0xFFFF;
+        if (mask != 0)
+            return i + __builtin_ctz((unsigned)mask);
+        i += SSE2_WIDTH;
+    }
+    return i + scalar_identifier_length(p + i, length - i);
+}
+
+static const ScanOps sse2_ops = {
+    sse2_newline, sse2_skip_blanks, sse2_trim_end, sse2_identifier_length};
+
+/*****************/
+/* AVX2 scanners */
+/*****************/
+
+/* Marks the bytes of v that are blanks: ' ' or '\t'..'\r' */
+__attribute__((target("avx2"))) static __m256i avx2_blank_bytes(__m256i v)
+{
+    __m256i control = _mm256_sub_epi8(v, _mm256_set1_epi8('\t'));
+    __m256i in_range = _mm256_cmpeq_epi8(_mm256_min_epu8(control, _mm256_set1_epi8('\r' - '\t')), control);
+    return _mm256_or_si256(in_range, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')));
+}
+
+/* Marks the bytes of v that are ASCII letters or digits */
+__attribute__((target("avx2"))) static __m256i avx2_identifier_bytes(__m256i v)
+{
+    __m256i digit = _mm256_sub_epi8(v, _mm256_set1_epi8('0'));
+    __m256i letter = _mm256_sub_epi8(_mm256_or_si256(v, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+    __m256i is_digit = _mm256_cmpeq_epi8(_mm256_min_epu8(digit, _mm256_set1_epi8(9)), digit);
+    __m256i is_letter = _mm256_cmpeq_epi8(_mm256_min_epu8(letter, _mm256_set1_epi8('z' - 'a')), letter);
+    return _mm256_or_si256(is_digit, is_letter);
+}
+
+__attribute__((target("avx2"))) static const char *avx2_newline(const char *p, const char *end)
+{
+    const __m256i newline = _mm256_set1_epi8('\n');
+    unsigned mask;
+
+    while (end - p >= AVX2_WIDTH)
+    {
+        mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)p), newline));
+        if (mask != 0)
+            return p + __builtin_ctz(mask);
+        p += AVX2_WIDTH;
+    }
+    return sse2_newline(p, end);
+}
+
+__attribute__((target("avx2"))) static const char *avx2_skip_blanks(const char *p, const char *end)
+{
+    unsigned mask;
+
+    while (end - p >= AVX2_WIDTH)
+    {
+        mask = ~(unsigned)_mm256_movemask_epi8(avx2_blank_bytes(_mm256_loadu_si256((const __m256i *)p)));
+        if (mask != 0)
+            return p + __builtin_ctz(mask);
+        p += AVX2_WIDTH;
+    }
+    return sse2_skip_blanks(p, end);
+}
+
+__attribute__((target("avx2"))) static const char *avx2_trim_end(const char *start, const char *end)
+{
+    unsigned mask;
+
+    while (end - start >= AVX2_WIDTH)
+    {
+        mask = ~(unsigned)_mm256_movemask_epi8(avx2_blank_bytes(_mm256_loadu_si256((const __m256i *)(end - AVX2_WIDTH))));
+        if (mask != 0)
+            return end - AVX2_WIDTH + (31 - __builtin_clz(mask)) + 1;
+        end -= AVX2_WIDTH;
+    }
+    return sse2_trim_end(start, end);
+}
+
+__attribute__((target("avx2"))) static size_t avx2_identifier_length(const char *p, size_t length)
+{
+    size_t i = 0;
+    unsigned mask;
+
+    while (length - i >= AVX2_WIDTH)
+    {
+        mask = ~(unsigned)_mm256_movemask_epi8(avx2_identifier_bytes(_mm256_loadu_si256((const __m256i *)(p + i))));
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+        i += AVX2_WIDTH;
+    }
+    return i + sse2_identifier_length(p + i, length - i);
+}
+
+static const ScanOps avx2_ops = {
+    avx2_newline, avx2_skip_blanks, avx2_trim_end, avx2_identifier_length};
+
+#endif /* SCAN_HAVE_X86 */
+
+/*********************/
+/* Runtime selection */
+/*********************/
+
+static const ScanOps *active_ops = &scalar_ops;
+static ScanLevel active_level = SCAN_SCALAR;
+
+/* Checks if the CPU and the build support a scan level */
+static int level_supported(ScanLevel level)
+{
+    switch (level)
+    {
+    case SCAN_SCALAR:
+        return 1;
+#if SCAN_HAVE_X86
+    case SCAN_SSE2:
+        return __builtin_cpu_supports("sse2");
+    case SCAN_AVX2:
+        return __builtin_cpu_supports("avx2");
+#endif
+    default:
+        return 0;
+    }
+}
+
+/* Selects a scanner implementation */
+int scan_set_level(ScanLevel level)
+{
+    if (!level_supported(level))
+    {
+        return 1;
+    }
+
+    switch (level)
+    {
+#if SCAN_HAVE_X86
+    case SCAN_SSE2:
+        active_ops = &sse2_ops;
+        break;
+    case SCAN_AVX2:
+        active_ops = &avx2_ops;
+        break;
+#endif
+    default:
+        active_ops = &scalar_ops;
+        break;
+    }
+    active_level = level;
+    return 0;
+}
+
+/* Returns the scanner implementation currently in use */
+ScanLevel scan_get_level(void)
+{
+    return active_level;
+}
+
+#if SCAN_HAVE_X86
+/* Picks the fastest supported implementation before main runs, so the
+   selection is never raced by worker threads */
+__attribute__((constructor)) static void scan_select_best(void)
+{
+    __builtin_cpu_init();
+    if (scan_set_level(SCAN_AVX2) != 0)
+    {
+        scan_set_level(SCAN_SSE2);
+    }
+}
+#endif
+
+/* Dispatching entry points */
+
+const char *scan_newline(const char *p, const char *end)
+{
+    return active_ops->newline(p, end);
+}
+
+const char *scan_skip_blanks(const char *p, const char *end)
+{
+    return active_ops->skip_blanks(p, end);
+}
+
+const char *scan_trim_end(const char *start, const char *end)
+{
+    return active_ops->trim_end(start, end);
+}
+
+size_t scan_identifier_length(const char *p, size_t length)
+{
+    return active_ops->identifier_length(p, length);
+}
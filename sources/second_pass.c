@@ -1,208 +1,460 @@
 #include "assembler.h"
 #include "check.h"
+#include "output.h"
 
-#define MEMORY_START 100
-#define BINARY_LENGTH 16
-#define ADDRESS_BINARY_LENGTH 13
-#define OCTAL_STRING_LENGTH 8
-#define EXTERNAL_BINARY "000000000000001"
-#define RELOCATABLE_BINARY_SUFFIX "010"
+#define WORD_MASK 0x7FFF
+#define OPCODE_SHIFT 11
+#define SRC_ADDRESSING_SHIFT 7
+#define DST_ADDRESSING_SHIFT 3
+#define SRC_REG_SHIFT 6
+#define DST_REG_SHIFT 3
+#define ARE_BITS_WIDTH 3
+#define ARE_ABSOLUTE 0x4
+#define ARE_RELOCATABLE 0x2
+#define ARE_EXTERNAL 0x1
+#define IMMEDIATE_MASK 0xFFF
 #define MAX_FILENAME_LENGTH 260
 #define ADDRESS_FORMAT "%04d"
+#define OBJECT_LINE_SIZE 64
+#define OBJECT_WORD_LINE_LENGTH 11 /* "0100 01234\n" */
+#define ADDRESS_WIDTH 4 /* Digits of ADDRESS_FORMAT; larger addresses grow the line */
+#define OCTAL_WORD_WIDTH 5 /* A 15-bit word is five octal digits */
+#define ENTRY_LINE_SIZE (MAX_LABEL_LENGTH + 24)
 
 
 
-/* Function to perform the second pass of the assembler */
-void second_pass(AssemblerState *state, const char *input_filename, const char *output_filename, int *error)
+/* Stores one machine word in the memory image */
+static void store_word(AssemblerState *state, int address, int word)
 {
+    state->words[address] = (unsigned short)(word & WORD_MASK);
+}
 
+/* Records that the word at address refers to a symbol */
+static int add_relocation(AssemblerState *state, int address, int symbol, RelocationKind kind)
+{
+    Relocation *relocations;
+    int capacity;
 
-    FILE *inputFile;
-    FILE *outputFile;
-    
-    char binaryCode[BINARY_LENGTH] = {0};
-    char addressBinary[ADDRESS_BINARY_LENGTH] = {0};
-    int addressValue;
-    int binaryDecimal;
-    char octalStr[OCTAL_STRING_LENGTH] = {0};
+    if (state->relocation_count == state->relocation_capacity)
+    {
+        capacity = state->relocation_capacity ? state->relocation_capacity * 2 : INITIAL_TABLE_SIZE;
+        relocations = realloc(state->relocations, capacity * sizeof(Relocation));
+        if (!relocations)
+        {
+            report(state->diagnostics, SEVERITY_ERROR, DIAG_OUT_OF_MEMORY, 0, 0, "Failed to reallocate relocation table");
+            return 1;
+        }
+        state->relocations = relocations;
+        state->relocation_capacity = capacity;
+    }
+    state->relocations[state->relocation_count].address = address;
+    state->relocations[state->relocation_count].symbol = symbol;
+    state->relocations[state->relocation_count].kind = (unsigned char)kind;
+    state->relocation_count++;
+    return 0;
+}
 
-    int result1 ;
-    int result2 ;
-    char entFilename[MAX_FILENAME_LENGTH] = "";
-    char extFilename[MAX_FILENAME_LENGTH] = "";
-    int i, j;
-    int is_extern;
-    int line_number = 0;  /* Add a line number counter */
-    addressValue = -1;
-     binaryDecimal = 0;
-    result1 = 0;
-    result2 = 0;
-if (state == NULL || input_filename == NULL || output_filename == NULL || error == NULL) {
-    fprintf(stderr, "Error: Invalid input parameters to second_pass\n");
-    return;
-}
-    /* Open input file */
-
-    inputFile = fopen(input_filename, "r");
-    if (!inputFile)
-    {
-        perror("Error opening input file");
-        return;
+/* Makes sure the memory image can hold addresses below size */
+int ensure_memory_capacity(AssemblerState *state, int size)
+{
+    unsigned short *words;
+    int capacity = state->memory_capacity;
+
+    if (size <= capacity)
+    {
+        return 0;
     }
+    if (capacity == 0)
+    {
+        capacity = INITIAL_MEMORY_SIZE;
+    }
+    while (capacity < size)
+    {
+        capacity *= 2;
+    }
+    words = realloc(state->words, capacity * sizeof(unsigned short));
+    if (!words)
+    {
+        report(state->diagnostics, SEVERITY_ERROR, DIAG_OUT_OF_MEMORY, 0, 0, "Failed to reallocate memory");
+        return 1;
+    }
+    state->words = words;
+    state->memory_capacity = capacity;
+    return 0;
+}
+
+/* Writes the final word for a reference to a symbol; returns 1 for an undefined symbol */
+int resolve_symbol_word(AssemblerState *state, int symbol_index, int address, int line)
+{
+    const Symbol *symbol = &state->symbols[symbol_index];
 
-    /* Open output file */
-    outputFile = fopen(output_filename, "w");
-    if (!outputFile)
+    if (symbol->is_extern)
     {
-        perror("Error creating output file");
-        fclose(inputFile);
-        return;
+        store_word(state, address, ARE_EXTERNAL);
+        return add_relocation(state, address, symbol_index, RELOCATION_EXTERNAL);
     }
+    if (symbol->label == -1)
+    {
+        report(state->diagnostics, SEVERITY_ERROR, DIAG_UNDEFINED_LABEL, line, 0, "Undefined label '%s'", symbol->name);
+        store_word(state, address, 0);
+        return 1;
+    }
+    store_word(state, address, (state->label_table[symbol->label].address << ARE_BITS_WIDTH) | ARE_RELOCATABLE);
+    return add_relocation(state, address, symbol_index, RELOCATION_RELOCATABLE);
+}
 
-    /* Write IC and DC values at the beginning of the output file */
-    fprintf(outputFile, "%d %d\n", state->IC - MEMORY_START, state->DC);
+/* Encodes the extra word of an operand. In single-pass mode a symbol that
+   is not a known code label gets a placeholder and is patched later. */
+static int encode_operand(AssemblerState *state, const Statement *statement, const Operand *operand, int is_source, int address)
+{
+    const Symbol *symbol;
 
-    /* Process each memory location */
-    for (i = MEMORY_START; i < state->IC + state->DC; i++)
+    switch (operand->mode)
     {
-        line_number++;  /* Increment line number */
+    case ADDRESSING_IMMEDIATE:
+        store_word(state, address, ((operand->value & IMMEDIATE_MASK) << ARE_BITS_WIDTH) | ARE_ABSOLUTE);
+        return 0;
+    case ADDRESSING_INDIRECT_REGISTER:
+    case ADDRESSING_DIRECT_REGISTER:
+        store_word(state, address, ARE_ABSOLUTE | (operand->reg << (is_source ? SRC_REG_SHIFT : DST_REG_SHIFT)));
+        return 0;
+    default:
+        if (operand->symbol == NO_SYMBOL)
+        {
+            return 1;
+        }
+        if (!state->single_pass)
+        {
+            return resolve_symbol_word(state, operand->symbol, address, statement->line);
+        }
+        if (record_fixup(state, operand->symbol, address, statement->line) != 0)
+        {
+            return 1;
+        }
+        symbol = &state->symbols[operand->symbol];
+        if (!symbol->is_extern && symbol->label != -1 && !state->label_table[symbol->label].is_data)
+        {
+            return resolve_symbol_word(state, operand->symbol, address, statement->line);
+        }
+        store_word(state, address, 0);
+        return 0;
+    }
+}
 
-        if (state->memory[i].label[0] != '\0')
+/* Encodes the words of one instruction statement into the memory image */
+int encode_instruction(AssemblerState *state, const Statement *statement)
+{
+    int error = 0;
+    int address = statement->address;
+
+    store_word(state, address++, (statement->opcode << OPCODE_SHIFT) | (statement->src.mode << SRC_ADDRESSING_SHIFT) |
+                                     (statement->dst.mode << DST_ADDRESSING_SHIFT) | ARE_ABSOLUTE);
+
+    /* Two register operands share a single word */
+    if ((statement->src.mode == ADDRESSING_INDIRECT_REGISTER || statement->src.mode == ADDRESSING_DIRECT_REGISTER) &&
+        (statement->dst.mode == ADDRESSING_INDIRECT_REGISTER || statement->dst.mode == ADDRESSING_DIRECT_REGISTER))
+    {
+        store_word(state, address, ARE_ABSOLUTE | (statement->src.reg << SRC_REG_SHIFT) | (statement->dst.reg << DST_REG_SHIFT));
+        return 0;
+    }
+    if (statement->src.mode != ADDRESSING_NONE)
+    {
+        error |= encode_operand(state, statement, &statement->src, 1, address++);
+    }
+    if (statement->dst.mode != ADDRESSING_NONE)
+    {
+        error |= encode_operand(state, statement, &statement->dst, 0, address);
+    }
+    return error;
+}
+
+/* Places the data segment after the code in the memory image */
+int encode_data_segment(AssemblerState *state)
+{
+    int k;
+
+    if (ensure_memory_capacity(state, state->IC + state->DC) != 0)
+    {
+        return 1;
+    }
+    for (k = 0; k < state->DC; k++)
+    {
+        store_word(state, state->IC + k, state->data_values[k]);
+    }
+    state->memory_size = state->IC + state->DC - MEMORY_START;
+    return 0;
+}
+
+/* Builds the memory image from the statements recorded by the first pass */
+int encode_statements(AssemblerState *state)
+{
+    int error = 0;
+    int i;
+
+    /* Size the memory image once for the whole program */
+    if (ensure_memory_capacity(state, state->IC + state->DC) != 0)
+    {
+        return 1;
+    }
+
+    for (i = 0; i < state->statement_count && !diagnostics_budget_exhausted(state->diagnostics); i++)
+    {
+        if (state->statements[i].kind == STATEMENT_INSTRUCTION)
         {
-            is_extern = 0;
-            for (j = 0; j < state->extern_count; j++)
-            {
-                if (strcmp(state->extern_table[j].name, state->memory[i].label) == 0)
-                {
-                    is_extern = 1;
-                    break;
-                }
-            }
+            error |= encode_instruction(state, &state->statements[i]);
+        }
+    }
 
-            if (is_extern)
-            {
-strncpy(binaryCode, EXTERNAL_BINARY, BINARY_LENGTH - 1);
-binaryCode[BINARY_LENGTH - 1] = '\0';
-                binaryDecimal = binaryToDecimal(binaryCode);
-                decimalToOctal(binaryDecimal, octalStr);
-                fprintf(outputFile, ADDRESS_FORMAT " %s\n", i, octalStr);
-            }
-            else
-            {
-                addressValue = get_label_address(state, state->memory[i].label);
-                if (addressValue != -1)
-                {
-                    decimalToBinary12(addressValue, addressBinary);
+    return error | encode_data_segment(state);
+}
 
-strncpy(binaryCode, addressBinary, BINARY_LENGTH - 1);
-binaryCode[BINARY_LENGTH - 1] = '\0';
-strncat(binaryCode, RELOCATABLE_BINARY_SUFFIX, BINARY_LENGTH - strlen(binaryCode) - 1);
+/* Returns where the line of an address starts among the word lines of the
+   object file. Lines are OBJECT_WORD_LINE_LENGTH long until the address
+   outgrows ADDRESS_FORMAT, and one longer past every further power of ten. */
+size_t object_text_offset(int address)
+{
+    size_t offset = (size_t)(address - MEMORY_START) * OBJECT_WORD_LINE_LENGTH;
+    long bound;
 
-                    binaryDecimal = binaryToDecimal(binaryCode);
-                    decimalToOctal(binaryDecimal, octalStr);
-                    fprintf(outputFile, ADDRESS_FORMAT " %s\n", i, octalStr);
-                }
-                else
-                {
-                    fprintf(stderr, "Error at line %d: undefined label %s\n", line_number, state->memory[i].label);
-                    *error = 1;
-                }
-            }
+    for (bound = 10000; bound < address; bound *= 10)
+    {
+        offset += (size_t)(address - bound);
+    }
+    return offset;
+}
+
+/* Writes the object file lines of the words in [from, to) to out, as
+   ADDRESS_FORMAT " %05o\n" would, without going through sprintf */
+void render_object_words(const AssemblerState *state, char *out, int from, int to)
+{
+    char digits[16];
+    int count;
+    int value;
+    int word;
+    int i;
+
+    for (i = from; i < to; i++)
+    {
+        count = 0;
+        for (value = i; value > 0 || count < ADDRESS_WIDTH; value /= 10)
+        {
+            digits[count++] = (char)('0' + value % 10);
         }
-        else
+        while (count > 0)
+        {
+            *out++ = digits[--count];
+        }
+        *out++ = ' ';
+        word = state->words[i];
+        for (count = OCTAL_WORD_WIDTH - 1; count >= 0; count--)
         {
-            binaryDecimal = binaryToDecimal(state->memory[i].binary);
-            decimalToOctal(binaryDecimal, octalStr);
-            fprintf(outputFile, ADDRESS_FORMAT " %s\n", i, octalStr);
+            out[count] = (char)('0' + (word & 7));
+            word >>= 3;
         }
+        out += OCTAL_WORD_WIDTH;
+        *out++ = '\n';
     }
+}
 
-    /* Close input and output files */
-    fclose(inputFile);
-    fclose(outputFile);
+/* Builds the contents of the object file */
+int build_object_file(AssemblerState *state, TextBuffer *text)
+{
+    char line[OBJECT_LINE_SIZE];
+    int length;
+    int end = state->IC + state->DC;
+    size_t words_length = object_text_offset(end);
 
-    /* Create entry and extern files */
-    result1 = createEntryFile(state, input_filename, entFilename);
-    result2 = createExternFile(state, input_filename, extFilename);
-   
-    if(result1 == 1 || result2 == 1)
+    /* IC and DC first, then one line per word, rendered in place once
+       the buffer has exactly the size of the file */
+    length = sprintf(line, "%d %d\n", state->IC - MEMORY_START, state->DC);
+    if (text_buffer_reserve(text, (size_t)length + words_length) != 0 ||
+        text_buffer_append(text, line, (size_t)length) != 0)
+    {
+        return 1;
+    }
+    parallel_render_object(state, text->data + text->length, end);
+    text->length += words_length;
+    text->data[text->length] = '\0';
+    return 0;
+}
+
+/* Encodes the program and builds the contents of every output file */
+int build_output_files(AssemblerState *state, TextBuffer *object, TextBuffer *entries, TextBuffer *externs)
+{
+    int failed = 0;
+
+    /* Encode every statement and resolve symbol references,
+       unless the single-pass mode already did it during the first pass */
+    if (!state->single_pass && encode_statements(state) != 0)
+    {
+        return 1;
+    }
+
+    if (build_object_file(state, object) != 0)
+    {
+        report(state->diagnostics, SEVERITY_ERROR, DIAG_OUT_OF_MEMORY, 0, 0, "Failed to build the object file");
+        failed = 1;
+    }
+    failed |= build_entry_file(state, entries);
+    failed |= build_extern_file(state, externs);
+    return failed;
+}
+
+/* Function to perform the second pass of the assembler */
+void second_pass(AssemblerState *state, const char *input_filename, const char *output_filename, int *error)
+{
+    TextBuffer object = {NULL, 0, 0};
+    TextBuffer entries = {NULL, 0, 0};
+    TextBuffer externs = {NULL, 0, 0};
+    char entFilename[MAX_FILENAME_LENGTH] = "";
+    char extFilename[MAX_FILENAME_LENGTH] = "";
+    int failed = 0;
+
+    if (state == NULL || input_filename == NULL || output_filename == NULL || error == NULL) {
+        fprintf(stderr, "Error: Invalid input parameters to second_pass\n");
+        return;
+    }
+
+    /* Build every output in memory, so nothing is written if one of them fails */
+    failed = build_output_files(state, &object, &entries, &externs);
+    if (state->entry_count > 0)
+    {
+        createExtension(input_filename, entFilename, ".ent");
+    }
+    if (state->extern_count > 0)
     {
-        remove(entFilename);
-        remove(extFilename);
+        createExtension(input_filename, extFilename, ".ext");
+    }
+
+    if (!failed && output_commit_buffer(state->output, output_filename, &object) != 0)
+    {
+        report(state->diagnostics, SEVERITY_ERROR, DIAG_IO, 0, 0, "Cannot write %s: %s", output_filename, strerror(errno));
+        failed = 1;
+    }
+    if (!failed && entFilename[0] != '\0' && output_commit_buffer(state->output, entFilename, &entries) != 0)
+    {
+        report(state->diagnostics, SEVERITY_ERROR, DIAG_IO, 0, 0, "Cannot write %s: %s", entFilename, strerror(errno));
+        failed = 1;
+    }
+    if (!failed && extFilename[0] != '\0' && output_commit_buffer(state->output, extFilename, &externs) != 0)
+    {
+        report(state->diagnostics, SEVERITY_ERROR, DIAG_IO, 0, 0, "Cannot write %s: %s", extFilename, strerror(errno));
+        failed = 1;
+    }
+
+    /* Do not leave the outputs of an earlier run next to a failed one */
+    if (failed)
+    {
+        remove(output_filename);
+        if (entFilename[0] != '\0')
+            remove(entFilename);
+        if (extFilename[0] != '\0')
+            remove(extFilename);
         *error = 1;
     }
+
+    free(object.data);
+    free(entries.data);
+    free(externs.data);
 }
 
-/* Function to create the entry file */
-int createEntryFile(AssemblerState *state, const char *filename, char *entFilename)
+/* Builds the contents of the entry file */
+int build_entry_file(AssemblerState *state, TextBuffer *text)
 {
+    char line[ENTRY_LINE_SIZE];
+    int length;
     int error = 0;
-    FILE *entFile;
     int i;
 
-    if (state->entry_count > 0)
+    if (state->entry_count == 0)
     {
-        createExtension(filename, entFilename, ".ent");
-        entFile = fopen(entFilename, "w");
-        if (!entFile)
-        {
-            perror("Error creating entry file");
-            return 1;
-        }
-
-        for (i = 0; i < state->entry_count; i++)
+        return 0;
+    }
+    text_buffer_reserve(text, (size_t)state->entry_count * ENTRY_LINE_SIZE);
+    for (i = 0; i < state->entry_count; i++)
+    {
+        if (is_entry_label_defined(state, state->entry_table[i].name) == 0)
         {
-            if (is_entry_label_defined(state, state->entry_table[i].name) == 0)
+            length = sprintf(line, "%s " ADDRESS_FORMAT "\n", state->entry_table[i].name, state->entry_table[i].address);
+            if (text_buffer_append(text, line, (size_t)length) != 0)
             {
-                fprintf(entFile, "%s " ADDRESS_FORMAT "\n", state->entry_table[i].name, state->entry_table[i].address);
-            }
-            else
-            {
-                fprintf(stderr, "Error in entry file: label entry %s not found in symbol table\n", state->entry_table[i].name);
-                error = 1;
+                report(state->diagnostics, SEVERITY_ERROR, DIAG_OUT_OF_MEMORY, 0, 0, "Failed to build the entry file");
+                return 1;
             }
         }
-        fclose(entFile);
+        else
+        {
+            report(state->diagnostics, SEVERITY_ERROR, DIAG_INVALID_ENTRY, 0, 0, "Entry label '%s' is not defined", state->entry_table[i].name);
+            error = 1;
+        }
     }
-    
+
     return error;
 }
 
-/* Function to create the extern file */
-int createExternFile(AssemblerState *state, const char *filename, char *extFilename)
+/* Orders relocations by address */
+static int compare_relocations(const void *a, const void *b)
 {
+    const Relocation *x = a;
+    const Relocation *y = b;
+
+    return x->address < y->address ? -1 : (x->address > y->address);
+}
+
+/* Builds the contents of the extern file */
+int build_extern_file(AssemblerState *state, TextBuffer *text)
+{
+    char line[ENTRY_LINE_SIZE];
+    int length;
     int error = 0;
-    FILE *extFile;
+    int references = 0;
     int i, j;
+    int symbol;
+    const Relocation *relocation;
 
-    if (state->extern_count > 0)
+    if (state->extern_count == 0)
+    {
+        return 0;
+    }
+
+    /* Single-pass mode resolves references out of address order */
+    for (j = 1; j < state->relocation_count; j++)
     {
-        createExtension(filename, extFilename, ".ext");
-        extFile = fopen(extFilename, "w");
-        if (!extFile)
+        if (state->relocations[j].address < state->relocations[j - 1].address)
         {
-            perror("Error creating extern file");
-            return 1;
+            qsort(state->relocations, (size_t)state->relocation_count, sizeof(Relocation), compare_relocations);
+            break;
         }
+    }
+    for (j = 0; j < state->relocation_count; j++)
+    {
+        references += state->relocations[j].kind == RELOCATION_EXTERNAL;
+    }
+    text_buffer_reserve(text, (size_t)references * ENTRY_LINE_SIZE);
 
-        for (i = 0; i < state->extern_count; i++)
+    for (i = 0; i < state->extern_count; i++)
+    {
+        /* Check if the extern label is also defined as an entry label */
+        if (is_extern_label_defined_as_entry(state, state->extern_table[i].name) == 0)
         {
-            /* Check if the extern label is also defined as an entry label */
-            if (is_extern_label_defined_as_entry(state, state->extern_table[i].name) == 0)
-            {
-                fprintf(stderr, "Error in extern file: extern label %s is also defined as an entry label\n", state->extern_table[i].name);
-                error = 1;
-            }
-            for (j = MEMORY_START; j < state->IC + state->DC; j++)
+            report(state->diagnostics, SEVERITY_ERROR, DIAG_SYMBOL_CONFLICT, 0, 0, "External label '%s' is also declared as an entry", state->extern_table[i].name);
+            error = 1;
+        }
+        symbol = find_symbol(state, state->extern_table[i].name);
+        for (j = 0; j < state->relocation_count && symbol != NO_SYMBOL; j++)
+        {
+            relocation = &state->relocations[j];
+            if (relocation->kind == RELOCATION_EXTERNAL && relocation->symbol == symbol)
             {
-                if (strcmp(state->memory[j].label, state->extern_table[i].name) == 0)
+                length = sprintf(line, "%s " ADDRESS_FORMAT "\n", state->extern_table[i].name, relocation->address);
+                if (text_buffer_append(text, line, (size_t)length) != 0)
                 {
-                    fprintf(extFile, "%s " ADDRESS_FORMAT "\n", state->extern_table[i].name, j);
+                    report(state->diagnostics, SEVERITY_ERROR, DIAG_OUT_OF_MEMORY, 0, 0, "Failed to build the extern file");
+                    return 1;
                 }
             }
         }
-        fclose(extFile);
     }
-    
+
     return error;
 }
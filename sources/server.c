@@ -0,0 +1,830 @@
+/****************************************************************/
+/* Assembler server on a Unix domain socket, and its client */
+/****************************************************************/
+#define _POSIX_C_SOURCE 200112L
+
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "assembler.h"
+#include "digest.h"
+#include "server.h"
+
+#define MAX_FILENAME_LENGTH 260
+#define EXTENSION_ROOM 4              /* Longest extension added to a file name, ".ent" */
+#define MAX_HEADER_LENGTH 256
+#define MAX_NAME_LENGTH (MAX_FILENAME_LENGTH - EXTENSION_ROOM)
+#define MAX_REQUEST_BYTES (256UL << 20)
+#define LISTEN_BACKLOG 64
+#define CACHE_BUCKET_COUNT 1024
+#define CACHE_MAX_BYTES (256UL << 20) /* Keys and responses kept in the result cache */
+#define FNV_OFFSET 2166136261UL
+#define FNV_PRIME 16777619UL
+#define OUTPUT_COUNT 5                /* .am, .ob, .ent, .ext and diagnostics */
+
+/* One cached response, found by the request that produced it */
+typedef struct CacheEntry {
+    struct CacheEntry *next;          /* Next entry of the same bucket */
+    struct CacheEntry *newer;         /* Next entry in insertion order */
+    unsigned long hash;
+    char *key;
+    size_t key_length;
+    char *response;
+    size_t response_length;
+} CacheEntry;
+
+/* Responses by request, shared by every thread that assembles */
+struct ResultCache {
+    CacheEntry *buckets[CACHE_BUCKET_COUNT];
+    CacheEntry *oldest;               /* Evicted first when the cache is full */
+    CacheEntry *newest;
+    size_t bytes;
+    pthread_mutex_t lock;
+};
+
+/* The state shared by the worker threads of a server */
+typedef struct {
+    int listen_fd;
+    ResultCache *cache;
+} Server;
+
+/* A parsed response header */
+typedef struct {
+    int status;
+    int outputs;                      /* A sum of RESPONSE_ flags */
+    int ic;
+    int dc;
+    int errors;
+    int warnings;
+    unsigned long lengths[OUTPUT_COUNT];
+} ResponseHeader;
+
+/*****************/
+/* Socket I/O    */
+/*****************/
+
+/* Writes all of data to a socket, resuming after short writes */
+static int send_all(int fd, const char *data, size_t length)
+{
+    ssize_t count;
+
+    while (length > 0)
+    {
+        count = write(fd, data, length);
+        if (count < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return 1;
+        }
+        data += count;
+        length -= (size_t)count;
+    }
+    return 0;
+}
+
+/* Reads exactly length bytes from a socket; returns 1 on error or end of stream */
+static int receive_all(int fd, char *data, size_t length)
+{
+    ssize_t count;
+
+    while (length > 0)
+    {
+        count = read(fd, data, length);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            return 1;
+        data += count;
+        length -= (size_t)count;
+    }
+    return 0;
+}
+
+/* Reads a header line, without its newline. Returns 0 on success, -1 if
+   the stream ended before the line started and 1 on any other failure. */
+static int receive_header(int fd, char *line, size_t size)
+{
+    size_t length = 0;
+    ssize_t count;
+    char c;
+
+    for (;;)
+    {
+        count = read(fd, &c, 1);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            return length == 0 ? -1 : 1;
+        if (c == '\n')
+            break;
+        if (length + 1 >= size)
+            return 1;
+        line[length++] = c;
+    }
+    line[length] = '\0';
+    return 0;
+}
+
+/*****************/
+/* Result cache  */
+/*****************/
+
+/* FNV-1a hash of a cache key */
+static unsigned long hash_key(const char *key, size_t length)
+{
+    unsigned long hash = FNV_OFFSET;
+    size_t i;
+
+    for (i = 0; i < length; i++)
+    {
+        hash = (hash ^ (unsigned char)key[i]) * FNV_PRIME;
+    }
+    return hash;
+}
+
+/* Copies the cached response of a key into out; returns 1 if it is cached */
+static int cache_lookup(ResultCache *cache, const TextBuffer *key, unsigned long hash, TextBuffer *out)
+{
+    const CacheEntry *entry;
+    int found = 0;
+
+    pthread_mutex_lock(&cache->lock);
+    for (entry = cache->buckets[hash % CACHE_BUCKET_COUNT]; entry != NULL && !found; entry = entry->next)
+    {
+        if (entry->hash == hash && entry->key_length == key->length && memcmp(entry->key, key->data, key->length) == 0)
+        {
+            found = text_buffer_append(out, entry->response, entry->response_length) == 0;
+        }
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return found;
+}
+
+/* Drops the oldest entry of the cache; its lock must be held */
+static void cache_evict_oldest(ResultCache *cache)
+{
+    CacheEntry *entry = cache->oldest;
+    CacheEntry **link = &cache->buckets[entry->hash % CACHE_BUCKET_COUNT];
+
+    while (*link != entry)
+    {
+        link = &(*link)->next;
+    }
+    *link = entry->next;
+    cache->oldest = entry->newer;
+    if (cache->oldest == NULL)
+    {
+        cache->newest = NULL;
+    }
+    cache->bytes -= entry->key_length + entry->response_length;
+    free(entry->key);
+    free(entry->response);
+    free(entry);
+}
+
+/* Adds a response to the cache, evicting the oldest entries to make room.
+   Failing to cache is not an error; the request is only assembled again. */
+static void cache_insert(ResultCache *cache, const TextBuffer *key, unsigned long hash, const TextBuffer *response)
+{
+    CacheEntry *entry;
+    const CacheEntry *existing;
+    size_t size = key->length + response->length;
+
+    if (size > CACHE_MAX_BYTES / 4)
+    {
+        return;
+    }
+    entry = malloc(sizeof(CacheEntry));
+    if (!entry)
+    {
+        return;
+    }
+    entry->key = malloc(key->length);
+    entry->response = malloc(response->length);
+    if (!entry->key || !entry->response)
+    {
+        free(entry->key);
+        free(entry->response);
+        free(entry);
+        return;
+    }
+    memcpy(entry->key, key->data, key->length);
+    memcpy(entry->response, response->data, response->length);
+    entry->key_length = key->length;
+    entry->response_length = response->length;
+    entry->hash = hash;
+    entry->newer = NULL;
+
+    pthread_mutex_lock(&cache->lock);
+    for (existing = cache->buckets[hash % CACHE_BUCKET_COUNT]; existing != NULL; existing = existing->next)
+    {
+        if (existing->hash == hash && existing->key_length == key->length && memcmp(existing->key, key->data, key->length) == 0)
+        {
+            break; /* Another connection assembled the same source meanwhile */
+        }
+    }
+    if (existing == NULL)
+    {
+        while (cache->oldest != NULL && cache->bytes + size > CACHE_MAX_BYTES)
+        {
+            cache_evict_oldest(cache);
+        }
+        entry->next = cache->buckets[hash % CACHE_BUCKET_COUNT];
+        cache->buckets[hash % CACHE_BUCKET_COUNT] = entry;
+        if (cache->newest != NULL)
+            cache->newest->newer = entry;
+        else
+            cache->oldest = entry;
+        cache->newest = entry;
+        cache->bytes += size;
+        entry = NULL;
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    if (entry != NULL)
+    {
+        free(entry->key);
+        free(entry->response);
+        free(entry);
+    }
+}
+
+/* Creates an empty result cache */
+ResultCache *result_cache_create(void)
+{
+    ResultCache *cache = calloc(1, sizeof(ResultCache));
+
+    if (cache)
+    {
+        pthread_mutex_init(&cache->lock, NULL);
+    }
+    return cache;
+}
+
+/* Releases a result cache and every response in it */
+void result_cache_free(ResultCache *cache)
+{
+    if (!cache)
+    {
+        return;
+    }
+    while (cache->oldest != NULL)
+    {
+        cache_evict_oldest(cache);
+    }
+    pthread_mutex_destroy(&cache->lock);
+    free(cache);
+}
+
+/*****************/
+/* Server        */
+/*****************/
+
+/* Serializes the outputs of an assembly into a response */
+static int build_response(TextBuffer *out, int status, const AssembleResult *result)
+{
+    char header[MAX_HEADER_LENGTH];
+    const TextBuffer *payloads[OUTPUT_COUNT];
+    int outputs = 0;
+    int length;
+    int error;
+    int i;
+
+    payloads[0] = &result->expanded;
+    payloads[1] = &result->object;
+    payloads[2] = &result->entries;
+    payloads[3] = &result->externs;
+    payloads[4] = &result->diagnostics;
+    if (result->expanded.data != NULL)
+        outputs |= RESPONSE_EXPANDED;
+    if (status == 0)
+        outputs |= RESPONSE_OBJECT;
+    if (result->entries.length > 0)
+        outputs |= RESPONSE_ENTRIES;
+    if (result->externs.length > 0)
+        outputs |= RESPONSE_EXTERNS;
+
+    length = sprintf(header, PROTOCOL_MAGIC " %d %d %d %d %d %d %lu %lu %lu %lu %lu\n", status, outputs,
+                     result->ic, result->dc, result->error_count, result->warning_count,
+                     (unsigned long)result->expanded.length, (unsigned long)result->object.length,
+                     (unsigned long)result->entries.length, (unsigned long)result->externs.length,
+                     (unsigned long)result->diagnostics.length);
+    error = text_buffer_append(out, header, (size_t)length);
+    for (i = 0; i < OUTPUT_COUNT; i++)
+    {
+        if (payloads[i]->length > 0)
+        {
+            error |= text_buffer_append(out, payloads[i]->data, payloads[i]->length);
+        }
+    }
+    return error;
+}
+
+/* Builds the response for a source file the server could not read */
+static int build_read_failure(TextBuffer *out, const char *name, const char *path, int flags)
+{
+    char filename[MAX_FILENAME_LENGTH];
+    Diagnostics diagnostics;
+    AssembleResult result;
+    int error;
+
+    memset(&result, 0, sizeof(result));
+    result.ic = -1;
+    result.dc = -1;
+    diagnostics_init(&diagnostics, (flags & REQUEST_JSON_DIAGNOSTICS) ? DIAGNOSTICS_JSON : DIAGNOSTICS_TEXT);
+    sprintf(filename, "%s.as", name);
+    diagnostics_set_file(&diagnostics, filename);
+    report(&diagnostics, SEVERITY_ERROR, DIAG_IO, 0, 0, "Cannot read %s: %s", path, strerror(errno));
+    result.error_count = diagnostics.error_count;
+    error = diagnostics_render(&diagnostics, &result.diagnostics);
+    error |= build_response(out, 1, &result);
+    diagnostics_free(&diagnostics);
+    assemble_result_free(&result);
+    return error;
+}
+
+/* Returns the REQUEST_ flags that stand for a set of options */
+static int request_flags(const AssembleOptions *options)
+{
+    int flags = 0;
+
+    if (options->single_pass)
+        flags |= REQUEST_ONE_PASS;
+    if (options->diagnostics_format == DIAGNOSTICS_JSON)
+        flags |= REQUEST_JSON_DIAGNOSTICS;
+    return flags;
+}
+
+/* Appends the response for a source, from the cache when the same name,
+   options and contents were assembled before. The key holds the digest of
+   the contents rather than the contents, so its size is bounded. */
+int assemble_cached(ResultCache *cache, const char *name, const SourceBuffer *source, const AssembleOptions *options, TextBuffer *response)
+{
+    char prefix[MAX_HEADER_LENGTH];
+    unsigned char digest[DIGEST_LENGTH];
+    AssembleResult result;
+    TextBuffer key = {NULL, 0, 0};
+    unsigned long hash;
+    int status;
+    int error = 0;
+
+    sprintf(prefix, "%d %d %lu %lu\n", request_flags(options), options->max_errors, (unsigned long)strlen(name), (unsigned long)source->length);
+    digest_compute(source->data, source->length, digest);
+    error |= text_buffer_append(&key, prefix, strlen(prefix));
+    error |= text_buffer_append(&key, name, strlen(name));
+    error |= text_buffer_append(&key, (const char *)digest, DIGEST_LENGTH);
+    hash = error ? 0 : hash_key(key.data, key.length);
+
+    if (error || !cache_lookup(cache, &key, hash, response))
+    {
+        status = assemble_buffer(name, source->data, source->length, options, &result);
+        error |= build_response(response, status, &result);
+        assemble_result_free(&result);
+        if (!error)
+        {
+            cache_insert(cache, &key, hash, response);
+        }
+    }
+    free(key.data);
+    return error;
+}
+
+/* Answers one request whose header line was read; returns 1 if the connection must be closed */
+static int serve_request(Server *server, int fd, const char *line)
+{
+    char name[MAX_NAME_LENGTH];
+    AssembleOptions options;
+    SourceBuffer source;
+    TextBuffer response = {NULL, 0, 0};
+    unsigned long name_length;
+    unsigned long data_length;
+    char *data;
+    char kind;
+    int flags;
+    int max_errors;
+    int error;
+
+    if (sscanf(line, PROTOCOL_MAGIC " %c %d %d %lu %lu", &kind, &flags, &max_errors, &name_length, &data_length) != 5 ||
+        (kind != REQUEST_SOURCE && kind != REQUEST_PATH) || max_errors < 0 ||
+        name_length == 0 || name_length >= MAX_NAME_LENGTH || data_length > MAX_REQUEST_BYTES)
+    {
+        return 1;
+    }
+    data = malloc(data_length + 1);
+    if (!data)
+    {
+        return 1;
+    }
+    if (receive_all(fd, name, name_length) != 0 || receive_all(fd, data, data_length) != 0)
+    {
+        free(data);
+        return 1;
+    }
+    name[name_length] = '\0';
+    data[data_length] = '\0';
+
+    /* A path request is answered from the contents of the file, so the
+       cache sees edits exactly like it sees new inline sources. The file
+       is copied, not mapped: truncating a mapped file while it is read
+       would raise SIGBUS and take the whole server down. */
+    if (kind == REQUEST_PATH)
+    {
+        if (source_read(&source, data) != 0)
+        {
+            error = build_read_failure(&response, name, data, flags) || send_all(fd, response.data, response.length);
+            free(response.data);
+            free(data);
+            return error;
+        }
+    }
+    else
+    {
+        memset(&source, 0, sizeof(source));
+        source.data = data;
+        source.length = data_length;
+    }
+
+    assemble_options_init(&options);
+    options.single_pass = (flags & REQUEST_ONE_PASS) != 0;
+    options.max_errors = max_errors;
+    options.diagnostics_format = (flags & REQUEST_JSON_DIAGNOSTICS) ? DIAGNOSTICS_JSON : DIAGNOSTICS_TEXT;
+    error = assemble_cached(server->cache, name, &source, &options, &response);
+    error = error || send_all(fd, response.data, response.length);
+    if (kind == REQUEST_PATH)
+    {
+        source_close(&source);
+    }
+    free(response.data);
+    free(data);
+    return error;
+}
+
+/* Worker thread: serves one connection at a time until the listener is shut down */
+static void *server_worker(void *arg)
+{
+    Server *server = arg;
+    char line[MAX_HEADER_LENGTH];
+    int fd;
+
+    for (;;)
+    {
+        fd = accept(server->listen_fd, NULL, NULL);
+        if (fd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            break;
+        }
+        while (receive_header(fd, line, sizeof(line)) == 0 && serve_request(server, fd, line) == 0)
+        {
+        }
+        close(fd);
+    }
+    return NULL;
+}
+
+/* Fills a socket address; returns 1 if the path is too long */
+static int socket_address(struct sockaddr_un *address, const char *path)
+{
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address->sun_path))
+    {
+        errno = ENAMETOOLONG;
+        return 1;
+    }
+    strcpy(address->sun_path, path);
+    return 0;
+}
+
+/* Connects to a socket; returns the descriptor, or -1 */
+static int connect_socket(const char *path)
+{
+    struct sockaddr_un address;
+    int saved_errno;
+    int fd;
+
+    if (socket_address(&address, path) != 0)
+    {
+        return -1;
+    }
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd >= 0 && connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0)
+    {
+        saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        fd = -1;
+    }
+    return fd;
+}
+
+/* Creates the listening socket, replacing a stale one; returns the descriptor, or -1 */
+static int open_listener(const char *path)
+{
+    struct sockaddr_un address;
+    int saved_errno;
+    int probe;
+    int fd;
+
+    if (socket_address(&address, path) != 0)
+    {
+        return -1;
+    }
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    if (bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0)
+    {
+        /* A socket nobody listens on is left over from a server that died */
+        probe = errno == EADDRINUSE ? connect_socket(path) : -1;
+        if (probe >= 0)
+        {
+            close(probe);
+            errno = EADDRINUSE;
+        }
+        if (probe >= 0 || errno != ECONNREFUSED || unlink(path) != 0 ||
+            bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0)
+        {
+            saved_errno = errno;
+            close(fd);
+            errno = saved_errno;
+            return -1;
+        }
+    }
+    if (listen(fd, LISTEN_BACKLOG) != 0)
+    {
+        saved_errno = errno;
+        close(fd);
+        unlink(path);
+        errno = saved_errno;
+        return -1;
+    }
+    return fd;
+}
+
+/* Serves assemble requests on a Unix domain socket until SIGINT or SIGTERM */
+int server_run(const char *socket_path, int threads)
+{
+    static Server server;       /* Detached workers may still use it after returning */
+    sigset_t blocked;
+    sigset_t stop;
+    pthread_t thread;
+    int started = 0;
+    int signal_number;
+    int i;
+
+    /* Workers inherit the mask: the stop signals are only taken by sigwait
+       below, and a client that hangs up makes write fail instead of SIGPIPE */
+    sigemptyset(&stop);
+    sigaddset(&stop, SIGINT);
+    sigaddset(&stop, SIGTERM);
+    blocked = stop;
+    sigaddset(&blocked, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &blocked, NULL);
+
+    server.listen_fd = open_listener(socket_path);
+    if (server.listen_fd < 0)
+    {
+        fprintf(stderr, "Error: Cannot listen on %s: %s\n", socket_path, strerror(errno));
+        return 1;
+    }
+    server.cache = result_cache_create();
+    if (!server.cache)
+    {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        close(server.listen_fd);
+        unlink(socket_path);
+        return 1;
+    }
+
+    for (i = 0; i < threads; i++)
+    {
+        if (pthread_create(&thread, NULL, server_worker, &server) == 0)
+        {
+            pthread_detach(thread);
+            started++;
+        }
+    }
+    if (started == 0)
+    {
+        fprintf(stderr, "Error: Cannot start the server threads\n");
+        close(server.listen_fd);
+        unlink(socket_path);
+        return 1;
+    }
+
+    printf("Serving on %s with %d thread%s\n", socket_path, started, started == 1 ? "" : "s");
+    fflush(stdout);
+    sigwait(&stop, &signal_number);
+
+    /* Stop accepting; connections still open end with the process */
+    shutdown(server.listen_fd, SHUT_RDWR);
+    unlink(socket_path);
+    return 0;
+}
+
+/*****************/
+/* Client        */
+/*****************/
+
+/* Reports a source file that could not be read, in the chosen format */
+void report_unreadable_source(const char *filename, DiagnosticsFormat format)
+{
+    Diagnostics diagnostics;
+
+    diagnostics_init(&diagnostics, format);
+    diagnostics_set_file(&diagnostics, filename);
+    report(&diagnostics, SEVERITY_ERROR, DIAG_IO, 0, 0, "Cannot read %s: %s", filename, strerror(errno));
+    diagnostics_flush(&diagnostics, stderr);
+    diagnostics_free(&diagnostics);
+}
+
+/* Parses a response header line; total receives the length of the payloads */
+static int parse_response_header(const char *line, ResponseHeader *header, unsigned long *total)
+{
+    int i;
+
+    if (sscanf(line, PROTOCOL_MAGIC " %d %d %d %d %d %d %lu %lu %lu %lu %lu", &header->status, &header->outputs,
+               &header->ic, &header->dc, &header->errors, &header->warnings, &header->lengths[0], &header->lengths[1],
+               &header->lengths[2], &header->lengths[3], &header->lengths[4]) != 11)
+    {
+        return 1;
+    }
+    *total = 0;
+    for (i = 0; i < OUTPUT_COUNT; i++)
+    {
+        if (header->lengths[i] > MAX_REQUEST_BYTES)
+            return 1;
+        *total += header->lengths[i];
+    }
+    return 0;
+}
+
+/* Sends one source and reads the whole response */
+static int exchange(int fd, const char *name, const SourceBuffer *source, const AssembleOptions *options, TextBuffer *response)
+{
+    char line[MAX_HEADER_LENGTH];
+    ResponseHeader header;
+    unsigned long total;
+    int length;
+
+    length = sprintf(line, PROTOCOL_MAGIC " %c %d %d %lu %lu\n", REQUEST_SOURCE, request_flags(options), options->max_errors,
+                     (unsigned long)strlen(name), (unsigned long)source->length);
+    if (send_all(fd, line, (size_t)length) != 0 || send_all(fd, name, strlen(name)) != 0 ||
+        send_all(fd, source->data, source->length) != 0)
+    {
+        return 1;
+    }
+
+    if (receive_header(fd, line, sizeof(line)) != 0 || parse_response_header(line, &header, &total) != 0)
+    {
+        return 1;
+    }
+    length = (int)strlen(line);
+    line[length++] = '\n';
+    if (text_buffer_reserve(response, (size_t)length + total) != 0 ||
+        text_buffer_append(response, line, (size_t)length) != 0 ||
+        receive_all(fd, response->data + response->length, total) != 0)
+    {
+        return 1;
+    }
+    response->length += total;
+    return 0;
+}
+
+/* Commits or removes the output files of one response, like the command line
+   does; returns 1 if a file could not be written */
+static int write_outputs(const char *name, const ResponseHeader *header, const char *payload, OutputStats *stats)
+{
+    static const char *extensions[] = {".am", ".ob", ".ent", ".ext"};
+    static const int flags[] = {RESPONSE_EXPANDED, RESPONSE_OBJECT, RESPONSE_ENTRIES, RESPONSE_EXTERNS};
+    char filename[MAX_FILENAME_LENGTH];
+    int failed = 0;
+    int i;
+
+    for (i = 0; i < OUTPUT_COUNT - 1; i++)
+    {
+        sprintf(filename, "%s%s", name, extensions[i]);
+        if (!failed && (header->outputs & flags[i]) &&
+            output_commit(stats, filename, payload, (size_t)header->lengths[i]) != 0)
+        {
+            fprintf(stderr, "Error: Cannot write %s: %s\n", filename, strerror(errno));
+            failed = 1;
+        }
+        payload += header->lengths[i];
+    }
+
+    /* Do not leave the outputs of an earlier run next to a failed one */
+    for (i = 0; i < OUTPUT_COUNT - 1; i++)
+    {
+        sprintf(filename, "%s%s", name, extensions[i]);
+        if (i == 0 ? !(header->outputs & RESPONSE_EXPANDED) : (failed || (header->status != 0 && header->ic >= 0)))
+        {
+            remove(filename);
+        }
+    }
+    return failed;
+}
+
+/* Writes the output files of a response, then its progress message and diagnostics */
+int apply_response(const char *name, const TextBuffer *response, const ClientOptions *options, OutputStats *stats)
+{
+    ResponseHeader header;
+    const char *newline = response->data != NULL ? memchr(response->data, '\n', response->length) : NULL;
+    const char *payload;
+    char line[MAX_HEADER_LENGTH];
+    unsigned long total;
+    int failed;
+
+    if (newline == NULL || (size_t)(newline - response->data) >= sizeof(line))
+    {
+        return 1;
+    }
+    memcpy(line, response->data, (size_t)(newline - response->data));
+    line[newline - response->data] = '\0';
+    payload = newline + 1;
+    if (parse_response_header(line, &header, &total) != 0 || (size_t)(payload - response->data) + total != response->length)
+    {
+        return 1;
+    }
+
+    failed = write_outputs(name, &header, payload, stats) || header.status != 0;
+    if (!failed && !options->quiet)
+    {
+        printf("Assembler process finished successfully for file: %s\n", name);
+        fflush(stdout);
+    }
+    if (header.lengths[OUTPUT_COUNT - 1] > 0)
+    {
+        fwrite(payload + total - header.lengths[OUTPUT_COUNT - 1], 1, (size_t)header.lengths[OUTPUT_COUNT - 1], stderr);
+        fflush(stderr);
+    }
+    return failed;
+}
+
+/* Assembles files through a running server */
+int client_run(const char *socket_path, char **names, int name_count, const ClientOptions *options)
+{
+    char filename[MAX_FILENAME_LENGTH];
+    OutputStats stats;
+    SourceBuffer source;
+    TextBuffer response = {NULL, 0, 0};
+    int stopped = 0;
+    int failed;
+    int fd;
+    int i;
+
+    fd = connect_socket(socket_path);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Error: Cannot connect to %s: %s\n", socket_path, strerror(errno));
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    memset(&stats, 0, sizeof(stats));
+    stats.skip_unchanged = options->skip_unchanged;
+
+    for (i = 0; i < name_count && !stopped; i++)
+    {
+        if (strlen(names[i]) >= MAX_NAME_LENGTH)
+        {
+            fprintf(stderr, "Error: File name too long: %s\n", names[i]);
+            stopped = options->fail_fast;
+            continue;
+        }
+        sprintf(filename, "%s.as", names[i]);
+        if (source_open(&source, filename) != 0)
+        {
+            report_unreadable_source(filename, options->assemble.diagnostics_format);
+            stopped = options->fail_fast;
+            continue;
+        }
+
+        response.length = 0;
+        failed = exchange(fd, names[i], &source, &options->assemble, &response);
+        source_close(&source);
+        if (failed)
+        {
+            fprintf(stderr, "Error: Lost the connection to %s\n", socket_path);
+            stopped = 1;
+            break;
+        }
+        failed = apply_response(names[i], &response, options, &stats);
+        stopped = failed && options->fail_fast;
+    }
+
+    if (options->skip_unchanged && !options->quiet)
+    {
+        printf("Skipped %d unchanged output file%s\n", stats.unchanged, stats.unchanged == 1 ? "" : "s");
+    }
+    free(response.data);
+    close(fd);
+    return stopped;
+}
@@ -0,0 +1,305 @@
+/****************************************************************/
+/* Input layer: whole-file source buffers and line views */
+/****************************************************************/
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "source.h"
+#include "scan.h"
+
+#define READ_CHUNK_SIZE 65536
+#define INITIAL_TEXT_CAPACITY 4096
+#define PREFAULT_STRIDE 4096 /* No page is smaller */
+
+/* Reads a descriptor that cannot be mapped (pipes, terminals) until end of file */
+static int read_whole_descriptor(int fd, size_t size_hint, SourceBuffer *source)
+{
+    char *data;
+    char *grown;
+    size_t length = 0;
+    size_t capacity;
+    ssize_t count;
+
+    capacity = size_hint > 0 ? size_hint + 1 : READ_CHUNK_SIZE;
+    data = malloc(capacity);
+    if (data == NULL)
+    {
+        return 1;
+    }
+
+    for (;;)
+    {
+        if (length == capacity)
+        {
+            capacity *= 2;
+            grown = realloc(data, capacity);
+            if (grown == NULL)
+            {
+                free(data);
+                return 1;
+            }
+            data = grown;
+        }
+
+        count = read(fd, data + length, capacity - length);
+        if (count < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            free(data);
+            return 1;
+        }
+        if (count == 0)
+            break;
+        length += (size_t)count;
+    }
+
+    source_from_memory(source, data, length);
+    return 0;
+}
+
+/* Reads the standard input into a source buffer */
+int source_read_stdin(SourceBuffer *source)
+{
+    memset(source, 0, sizeof(*source));
+    source->data = "";
+    return read_whole_descriptor(STDIN_FILENO, 0, source);
+}
+
+/* Loads a file into a source buffer, mapping it if allowed and possible */
+static int load_file(SourceBuffer *source, const char *filename, int allow_mapping)
+{
+    int fd;
+    struct stat info;
+    void *mapping;
+    int result;
+    int saved_errno;
+
+    memset(source, 0, sizeof(*source));
+    source->data = "";
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        return 1;
+    }
+
+    if (fstat(fd, &info) != 0)
+    {
+        saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return 1;
+    }
+
+    if (allow_mapping && S_ISREG(info.st_mode) && info.st_size > 0)
+    {
+        mapping = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping != MAP_FAILED)
+        {
+            source->mapping = mapping;
+            source->mapping_length = (size_t)info.st_size;
+            source->data = mapping;
+            source->length = (size_t)info.st_size;
+            close(fd);
+            return 0;
+        }
+    }
+    else if (S_ISREG(info.st_mode) && info.st_size == 0)
+    {
+        /* Empty file: nothing to map or read */
+        close(fd);
+        return 0;
+    }
+
+    result = read_whole_descriptor(fd, S_ISREG(info.st_mode) ? (size_t)info.st_size : 0, source);
+    saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+    return result;
+}
+
+/* Loads a file into a source buffer, mapping it when possible */
+int source_open(SourceBuffer *source, const char *filename)
+{
+    return load_file(source, filename, 1);
+}
+
+/* Loads a file into a private heap buffer */
+int source_read(SourceBuffer *source, const char *filename)
+{
+    return load_file(source, filename, 0);
+}
+
+/* Touches every page of a source buffer so it is resident before it is parsed */
+void source_prefault(const SourceBuffer *source)
+{
+    volatile char sink = 0;
+    size_t i;
+
+    for (i = 0; i < source->length; i += PREFAULT_STRIDE)
+    {
+        sink ^= source->data[i];
+    }
+    (void)sink;
+}
+
+/* Creates a source buffer that owns a heap buffer */
+void source_from_memory(SourceBuffer *source, char *data, size_t length)
+{
+    memset(source, 0, sizeof(*source));
+    source->owned = data;
+    source->data = data != NULL ? data : "";
+    source->length = data != NULL ? length : 0;
+}
+
+/* Releases the memory or mapping held by a source buffer */
+void source_close(SourceBuffer *source)
+{
+    if (source->mapping != NULL)
+    {
+        munmap(source->mapping, source->mapping_length);
+    }
+    free(source->owned);
+    memset(source, 0, sizeof(*source));
+    source->data = "";
+}
+
+/* Starts reading lines from the beginning of a source buffer */
+void line_reader_init(LineReader *reader, const SourceBuffer *source)
+{
+    reader->source = source;
+    reader->offset = 0;
+    reader->line_number = 0;
+}
+
+/* Returns the next line of the source buffer */
+int line_reader_next(LineReader *reader, LineView *line)
+{
+    const char *start;
+    const char *end;
+    const char *newline;
+    size_t remaining;
+
+    if (reader->offset >= reader->source->length)
+    {
+        return 0;
+    }
+
+    start = reader->source->data + reader->offset;
+    remaining = reader->source->length - reader->offset;
+    end = scan_newline(start, start + remaining);
+    newline = end < start + remaining ? end : NULL;
+
+    line->start = start;
+    line->length = (size_t)(end - start);
+    line->has_newline = newline != NULL;
+    line->number = ++reader->line_number;
+
+    reader->offset += line->length + (newline != NULL ? 1 : 0);
+    return 1;
+}
+
+/* Copies a whole line into a text buffer, keeping its newline */
+int line_view_copy(const LineView *line, TextBuffer *text)
+{
+    int error = 0;
+
+    text->length = 0;
+    error |= text_buffer_append(text, line->start, line->length);
+    if (line->has_newline)
+    {
+        error |= text_buffer_append(text, "\n", 1);
+    }
+    return error;
+}
+
+/* Grows a text buffer to hold needed bytes; doubles unless the exact size is asked for */
+static int grow_text(TextBuffer *text, size_t needed, int exact)
+{
+    size_t capacity;
+    char *grown;
+
+    if (needed <= text->capacity)
+    {
+        return 0;
+    }
+    capacity = needed;
+    if (!exact)
+    {
+        capacity = text->capacity > 0 ? text->capacity : INITIAL_TEXT_CAPACITY;
+        while (needed > capacity)
+        {
+            capacity *= 2;
+        }
+    }
+    grown = realloc(text->data, capacity);
+    if (grown == NULL)
+    {
+        return 1;
+    }
+    text->data = grown;
+    text->capacity = capacity;
+    return 0;
+}
+
+/* Makes room for exactly length more characters and the terminator in a text buffer */
+int text_buffer_reserve(TextBuffer *text, size_t length)
+{
+    return grow_text(text, text->length + length + 1, 1);
+}
+
+/* Appends characters to a text buffer, growing it as needed */
+int text_buffer_append(TextBuffer *text, const char *str, size_t length)
+{
+    if (grow_text(text, text->length + length + 1, 0) != 0)
+    {
+        return 1;
+    }
+
+    memcpy(text->data + text->length, str, length);
+    text->length += length;
+    text->data[text->length] = '\0';
+    return 0;
+}
+
+/* Appends a string as a quoted, escaped JSON string */
+int text_buffer_append_json(TextBuffer *text, const char *str)
+{
+    static const char hex[] = "0123456789abcdef";
+    char escape[7];
+    const char *run = str;
+    int error = 0;
+
+    error |= text_buffer_append(text, "\"", 1);
+    for (; *str != '\0'; str++)
+    {
+        if (*str != '"' && *str != '\\' && (unsigned char)*str >= ' ')
+            continue;
+        error |= text_buffer_append(text, run, (size_t)(str - run));
+        escape[0] = '\\';
+        if (*str == '"' || *str == '\\')
+        {
+            escape[1] = *str;
+            error |= text_buffer_append(text, escape, 2);
+        }
+        else
+        {
+            memcpy(escape + 1, "u00", 3);
+            escape[4] = hex[((unsigned char)*str >> 4) & 0xF];
+            escape[5] = hex[(unsigned char)*str & 0xF];
+            error |= text_buffer_append(text, escape, 6);
+        }
+        run = str + 1;
+    }
+    error |= text_buffer_append(text, run, (size_t)(str - run));
+    error |= text_buffer_append(text, "\"", 1);
+    return error;
+}
@@ -0,0 +1,117 @@
+/****************************************************************/
+/* Reentrant line tokenizer used by the first pass */
+/****************************************************************/
+#include <string.h>
+#include "tokenizer.h"
+#include "scan.h"
+
+#define LABEL_SUFFIX ':'
+#define OPERAND_SEPARATOR ','
+
+/* Builds a span for [start, end) of the line, dropping surrounding blanks */
+static Span make_trimmed_span(const char *line, const char *start, const char *end)
+{
+    Span span;
+
+    start = scan_skip_blanks(start, end);
+    end = scan_trim_end(start, end);
+
+    span.start = start;
+    span.length = (int)(end - start);
+    span.column = span.length > 0 ? (int)(start - line) + 1 : 0;
+    return span;
+}
+
+/* Splits a line into label, mnemonic and operand spans without modifying it */
+int tokenize_line(const char *line, size_t length, LineTokens *tokens)
+{
+    const char *end = line + length;
+    const char *p;
+    const char *word_end;
+    const char *colon;
+    const char *piece;
+
+    memset(tokens, 0, sizeof(*tokens));
+
+    p = scan_skip_blanks(line, end);
+    if (p == end)
+    {
+        return 0;
+    }
+
+    /* The first word is a label definition if it contains a colon */
+    word_end = p;
+    colon = NULL;
+    while (word_end < end && !scan_is_blank(*word_end))
+    {
+        if (*word_end == LABEL_SUFFIX && colon == NULL)
+            colon = word_end;
+        word_end++;
+    }
+
+    if (colon != NULL)
+    {
+        tokens->has_label = 1;
+        tokens->label = make_trimmed_span(line, p, colon);
+        tokens->label.column = (int)(p - line) + 1;
+        p = scan_skip_blanks(colon + 1, end);
+        word_end = p;
+        while (word_end < end && !scan_is_blank(*word_end))
+            word_end++;
+    }
+
+    tokens->op = make_trimmed_span(line, p, word_end);
+    tokens->rest = make_trimmed_span(line, word_end, end);
+
+    /* Split the remaining text on commas */
+    if (tokens->rest.length > 0)
+    {
+        piece = tokens->rest.start;
+        p = piece;
+        end = tokens->rest.start + tokens->rest.length;
+        for (;;)
+        {
+            if (p == end || *p == OPERAND_SEPARATOR)
+            {
+                if (tokens->operand_count < MAX_LINE_OPERANDS)
+                {
+                    tokens->operands[tokens->operand_count] = make_trimmed_span(line, piece, p);
+                }
+                tokens->operand_count++;
+                if (p == end)
+                    break;
+                piece = p + 1;
+            }
+            p++;
+        }
+    }
+
+    return 1;
+}
+
+/* Compares a span with a null-terminated string */
+int span_equals(Span span, const char *str)
+{
+    return (int)strlen(str) == span.length && strncmp(span.start, str, span.length) == 0;
+}
+
+/* Copies a span into a null-terminated buffer, truncating if needed */
+char *span_copy(Span span, char *buffer, size_t size)
+{
+    size_t length = (size_t)span.length;
+
+    if (size == 0)
+    {
+        return buffer;
+    }
+    if (length >= size)
+    {
+        length = size - 1;
+    }
+    if (length > 0)
+    {
+        memcpy(buffer, span.start, length);
+    }
+    buffer[length] = '\0';
+    return buffer;
+}
@@ -0,0 +1,194 @@
+/****************************************************************/
+/* Watch mode: reassembling input files when they are saved */
+/****************************************************************/
+#define _POSIX_C_SOURCE 200112L
+
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include "assembler.h"
+#include "watch.h"
+
+#define MAX_FILENAME_LENGTH 260
+#define DEBOUNCE_MS 15 /* Quiet time that ends a burst of changes */
+#define EVENT_BUFFER_SIZE 4096
+#define WATCH_MASK (IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE)
+
+/* One input file and the directory watch that covers it */
+typedef struct {
+    char *name;                         /* As given, without extension */
+    char path[MAX_FILENAME_LENGTH];     /* name.as */
+    const char *base;                   /* The part of path after its directory */
+    int wd;
+    int dirty;                          /* Changed since it was last assembled */
+} WatchedFile;
+
+/* Assembles one file through the cache and writes its outputs */
+static void assemble_file(ResultCache *cache, const WatchedFile *file, const ClientOptions *options, OutputStats *stats)
+{
+    SourceBuffer source;
+    TextBuffer response = {NULL, 0, 0};
+
+    /* The file was just saved and may be rewritten again; a copy cannot fault like a mapping */
+    if (source_read(&source, file->path) != 0)
+    {
+        report_unreadable_source(file->path, options->assemble.diagnostics_format);
+        return;
+    }
+    if (assemble_cached(cache, file->name, &source, &options->assemble, &response) != 0)
+    {
+        fprintf(stderr, "Error: Memory allocation failed while assembling %s\n", file->path);
+    }
+    else
+    {
+        apply_response(file->name, &response, options, stats);
+    }
+    source_close(&source);
+    free(response.data);
+}
+
+/* Starts watching the directory of a file; returns 1 on failure */
+static int watch_directory(int fd, WatchedFile *file)
+{
+    char directory[MAX_FILENAME_LENGTH];
+    const char *slash = strrchr(file->path, '/');
+
+    file->base = slash != NULL ? slash + 1 : file->path;
+    if (slash == NULL)
+    {
+        strcpy(directory, ".");
+    }
+    else if (slash == file->path)
+    {
+        strcpy(directory, "/");
+    }
+    else
+    {
+        memcpy(directory, file->path, (size_t)(slash - file->path));
+        directory[slash - file->path] = '\0';
+    }
+    file->wd = inotify_add_watch(fd, directory, WATCH_MASK);
+    if (file->wd < 0)
+    {
+        fprintf(stderr, "Error: Cannot watch %s: %s\n", directory, strerror(errno));
+        return 1;
+    }
+    return 0;
+}
+
+/* Marks the files an event is about; returns 1 if one of them is watched */
+static int mark_changed(WatchedFile *files, int file_count, const struct inotify_event *event)
+{
+    int marked = 0;
+    int i;
+
+    for (i = 0; i < file_count && event->len > 0; i++)
+    {
+        if (files[i].wd == event->wd && strcmp(files[i].base, event->name) == 0)
+        {
+            files[i].dirty = 1;
+            marked = 1;
+        }
+    }
+    return marked;
+}
+
+/* Assembles files, then again each time they change, until interrupted */
+int watch_run(char **names, int name_count, const ClientOptions *options)
+{
+    union {
+        struct inotify_event event;     /* Keeps the buffer aligned for events */
+        char bytes[EVENT_BUFFER_SIZE];
+    } buffer;
+    const struct inotify_event *event;
+    WatchedFile *files;
+    ResultCache *cache;
+    OutputStats stats;
+    struct pollfd watch;
+    ssize_t length;
+    ssize_t offset;
+    int pending = 0;
+    int ready;
+    int i;
+
+    files = calloc((size_t)(name_count > 0 ? name_count : 1), sizeof(WatchedFile));
+    cache = result_cache_create();
+    watch.fd = inotify_init();
+    watch.events = POLLIN;
+    if (!files || !cache || watch.fd < 0)
+    {
+        fprintf(stderr, "Error: Cannot start watching: %s\n", strerror(errno));
+        goto failed;
+    }
+
+    for (i = 0; i < name_count; i++)
+    {
+        if (strlen(names[i]) + 3 >= MAX_FILENAME_LENGTH)
+        {
+            fprintf(stderr, "Error: File name too long: %s\n", names[i]);
+            goto failed;
+        }
+        files[i].name = names[i];
+        sprintf(files[i].path, "%s.as", names[i]);
+        if (watch_directory(watch.fd, &files[i]) != 0)
+        {
+            goto failed;
+        }
+        files[i].dirty = 1;
+    }
+    memset(&stats, 0, sizeof(stats));
+    stats.skip_unchanged = options->skip_unchanged;
+    if (!options->quiet)
+    {
+        printf("Watching %d file%s for changes; press Ctrl-C to stop\n", name_count, name_count == 1 ? "" : "s");
+        fflush(stdout);
+    }
+
+    /* Every file starts dirty, so the first round assembles them all */
+    pending = 1;
+    for (;;)
+    {
+        if (pending)
+        {
+            for (i = 0; i < name_count; i++)
+            {
+                if (files[i].dirty)
+                {
+                    files[i].dirty = 0;
+                    assemble_file(cache, &files[i], options, &stats);
+                }
+            }
+            pending = 0;
+        }
+
+        /* Gather events until none came for DEBOUNCE_MS */
+        do
+        {
+            ready = poll(&watch, 1, pending ? DEBOUNCE_MS : -1);
+            if (ready < 0 && errno != EINTR)
+            {
+                fprintf(stderr, "Error: Cannot wait for changes: %s\n", strerror(errno));
+                goto failed;
+            }
+            if (ready <= 0)
+            {
+                continue;
+            }
+            length = read(watch.fd, buffer.bytes, sizeof(buffer.bytes));
+            for (offset = 0; offset < length; offset += (ssize_t)sizeof(struct inotify_event) + event->len)
+            {
+                event = (const struct inotify_event *)(buffer.bytes + offset);
+                pending |= mark_changed(files, name_count, event);
+            }
+        } while (ready != 0 || !pending);
+    }
+
+failed:
+    if (watch.fd >= 0)
+    {
+        close(watch.fd);
+    }
+    result_cache_free(cache);
+    free(files);
+    return 1;
+}